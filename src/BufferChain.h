@@ -0,0 +1,367 @@
+/**
+ * Chain of buffers in the style of BSD mbuf
+ * A packet is a list of segments. Every segment points to a range of bytes in a block
+ * allocated from a MemoryPoolRaw (or MemoryPoolBitmap). Protocol layers can add headers
+ * in front of the packet, append payload, split a packet and clone it without copying
+ * the payload. The chain can be handed to writev() as an array of iovec.
+ *
+ * A block can be referenced by more than one segment, for example after clone() or
+ * split(). The first bytes of the block keep a reference counter, see PooledBuffer, the
+ * last segment which releases the block returns it to the pool. A shared block is read
+ * only - append and prepend do not write to a block with reference counter above one.
+ *
+ * The code is not thread safe.
+ *
+ * Example of usage:
+ *
+ *   static MemoryPool<LockDummy, BufferSegment, 64> segmentPool("segments");
+ *   typedef BufferChain<MemoryPoolRaw<LockDummy, 16>, MemoryPool<LockDummy, BufferSegment, 64> > MyBufferChain;
+ *   MyBufferChain packet(dataPool, segmentPool, 32);
+ *   packet.append(payload, sizeof(payload));
+ *   uint8_t *header;
+ *   packet.prepend(sizeof(MyHeader), &header);
+ *   struct iovec iov[4];
+ *   size_t count = packet.getIovec(iov, 4);
+ *   writev(fd, iov, count);
+ */
+
+#pragma once
+
+#include <sys/uio.h>
+
+#include "PooledBuffer.h"
+
+struct BufferSegment {
+    BufferSegment* next;
+    uint8_t* block;
+    uint8_t* data;
+    size_t size;
+};
+
+template<typename DataPool, typename SegmentPool> class BufferChain {
+
+public:
+
+    /**
+     * @param headroom - bytes reserved in front of the data in the first block
+     * for headers added later by prepend(). The first block shall keep at least one
+     * byte of data, larger headroom is clamped, see getHeadroom()
+     */
+    BufferChain(DataPool& dataPool, SegmentPool& segmentPool, size_t headroom = 0) :
+        dataPool(dataPool), segmentPool(segmentPool), headroom(clampHeadroom(dataPool, headroom)),
+        head(nullptr), tail(nullptr), size(0) {
+    }
+
+    ~BufferChain() {
+        clear();
+    }
+
+    /**
+     * Copy the data to the end of the chain. Use free space in the last block
+     * if possible, allocate more blocks if needed.
+     * If the function fails the chain can contain part of the data
+     */
+    bool append(const uint8_t* data, size_t size);
+
+    /**
+     * Reserve 'size' bytes in front of the chain and return pointer to the reserved
+     * space. The function uses the headroom of the first block if possible, otherwise
+     * allocates a new block. Size can not be larger than a block.
+     */
+    bool prepend(size_t size, uint8_t** data);
+
+    bool prepend(const uint8_t* data, size_t size) {
+        uint8_t* dst;
+        bool res = prepend(size, &dst);
+        if (res) {
+            memcpy(dst, data, size);
+        }
+        return res;
+    }
+
+    /**
+     * Move the bytes starting from 'offset' to the chain 'tailChain'. The block
+     * containing the offset is shared by both chains, no data is copied.
+     * tailChain is expected to be empty
+     */
+    bool split(size_t offset, BufferChain* tailChain);
+
+    /**
+     * Add to the chain 'dst' references to all blocks of this chain. No data is copied
+     */
+    bool clone(BufferChain* dst) const;
+
+    /**
+     * Fill the array iov. Returns number of used entries, the returned value can
+     * be smaller than getSegments() if maxIov is not large enough
+     */
+    size_t getIovec(struct iovec* iov, size_t maxIov) const;
+
+    /**
+     * Release all segments
+     */
+    void clear();
+
+    size_t getSize() const {
+        return size;
+    }
+
+    /**
+     * The headroom actually reserved, smaller than requested in the constructor
+     * if the requested headroom does not fit the block
+     */
+    size_t getHeadroom() const {
+        return headroom;
+    }
+
+    size_t getSegments() const {
+        size_t count = 0;
+        for (BufferSegment* segment = head;segment != nullptr;segment = segment->next) {
+            count++;
+        }
+        return count;
+    }
+
+protected:
+
+    typedef PooledBuffer<DataPool> Block;
+
+    inline uint8_t* getBlockStart(const BufferSegment* segment) const {
+        return segment->block + Block::HEADER_SIZE;
+    }
+
+    inline uint8_t* getBlockEnd(const BufferSegment* segment) const {
+        return segment->block + dataPool.getBlockSize();
+    }
+
+    static size_t clampHeadroom(const DataPool& dataPool, size_t headroom) {
+        size_t blockSize = dataPool.getBlockSize();
+        size_t maxHeadroom = (blockSize > Block::HEADER_SIZE) ? (blockSize - Block::HEADER_SIZE - 1) : 0;
+        return (headroom < maxHeadroom) ? headroom : maxHeadroom;
+    }
+
+    inline static bool isShared(const BufferSegment* segment) {
+        return (Block::getRefCount(segment->block) > 1);
+    }
+
+    /**
+     * Allocate a new block and a segment, the segment is empty and starts at 'offset'
+     * from the beginning of the block
+     */
+    BufferSegment* allocateSegment(size_t offset);
+
+    /**
+     * Allocate a segment which references the same block as 'segment'
+     */
+    BufferSegment* referenceSegment(const BufferSegment* segment) const;
+
+    void freeSegment(BufferSegment* segment);
+
+    void addTail(BufferSegment* segment) {
+        segment->next = nullptr;
+        if (tail != nullptr) {
+            tail->next = segment;
+        }
+        else {
+            head = segment;
+        }
+        tail = segment;
+        size += segment->size;
+    }
+
+    DataPool& dataPool;
+    SegmentPool& segmentPool;
+    size_t headroom;
+    BufferSegment* head;
+    BufferSegment* tail;
+    size_t size;
+};
+
+template<typename DataPool, typename SegmentPool>
+BufferSegment* BufferChain<DataPool, SegmentPool>::allocateSegment(size_t offset) {
+    BufferSegment* segment;
+    if (!segmentPool.allocate(&segment)) {
+        return nullptr;
+    }
+    uint8_t* block;
+    if (!dataPool.allocate(&block)) {
+        segmentPool.free(segment);
+        return nullptr;
+    }
+    if (!Block::isAligned(block)) {
+        dataPool.free(block);
+        segmentPool.free(segment);
+        return nullptr;
+    }
+    Block::attach(block, &dataPool);
+    segment->next = nullptr;
+    segment->block = block;
+    segment->data = block + Block::HEADER_SIZE + offset;
+    segment->size = 0;
+    return segment;
+}
+
+template<typename DataPool, typename SegmentPool>
+BufferSegment* BufferChain<DataPool, SegmentPool>::referenceSegment(const BufferSegment* segment) const {
+    BufferSegment* reference;
+    if (!segmentPool.allocate(&reference)) {
+        return nullptr;
+    }
+    *reference = *segment;
+    reference->next = nullptr;
+    Block::addReference(segment->block);
+    return reference;
+}
+
+template<typename DataPool, typename SegmentPool>
+void BufferChain<DataPool, SegmentPool>::freeSegment(BufferSegment* segment) {
+    Block::releaseReference(segment->block);
+    segmentPool.free(segment);
+}
+
+template<typename DataPool, typename SegmentPool>
+void BufferChain<DataPool, SegmentPool>::clear() {
+    BufferSegment* segment = head;
+    while (segment != nullptr) {
+        BufferSegment* next = segment->next;
+        freeSegment(segment);
+        segment = next;
+    }
+    head = nullptr;
+    tail = nullptr;
+    size = 0;
+}
+
+template<typename DataPool, typename SegmentPool>
+bool BufferChain<DataPool, SegmentPool>::append(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        BufferSegment* segment = tail;
+        size_t room = 0;
+        if ((segment != nullptr) && !isShared(segment)) {
+            room = getBlockEnd(segment) - (segment->data + segment->size);
+        }
+        if (room == 0) {
+            size_t offset = (head == nullptr) ? headroom : 0;
+            segment = allocateSegment(offset);
+            if (segment == nullptr) {
+                return false;
+            }
+            addTail(segment);
+            room = getBlockEnd(segment) - segment->data;
+            // A block which is not larger than the header
+            if (room == 0) {
+                return false;
+            }
+        }
+        size_t chunk = (size < room) ? size : room;
+        memcpy(segment->data + segment->size, data, chunk);
+        segment->size += chunk;
+        this->size += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+template<typename DataPool, typename SegmentPool>
+bool BufferChain<DataPool, SegmentPool>::prepend(size_t size, uint8_t** data) {
+    BufferSegment* segment = head;
+    bool fits = (segment != nullptr) && !isShared(segment);
+    fits = fits && ((size_t)(segment->data - getBlockStart(segment)) >= size);
+    if (!fits) {
+        size_t blockSize = dataPool.getBlockSize() - Block::HEADER_SIZE;
+        if (size > blockSize) {
+            return false;
+        }
+        segment = allocateSegment(blockSize);
+        if (segment == nullptr) {
+            return false;
+        }
+        segment->next = head;
+        head = segment;
+        if (tail == nullptr) {
+            tail = segment;
+        }
+    }
+    segment->data -= size;
+    segment->size += size;
+    this->size += size;
+    *data = segment->data;
+    return true;
+}
+
+template<typename DataPool, typename SegmentPool>
+bool BufferChain<DataPool, SegmentPool>::split(size_t offset, BufferChain* tailChain) {
+    if (offset > size) {
+        return false;
+    }
+    BufferSegment* prev = nullptr;
+    BufferSegment* segment = head;
+    size_t position = 0;
+    while ((segment != nullptr) && ((position + segment->size) <= offset)) {
+        position += segment->size;
+        prev = segment;
+        segment = segment->next;
+    }
+    if (segment == nullptr) {
+        return true;
+    }
+
+    // The offset is inside of the segment - both chains share the block
+    size_t skip = offset - position;
+    if (skip > 0) {
+        BufferSegment* reference = referenceSegment(segment);
+        if (reference == nullptr) {
+            return false;
+        }
+        reference->data += skip;
+        reference->size -= skip;
+        reference->next = segment->next;
+        segment->size = skip;
+        segment->next = nullptr;
+        prev = segment;
+        segment = reference;
+    }
+
+    // Move the segments to the tail chain
+    if (prev != nullptr) {
+        prev->next = nullptr;
+    }
+    else {
+        head = nullptr;
+    }
+    tail = prev;
+    while (segment != nullptr) {
+        BufferSegment* next = segment->next;
+        tailChain->addTail(segment);
+        segment = next;
+    }
+    this->size = offset;
+    return true;
+}
+
+template<typename DataPool, typename SegmentPool>
+bool BufferChain<DataPool, SegmentPool>::clone(BufferChain* dst) const {
+    for (BufferSegment* segment = head;segment != nullptr;segment = segment->next) {
+        BufferSegment* reference = referenceSegment(segment);
+        if (reference == nullptr) {
+            return false;
+        }
+        dst->addTail(reference);
+    }
+    return true;
+}
+
+template<typename DataPool, typename SegmentPool>
+size_t BufferChain<DataPool, SegmentPool>::getIovec(struct iovec* iov, size_t maxIov) const {
+    size_t count = 0;
+    for (BufferSegment* segment = head;(segment != nullptr) && (count < maxIov);segment = segment->next) {
+        if (segment->size == 0) {
+            continue;
+        }
+        iov[count].iov_base = segment->data;
+        iov[count].iov_len = segment->size;
+        count++;
+    }
+    return count;
+}
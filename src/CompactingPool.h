@@ -0,0 +1,187 @@
+/**
+ * Pool of objects which can move the objects to the beginning of the array
+ * The application keeps handles, not pointers. A handle is an entry in the table of
+ * handles (an IndexPool with generations) which keeps the index of the object.
+ *
+ * Allocation takes the lowest free slot, free() leaves a hole. After a long run
+ * the live objects are scattered and a scan of all objects touches many cache lines.
+ * compact() moves the last live objects to the lowest holes and updates the handles.
+ * The application calls compact() when idle, maxMoves limits the time spent in
+ * one call. When the pool is compact the live objects are the dense prefix
+ * objects[0..getCount()) and the scan is a sequential sweep of the memory.
+ *
+ * The objects are moved with memcpy, an object can not keep pointers to itself.
+ * A pointer returned by get() is valid until the next call to compact().
+ *
+ * The code is not thread safe.
+ *
+ * Example of usage:
+ *
+ *   typedef CompactingPool<Session, 1024> SessionPool;
+ *   static SessionPool sessionPool;
+ *   SessionPool::Handle handle;
+ *   if (sessionPool.allocate(&handle)) {
+ *       Session* session = sessionPool.get(handle);
+ *   }
+ *
+ *   // idle loop
+ *   sessionPool.compact(16);
+ *
+ *   uint_fast32_t index = 0;
+ *   Session* session;
+ *   while (sessionPool.getNext(index, &session) == SessionPool::GETNEXT_OK) {
+ *       checkTimeout(session);
+ *       index++;
+ *   }
+ */
+
+#pragma once
+
+#include "Memory.h"
+#include "IndexPool.h"
+
+template<typename T, size_t N> class CompactingPool {
+public:
+
+    typedef IndexPool<uint32_t, N, true> HandleTable;
+    typedef typename HandleTable::Handle Handle;
+
+    static const Handle ILLEGAL_HANDLE = HandleTable::ILLEGAL_HANDLE;
+
+    enum GetNextResult {
+        GETNEXT_OK,
+        GETNEXT_END_TABLE
+    };
+
+    CompactingPool() :
+        top(0) {
+        static_assert(std::is_trivially_copyable<T>::value, "CompactingPool moves the objects with memcpy, object shall be trivially copyable");
+    }
+
+    inline bool allocate(Handle* handle);
+
+    inline bool free(Handle handle);
+
+    /**
+     * Returns nullptr if the handle is illegal or stale
+     */
+    inline T* get(Handle handle) {
+        uint32_t* index = handles.get(handle);
+        return (index != nullptr) ? &objects[*index] : nullptr;
+    }
+
+    /**
+     * Move up to maxMoves objects to the holes in the beginning of the array
+     * Returns number of moved objects
+     */
+    size_t compact(size_t maxMoves);
+
+    bool isCompact() const {
+        return (top == getCount());
+    }
+
+    size_t getCount() const {
+        return handles.getCount();
+    }
+
+    /**
+     * Number of free slots between the live objects
+     */
+    size_t getHoles() const {
+        return top - getCount();
+    }
+
+    /**
+     * Find the first live object starting from 'index'
+     * @param index - position in the array of objects, the function updates the index
+     * @param handle - optional, the handle of the object
+     */
+    inline enum GetNextResult getNext(uint_fast32_t& index, T** object, Handle* handle = nullptr);
+
+protected:
+
+    /**
+     * Move 'top' below the highest live object
+     */
+    inline void shrinkTop() {
+        while ((top > 0) && !bitmap.isAllocated(top - 1)) {
+            top--;
+        }
+    }
+
+    T objects[N];
+    /**
+     * Handle of the object in the slot, required to update the handle when the object moves
+     */
+    Handle owners[N];
+    HandleTable handles;
+    BlockBitmap<N> bitmap;
+    /**
+     * Slots at and above 'top' are free
+     */
+    size_t top;
+};
+
+template<typename T, size_t N>
+inline bool CompactingPool<T, N>::allocate(Handle* handle) {
+    Handle res;
+    if (!handles.allocate(&res)) {
+        return false;
+    }
+    size_t index = 0;
+    bitmap.allocate(&index);
+    *handles.get(res) = index;
+    owners[index] = res;
+    if (index >= top) {
+        top = index + 1;
+    }
+    *handle = res;
+    return true;
+}
+
+template<typename T, size_t N>
+inline bool CompactingPool<T, N>::free(Handle handle) {
+    uint32_t* index = handles.get(handle);
+    if (index == nullptr) {
+        return false;
+    }
+    bitmap.free(*index);
+    handles.free(handle);
+    shrinkTop();
+    return true;
+}
+
+template<typename T, size_t N>
+size_t CompactingPool<T, N>::compact(size_t maxMoves) {
+    size_t moves = 0;
+    while ((moves < maxMoves) && !isCompact()) {
+        // There is a hole below 'top' and the slot top-1 is alive
+        size_t hole = 0;
+        bitmap.allocate(&hole);
+        size_t last = top - 1;
+        memcpy(&objects[hole], &objects[last], sizeof(T));
+        Handle owner = owners[last];
+        owners[hole] = owner;
+        *handles.get(owner) = hole;
+        bitmap.free(last);
+        shrinkTop();
+        moves++;
+    }
+    return moves;
+}
+
+template<typename T, size_t N>
+inline enum CompactingPool<T, N>::GetNextResult
+CompactingPool<T, N>::getNext(uint_fast32_t& index, T** object, Handle* handle) {
+    for (uint_fast32_t i = index;i < top;i++) {
+        if (bitmap.isAllocated(i)) {
+            *object = &objects[i];
+            if (handle != nullptr) {
+                *handle = owners[i];
+            }
+            index = i;
+            return GETNEXT_OK;
+        }
+    }
+    return GETNEXT_END_TABLE;
+}
@@ -0,0 +1,370 @@
+/**
+ * Epoch based reclamation (EBR) of objects removed from lock-free containers
+ *
+ * A reader can not know if another thread freed the object the reader is about
+ * to dereference. With EBR a thread removing an object from a container does not
+ * free the object, but retires it. The object goes back to the pool only after all
+ * threads which could see the object left their critical sections.
+ *
+ * There is a global epoch counter. A thread announces the global epoch when it enters
+ * a critical section (a lookup, for example) and clears the announcement when it
+ * exits. The global epoch advances only when all active threads announced the
+ * current epoch. An object retired in the epoch E can be freed when the global epoch
+ * reached E+2 - no thread can hold a reference to the object anymore.
+ *
+ * Every thread keeps its own retire lists, one list for each of the last three epochs.
+ * Retire and reclaim do not require synchronization between the threads.
+ * The slot in the table of threads is the process wide index of the thread, see
+ * epochReclamationThreadIndex(). The index returns to the free list when the thread
+ * exits and the next thread inherits the slot with the objects retired there. Up to
+ * MaxThreads threads can live at the same time. In other threads enter() fails and
+ * the thread shall not access the container - check Guard::isActive().
+ *
+ * Pool is any type which implements free(ObjectType*), for example MemoryPool. The
+ * pool is called from different threads and shall use a real lock.
+ *
+ * Example of usage:
+ *
+ *   typedef MemoryPool<MyLock, Route, 1024> RoutePool;
+ *   static RoutePool routePool("routes");
+ *   static EpochReclamation<Route, RoutePool> routeReclamation(routePool);
+ *
+ *   // reader
+ *   {
+ *       EpochReclamation<Route, RoutePool>::Guard guard(routeReclamation);
+ *       Route* route;
+ *       if (guard.isActive() && routeTable->search(key, &route))
+ *           forward(packet, route->nextHop);
+ *   }
+ *
+ *   // writer
+ *   {
+ *       EpochReclamation<Route, RoutePool>::Guard guard(routeReclamation);
+ *       Route* route;
+ *       if (guard.isActive() && routeTable->remove(key, &route))
+ *           routeReclamation.retire(route);
+ *   }
+ */
+
+#pragma once
+
+#include <atomic>
+
+/**
+ * Process wide index of a thread. A living thread owns a bit in the bitmap, the lowest
+ * free bit is taken when the thread calls epochReclamationThreadIndex() the first time
+ * and is released when the thread exits. The indexes stay below the number of living
+ * threads and the tables of threads are not exhausted by short living threads.
+ */
+class EpochReclamationThreadIndex {
+
+public:
+
+    /**
+     * Index of a thread if all MAX_THREADS indexes are taken
+     */
+    static const size_t MAX_THREADS = 1024;
+
+    EpochReclamationThreadIndex() :
+        index(allocate()) {
+    }
+
+    ~EpochReclamationThreadIndex() {
+        release(index);
+    }
+
+    size_t get() const {
+        return index;
+    }
+
+protected:
+
+    typedef uint64_t Word;
+    static const size_t BITS = 8*sizeof(Word);
+    static const size_t WORDS = MAX_THREADS / BITS;
+
+    /**
+     * Zero initialized static storage, all indexes are free
+     */
+    static std::atomic<Word>* getBitmap() {
+        static std::atomic<Word> bitmap[WORDS];
+        return bitmap;
+    }
+
+    static size_t allocate() {
+        std::atomic<Word>* bitmap = getBitmap();
+        for (size_t i = 0;i < WORDS;i++) {
+            Word word = bitmap[i].load(std::memory_order_relaxed);
+            while (~word != 0) {
+                Word bit = (Word)1 << __builtin_ctzll(~word);
+                // Acquire the slot state left by the previous owner of the index
+                if (bitmap[i].compare_exchange_weak(word, word | bit, std::memory_order_acq_rel)) {
+                    return i * BITS + __builtin_ctzll(bit);
+                }
+            }
+        }
+        return MAX_THREADS;
+    }
+
+    static void release(size_t index) {
+        if (index < MAX_THREADS) {
+            getBitmap()[index / BITS].fetch_and(~((Word)1 << (index % BITS)), std::memory_order_release);
+        }
+    }
+
+    size_t index;
+};
+
+inline size_t epochReclamationThreadIndex() {
+    static thread_local EpochReclamationThreadIndex threadIndex;
+    return threadIndex.get();
+}
+
+template<typename ObjectType, typename Pool, size_t MaxThreads = 64, size_t RetireListSize = 128>
+class EpochReclamation {
+
+public:
+
+    EpochReclamation(Pool& pool) :
+        pool(pool), globalEpoch(EPOCH_INCREMENT), threadsCount(0) {
+        for (size_t i = 0;i < MaxThreads;i++) {
+            ThreadState& thread = threads[i];
+            thread.epoch.store(0, std::memory_order_relaxed);
+            for (int j = 0;j < EPOCHS;j++) {
+                thread.retired[j].epoch = 0;
+                thread.retired[j].count = 0;
+            }
+        }
+        statistics.retireTotal.store(0, std::memory_order_relaxed);
+        statistics.retireFailed.store(0, std::memory_order_relaxed);
+        statistics.reclaimed.store(0, std::memory_order_relaxed);
+        statistics.epochAdvance.store(0, std::memory_order_relaxed);
+        statistics.threadsOverflow.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * Free all retired objects. No thread can be inside a critical section
+     */
+    ~EpochReclamation() {
+        for (size_t i = 0;i < MaxThreads;i++) {
+            for (int j = 0;j < EPOCHS;j++) {
+                freeList(threads[i].retired[j]);
+            }
+        }
+    }
+
+    /**
+     * Read side critical section
+     */
+    class Guard {
+    public:
+        Guard(EpochReclamation& reclamation) : reclamation(reclamation), active(reclamation.enter()) {
+        }
+        ~Guard() {
+            if (active) {
+                reclamation.exit();
+            }
+        }
+        /**
+         * False if enter() failed. The thread is not protected and shall not
+         * dereference objects from the container
+         */
+        bool isActive() const {
+            return active;
+        }
+    protected:
+        EpochReclamation& reclamation;
+        bool active;
+    };
+
+    /**
+     * The counters are updated by all threads, relaxed atomic increments
+     */
+    struct Statistics {
+        std::atomic<uint64_t> retireTotal;
+        std::atomic<uint64_t> retireFailed;
+        std::atomic<uint64_t> reclaimed;
+        std::atomic<uint64_t> epochAdvance;
+        std::atomic<uint64_t> threadsOverflow;
+    };
+
+    /**
+     * Enter a critical section. Critical sections can not be nested.
+     * Returns false if there are more than MaxThreads threads, see Guard
+     */
+    inline bool enter() __attribute__((warn_unused_result));
+
+    inline void exit();
+
+    /**
+     * Return the object to the pool after all threads leave the critical sections
+     * they could get the object in. The function fails if the retire list of the
+     * current epoch is full and the epoch can not advance. The caller can keep the
+     * object and try again later
+     */
+    inline bool retire(ObjectType* object);
+
+    /**
+     * Try to advance the global epoch and free objects retired by the calling thread.
+     * Threads which retire objects but rarely enter/exit critical sections
+     * shall call the function periodically
+     */
+    void reclaim();
+
+    const Statistics& getStatistics() const {
+        return statistics;
+    }
+
+protected:
+
+    /**
+     * Bit 0 in the announced epoch is set while the thread is in a critical section
+     */
+    static const uint64_t ACTIVE = 1;
+    static const uint64_t EPOCH_INCREMENT = 2;
+    static const int EPOCHS = 3;
+
+    struct RetireList {
+        uint64_t epoch;
+        size_t count;
+        ObjectType* objects[RetireListSize];
+    };
+
+    struct alignas(64) ThreadState {
+        std::atomic<uint64_t> epoch;
+        RetireList retired[EPOCHS];
+    };
+
+    inline ThreadState* getThreadState() {
+        size_t index = epochReclamationThreadIndex();
+        if (index >= MaxThreads) {
+            statisticsAdd(statistics.threadsOverflow);
+            return nullptr;
+        }
+        size_t count = threadsCount.load(std::memory_order_relaxed);
+        while ((count <= index) &&
+            !threadsCount.compare_exchange_weak(count, index+1, std::memory_order_relaxed)) {
+        }
+        return &threads[index];
+    }
+
+    inline static void statisticsAdd(std::atomic<uint64_t>& counter, uint64_t value = 1) {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    inline static RetireList& getList(ThreadState* thread, uint64_t epoch) {
+        return thread->retired[(epoch / EPOCH_INCREMENT) % EPOCHS];
+    }
+
+    void freeList(RetireList& list) {
+        for (size_t i = 0;i < list.count;i++) {
+            pool.free(list.objects[i]);
+        }
+        statisticsAdd(statistics.reclaimed, list.count);
+        list.count = 0;
+    }
+
+    /**
+     * Free the lists retired two or more epochs ago
+     */
+    void freeLists(ThreadState* thread, uint64_t epoch) {
+        for (int j = 0;j < EPOCHS;j++) {
+            RetireList& list = thread->retired[j];
+            if ((list.count > 0) && ((list.epoch + 2*EPOCH_INCREMENT) <= epoch)) {
+                freeList(list);
+            }
+        }
+    }
+
+    /**
+     * The global epoch advances if all threads in critical sections announced
+     * the current epoch
+     */
+    bool tryAdvance(uint64_t epoch);
+
+    Pool& pool;
+    std::atomic<uint64_t> globalEpoch;
+    std::atomic<size_t> threadsCount;
+    ThreadState threads[MaxThreads];
+    Statistics statistics;
+};
+
+template<typename ObjectType, typename Pool, size_t MaxThreads, size_t RetireListSize>
+inline bool EpochReclamation<ObjectType, Pool, MaxThreads, RetireListSize>::enter() {
+    ThreadState* thread = getThreadState();
+    if (thread == nullptr) {
+        return false;
+    }
+    uint64_t epoch = globalEpoch.load(std::memory_order_relaxed);
+    thread->epoch.store(epoch | ACTIVE, std::memory_order_relaxed);
+    // The announcement shall be visible before the thread reads the container
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return true;
+}
+
+template<typename ObjectType, typename Pool, size_t MaxThreads, size_t RetireListSize>
+inline void EpochReclamation<ObjectType, Pool, MaxThreads, RetireListSize>::exit() {
+    ThreadState* thread = getThreadState();
+    if (thread == nullptr) {
+        return;
+    }
+    uint64_t epoch = thread->epoch.load(std::memory_order_relaxed);
+    thread->epoch.store(epoch & ~ACTIVE, std::memory_order_release);
+}
+
+template<typename ObjectType, typename Pool, size_t MaxThreads, size_t RetireListSize>
+bool EpochReclamation<ObjectType, Pool, MaxThreads, RetireListSize>::tryAdvance(uint64_t epoch) {
+    size_t count = threadsCount.load(std::memory_order_acquire);
+    for (size_t i = 0;i < count;i++) {
+        uint64_t threadEpoch = threads[i].epoch.load(std::memory_order_acquire);
+        if ((threadEpoch & ACTIVE) && ((threadEpoch & ~ACTIVE) != epoch)) {
+            return false;
+        }
+    }
+    bool res = globalEpoch.compare_exchange_strong(epoch, epoch + EPOCH_INCREMENT, std::memory_order_acq_rel);
+    if (res) {
+        statisticsAdd(statistics.epochAdvance);
+    }
+    return res;
+}
+
+template<typename ObjectType, typename Pool, size_t MaxThreads, size_t RetireListSize>
+void EpochReclamation<ObjectType, Pool, MaxThreads, RetireListSize>::reclaim() {
+    ThreadState* thread = getThreadState();
+    if (thread == nullptr) {
+        return;
+    }
+    uint64_t epoch = globalEpoch.load(std::memory_order_acquire);
+    tryAdvance(epoch);
+    epoch = globalEpoch.load(std::memory_order_acquire);
+    freeLists(thread, epoch);
+}
+
+template<typename ObjectType, typename Pool, size_t MaxThreads, size_t RetireListSize>
+inline bool EpochReclamation<ObjectType, Pool, MaxThreads, RetireListSize>::retire(ObjectType* object) {
+    ThreadState* thread = getThreadState();
+    if (thread == nullptr) {
+        return false;
+    }
+    statisticsAdd(statistics.retireTotal);
+    uint64_t epoch = globalEpoch.load(std::memory_order_acquire);
+    freeLists(thread, epoch);
+    RetireList* list = &getList(thread, epoch);
+    if (list->count == RetireListSize) {
+        reclaim();
+        epoch = globalEpoch.load(std::memory_order_acquire);
+        list = &getList(thread, epoch);
+    }
+    if (list->count == RetireListSize) {
+        statisticsAdd(statistics.retireFailed);
+        return false;
+    }
+    list->epoch = epoch;
+    list->objects[list->count] = object;
+    list->count++;
+    // Advance the epoch early, the list is recycled after two more epochs
+    if (list->count >= (RetireListSize / 2)) {
+        tryAdvance(epoch);
+    }
+    return true;
+}
@@ -38,7 +38,15 @@
 
 #pragma once
 
+#include <string.h>
+#include <type_traits>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HASH_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
 #include "ObjectRegistry.h"
+#include "EpochReclamation.h"
 
 class HashTableBase;
 
@@ -75,6 +83,10 @@ public:
         uint64_t rehashFailed;
         uint64_t rehashDone;
         uint64_t rehashCollision;
+        /**
+         * Incremental rehashes, rehashTotal counts all rehashes
+         */
+        uint64_t rehashIncremental;
     };
 
     /**
@@ -151,6 +163,258 @@ protected:
     }
 };
 
+/**
+ * Statistics policies of the hash tables
+ *
+ * HashTableStatisticsShared - the counters in HashTableBase, the default. Every operation
+ * writes the same cache line. Without a lock the counters are approximate.
+ * HashTableStatisticsSharded - every thread updates its own cache line, getStatistics()
+ * sums the shards. The shard is the index of the thread, see epochReclamationThreadIndex().
+ * Threads with an index above Shards share one overflow shard and update it with atomic
+ * adds, the counters stay exact. The owner of a shard updates the counter with relaxed
+ * atomic load and store, collect() reads the counters with relaxed atomic loads.
+ * HashTableStatisticsNone - the counters are compiled out, getStatistics() returns zeros.
+ *
+ * getLocal() returns the counters of the calling thread. The lockfree tables call it once
+ * per operation and update the counters with Local::add() and Local::addCount()
+ *
+ * The policies of LockfreeHashTable maintain the number of entries as well: sharded
+ * count is exact, HashTableStatisticsNone does not count the entries, getCount() returns zero.
+ */
+class HashTableStatisticsShared
+{
+public:
+    typedef HashTableBase::Statistics Statistics;
+
+    class Local
+    {
+    public:
+        Local(Statistics &statistics, uint_fast32_t &count) :
+            statistics(statistics), count(count)
+        {
+        }
+
+        inline void add(uint64_t Statistics::*counter, uint64_t value = 1)
+        {
+            statistics.*counter += value;
+        }
+
+        inline void addCount(int value)
+        {
+            count += value;
+        }
+
+    protected:
+        Statistics &statistics;
+        uint_fast32_t &count;
+    };
+
+    inline Local getLocal(Statistics &statistics, uint_fast32_t &count)
+    {
+        return Local(statistics, count);
+    }
+
+    inline void add(Statistics &statistics, uint64_t Statistics::*counter, uint64_t value = 1)
+    {
+        statistics.*counter += value;
+    }
+
+    inline void addCount(uint_fast32_t &count, int value)
+    {
+        count += value;
+    }
+
+    inline uint_fast32_t getCount(uint_fast32_t count) const
+    {
+        return count;
+    }
+
+    void collect(Statistics &statistics) const
+    {
+    }
+
+    void reset()
+    {
+    }
+};
+
+template<size_t Shards = 64> class HashTableStatisticsSharded
+{
+public:
+    typedef HashTableBase::Statistics Statistics;
+
+protected:
+
+    struct alignas(64) Shard
+    {
+        Statistics statistics;
+        std::atomic<int64_t> count;
+    };
+
+public:
+
+    class Local
+    {
+    public:
+        Local(Shard &shard, bool exclusive) :
+            shard(shard), exclusive(exclusive)
+        {
+        }
+
+        inline void add(uint64_t Statistics::*counter, uint64_t value = 1)
+        {
+            uint64_t *p = &(shard.statistics.*counter);
+            if (exclusive)
+            {
+                // Single writer, a relaxed load and store are enough and do not lock the bus
+                __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+            }
+            else
+            {
+                __atomic_fetch_add(p, value, __ATOMIC_RELAXED);
+            }
+        }
+
+        inline void addCount(int value)
+        {
+            shard.count.fetch_add(value, std::memory_order_relaxed);
+        }
+
+    protected:
+        Shard &shard;
+        bool exclusive;
+    };
+
+    HashTableStatisticsSharded()
+    {
+        reset();
+        for (size_t i = 0;i < SHARDS;i++)
+        {
+            shards[i].count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    inline Local getLocal(Statistics &statistics, uint_fast32_t &count)
+    {
+        return getLocal();
+    }
+
+    inline void add(Statistics &statistics, uint64_t Statistics::*counter, uint64_t value = 1)
+    {
+        getLocal().add(counter, value);
+    }
+
+    inline void addCount(uint_fast32_t &count, int value)
+    {
+        getLocal().addCount(value);
+    }
+
+    uint_fast32_t getCount(uint_fast32_t count) const
+    {
+        int64_t sum = 0;
+        for (size_t i = 0;i < SHARDS;i++)
+        {
+            sum += shards[i].count.load(std::memory_order_relaxed);
+        }
+        return (uint_fast32_t)sum;
+    }
+
+    /**
+     * Sum of the counters in all shards
+     */
+    void collect(Statistics &statistics) const
+    {
+        static_assert((sizeof(Statistics) % sizeof(uint64_t)) == 0, "Statistics is expected to be an array of uint64_t");
+        const size_t counters = sizeof(Statistics) / sizeof(uint64_t);
+        uint64_t *sum = reinterpret_cast<uint64_t*>(&statistics);
+        memset(sum, 0, sizeof(Statistics));
+        for (size_t i = 0;i < SHARDS;i++)
+        {
+            const uint64_t *shard = reinterpret_cast<const uint64_t*>(&shards[i].statistics);
+            for (size_t j = 0;j < counters;j++)
+            {
+                sum[j] += __atomic_load_n(&shard[j], __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    void reset()
+    {
+        const size_t counters = sizeof(Statistics) / sizeof(uint64_t);
+        for (size_t i = 0;i < SHARDS;i++)
+        {
+            uint64_t *shard = reinterpret_cast<uint64_t*>(&shards[i].statistics);
+            for (size_t j = 0;j < counters;j++)
+            {
+                __atomic_store_n(&shard[j], 0, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+protected:
+
+    /**
+     * The last shard is shared by the threads with the index above Shards
+     */
+    static const size_t SHARDS = Shards + 1;
+
+    inline Local getLocal()
+    {
+        size_t index = epochReclamationThreadIndex();
+        if (index < Shards)
+        {
+            return Local(shards[index], true);
+        }
+        return Local(shards[Shards], false);
+    }
+
+    Shard shards[SHARDS];
+};
+
+class HashTableStatisticsNone
+{
+public:
+    typedef HashTableBase::Statistics Statistics;
+
+    class Local
+    {
+    public:
+        inline void add(uint64_t Statistics::*counter, uint64_t value = 1)
+        {
+        }
+
+        inline void addCount(int value)
+        {
+        }
+    };
+
+    inline Local getLocal(Statistics &statistics, uint_fast32_t &count)
+    {
+        return Local();
+    }
+
+    inline void add(Statistics &statistics, uint64_t Statistics::*counter, uint64_t value = 1)
+    {
+    }
+
+    inline void addCount(uint_fast32_t &count, int value)
+    {
+    }
+
+    inline uint_fast32_t getCount(uint_fast32_t count) const
+    {
+        return 0;
+    }
+
+    void collect(Statistics &statistics) const
+    {
+    }
+
+    void reset()
+    {
+    }
+};
+
 /**
  * This class contains the core logic for the hash table
  *
@@ -174,7 +438,8 @@ protected:
  * The assumption is that collisions are very rare. For example, hash function for file paths can be
  * tested and, if necessary, tuned, in the initialization time.
  */
-template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator,
+    typename StatisticsPolicy = HashTableStatisticsShared>
 class HashTable: public HashTableBase
 {
 public:
@@ -193,16 +458,16 @@ public:
      * If the function fails often the application is expected to call rehash for a larger
      * table/different hash function
      */
-    enum InsertResult insert(const Key &key, const Object &object)
-    {
-        InsertResult insertResult = insert(key, object, this->table, getSize(), *this);
-        return insertResult;
-    }
+    enum InsertResult insert(const Key &key, const Object &object);
 
 
     /**
      * Insert with automatic call to rehash if the space is running low. Tries to avoid
      * collisions at cost of larger table. See setResizeFactor()
+     * A collision starts an incremental rehash to a larger table. If the insert fails
+     * or an object of the old tables does not fit the current table the function
+     * chains another incremental rehash to a larger table. The function never moves
+     * all objects at once.
      *
      * @param maxSize - maximum size for the table
      */
@@ -220,9 +485,20 @@ public:
      */
     bool search(const Key &key, Object *object, bool skipKeyCompare=false);
 
+    /**
+     * Look up 'count' keys under one lock. The function hashes a group of keys and
+     * prefetches the entries, then prefetches the objects the entries point to and
+     * only then compares the first key. Cache misses of the keys in the group overlap
+     * instead of stalling one after another. A key which is not found gets
+     * illegalValue in 'objects'
+     * Returns number of found keys
+     */
+    size_t searchBatch(const Key *keys, size_t count, Object *objects);
+
     /**
      * The function is not safe. Making the table smaller can cause dropping
-     * of stored elements
+     * of stored elements. If an element does not fit the new table the function
+     * returns INSERT_COLLISION and keeps the existing table
      *
      * Call the function if size/count ratio is below 2
      * or you are getting collisions often or you tune the hash function
@@ -253,6 +529,39 @@ public:
         return result;
     }
 
+    /**
+     * Allocate a new table and return immediately. Every following insert,
+     * remove and search moves a few entries from the old table, see setRehashStep().
+     * Until all entries are moved search and remove look in both tables.
+     * The cost of the rehash is spread over many operations and there is no long
+     * pause when a large table grows.
+     *
+     * If a rehash is in progress the current table joins the old tables, search and
+     * remove look in all of them. An object which does not fit the new table stays
+     * in the old table, see statistics.rehashCollision. insert() with maxSize starts
+     * the next incremental rehash in this case
+     *
+     * @param size - new size of the hash table
+     */
+    enum InsertResult rehashIncremental(const uint_fast32_t size);
+
+    /**
+     * True if an incremental rehash is in progress
+     */
+    bool isRehashing() const
+    {
+        return (oldTables != nullptr);
+    }
+
+    /**
+     * Number of entries of the old table moved by every operation during
+     * incremental rehash. Default is 16
+     */
+    void setRehashStep(uint_fast32_t entries)
+    {
+        this->rehashStep = (entries > 0) ? entries : 1;
+    }
+
     enum GetNextResult
     {
         GETNEXT_FAILED,
@@ -274,6 +583,110 @@ public:
      */
     enum GetNextResult getNext(uint_fast32_t &index, Object *object) const;
 
+    /**
+     * Copy of the stored objects. The constructor takes the lock for a copy of the
+     * occupied entries, getNext() runs on the copy and does not block the writers.
+     * A long scan, for example a dump of the statistics, does not stall the hot path.
+     * The objects removed from the table after the copy are still in the snapshot -
+     * the application shall not free the objects while a snapshot is in use.
+     *
+     *   MyHashTable::Snapshot snapshot(*hashTable);
+     *   uint_fast32_t index = 0;
+     *   while (snapshot.getNext(index, &pMyHashObject) != MyHashTable::GETNEXT_END_TABLE)
+     *   {
+     *       ....
+     *       index++;
+     *   }
+     */
+    class Snapshot
+    {
+    public:
+        Snapshot(const HashTable &hashTable) : objects(nullptr), count(0)
+        {
+            // Allocate outside of the lock, retry if the table grows meanwhile
+            uint_fast32_t capacity = hashTable.getCount() + hashTable.getCount() / 8 + 16;
+            while (true)
+            {
+                objects = (Object*)Allocator::alloc(capacity * sizeof(Object));
+                if (objects == nullptr)
+                {
+                    return;
+                }
+                {
+                    Lock lock;
+                    if (copy(hashTable, capacity))
+                    {
+                        return;
+                    }
+                    capacity = hashTable.getCount() + hashTable.getCount() / 8 + 16;
+                }
+                Allocator::free((void*)objects);
+                objects = nullptr;
+            }
+        }
+
+        ~Snapshot()
+        {
+            if (objects != nullptr)
+            {
+                Allocator::free((void*)objects);
+            }
+        }
+
+        /**
+         * Returns false if the allocation failed
+         */
+        bool isValid() const
+        {
+            return (objects != nullptr);
+        }
+
+        uint_fast32_t getCount() const
+        {
+            return count;
+        }
+
+        /**
+         * Same as HashTable::getNext()
+         */
+        enum GetNextResult getNext(uint_fast32_t &index, Object *object) const
+        {
+            if (index >= count)
+            {
+                return GETNEXT_END_TABLE;
+            }
+            *object = objects[index];
+            return GETNEXT_OK;
+        }
+
+    protected:
+        /**
+         * The caller holds the lock. Returns false if the objects do not fit
+         */
+        bool copy(const HashTable &hashTable, uint_fast32_t capacity)
+        {
+            uint_fast32_t index = 0;
+            Object object;
+            count = 0;
+            while (hashTable.getNext(index, &object) == GETNEXT_OK)
+            {
+                if (count == capacity)
+                {
+                    return false;
+                }
+                objects[count++] = object;
+                index++;
+            }
+            return true;
+        }
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        Object *objects;
+        uint_fast32_t count;
+    };
+
 
     /**
      * By default the table assumes that nullptr means that the entry is not
@@ -285,6 +698,21 @@ public:
         this->illegalValue = value;
     }
 
+    /**
+     * See HashTableStatisticsShared, HashTableStatisticsSharded
+     */
+    const struct Statistics *getStatistics()
+    {
+        counters.collect(statistics);
+        return &statistics;
+    }
+
+    void resetStatistics()
+    {
+        HashTableBase::resetStatistics();
+        counters.reset();
+    }
+
     /**
      * Hash tables can be allocated in different types of memory. For example paged memory,
      * non paged memory, in cache, etc.
@@ -316,6 +744,7 @@ public:
      */
     static void destroy(HashTable *hashTable)
     {
+        hashTable->freeOldTables();
         hashTable->~HashTable();
         freeTable(hashTable->table);
         Allocator::free((void *)hashTable);
@@ -324,6 +753,11 @@ public:
 protected:
 
     static const int MAX_COLLISIONS = 3;
+    static const uint_fast32_t REHASH_STEP = 16;
+    /**
+     * Number of prefetches in flight in searchBatch()
+     */
+    static const size_t SEARCH_BATCH = 16;
 
     static uint_fast32_t getIndex(const Key &key, uint_fast32_t size)
     {
@@ -332,6 +766,18 @@ protected:
         return index;
     }
 
+    /**
+     * Comparator reads the object if the table keeps pointers
+     */
+    static inline void prefetchObject(const Object &object, std::true_type)
+    {
+        __builtin_prefetch(object);
+    }
+
+    static inline void prefetchObject(const Object &, std::false_type)
+    {
+    }
+
     typedef Object TableEntry;
     typedef TableEntry *Table;
 
@@ -342,6 +788,9 @@ protected:
         this->size = size;
         this->table = table;
         this->illegalValue = nullptr;
+        this->oldTables = nullptr;
+        this->rehashStep = REHASH_STEP;
+        this->rehashStalled = false;
         resetStatistics();
     }
 
@@ -369,18 +818,99 @@ protected:
 
     static uint_fast32_t applyResizeFactor(uint_fast32_t size, uint_fast32_t maxSize, uint_fast32_t resizeFactor);
 
+    /**
+     * The caller holds the lock
+     */
     static enum InsertResult insert(const Key &key, const Object &object,
             Table table, uint_fast32_t size,
             HashTable &hashTable);
 
+    TableEntry *find(const Key &key, Table table, uint_fast32_t size, bool skipKeyCompare)
+    {
+        return find(key, &table[getIndex(key, size)], skipKeyCompare);
+    }
+
+    /**
+     * Probe MAX_COLLISIONS entries starting from 'tableEntry'
+     */
+    TableEntry *find(const Key &key, TableEntry *tableEntry, bool skipKeyCompare);
+
+    /**
+     * Move up to 'entries' entries from the oldest of the old tables to the current
+     * table if an incremental rehash is in progress. The caller holds the lock
+     */
+    void rehashMove(uint_fast32_t entries);
+
+    void rehashMove()
+    {
+        rehashMove(rehashStep);
+    }
+
+    /**
+     * A table being emptied by the incremental rehash
+     */
+    struct OldTable
+    {
+        Table table;
+        uint_fast32_t size;
+        uint_fast32_t rehashIndex;
+        OldTable *next;
+    };
+
+    /**
+     * Look for the key in the old tables. The caller holds the lock
+     */
+    TableEntry *findOld(const Key &key, bool skipKeyCompare)
+    {
+        for (OldTable *oldTable = oldTables;oldTable != nullptr;oldTable = oldTable->next)
+        {
+            TableEntry *tableEntry = find(key, oldTable->table, oldTable->size, skipKeyCompare);
+            if (tableEntry != nullptr)
+            {
+                return tableEntry;
+            }
+        }
+        return nullptr;
+    }
+
+    void freeOldTables()
+    {
+        while (oldTables != nullptr)
+        {
+            OldTable *next = oldTables->next;
+            freeTable(oldTables->table);
+            Allocator::free((void *)oldTables);
+            oldTables = next;
+        }
+    }
+
+
     Table table;
     TableEntry illegalValue;
+
+    /**
+     * The newest old table first. Usually there is one old table, an object which
+     * does not fit the current table chains another one
+     */
+    OldTable *oldTables;
+    uint_fast32_t rehashStep;
+    /**
+     * An entry of the old tables does not fit the current table
+     */
+    bool rehashStalled;
+
+    inline void statisticsAdd(uint64_t Statistics::*counter, uint64_t value = 1)
+    {
+        counters.add(statistics, counter, value);
+    }
+
+    StatisticsPolicy counters;
 };
 
 
-template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
 uint_fast32_t
-HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::applyResizeFactor(uint_fast32_t size, uint_fast32_t maxSize, uint_fast32_t resizeFactor)
+HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::applyResizeFactor(uint_fast32_t size, uint_fast32_t maxSize, uint_fast32_t resizeFactor)
 {
     uint_fast32_t newSize = (size * (100+resizeFactor))/100;
     if (newSize == size)
@@ -395,56 +925,48 @@ HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::applyResizeFactor(uin
 }
 
 
-template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
-enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
-HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::insert(const Key &key, const Object &object,
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::InsertResult
+HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::insert(const Key &key, const Object &object,
         uint_fast32_t maxSize)
 {
-    InsertResult insertResult;
-    bool inserted = false;
     /**
      * If a table does not have collisions it does not mean that I can insert an entry.
      * I will try to insert an entry first and check the return code.
-     * Resize the table if needed. Ensure that after resizing there is no collisions in
-     * the table.
+     * A collision starts incremental rehash, the table grows while the application
+     * keeps running. If the insert fails or an entry of the old tables does not fit
+     * the current table I start another incremental rehash to a larger table.
      */
-    do
+    InsertResult insertResult = insert(key, object);
+    bool inserted = (insertResult == INSERT_DONE) || (insertResult == INSERT_DUPLICATE);
+    bool grow = ((this->collisionsInTheTable > 0) && !isRehashing()) || !inserted || this->rehashStalled;
+    while (grow && (getSize() < maxSize))
     {
-        if (!inserted)
-        {
-            insertResult = insert(key, object);
-            inserted = (insertResult == INSERT_DONE);
-        }
-        if (this->collisionsInTheTable > 0)
+        uint_fast32_t newSize = applyResizeFactor(getSize(), maxSize, this->resizeFactor);
+        InsertResult rehashResult = rehashIncremental(newSize);
+        if (rehashResult == INSERT_FAILED)  // something very wrong, allocation problems?
         {
-            if (getSize() < maxSize)
-            {
-                uint_fast32_t newSize = applyResizeFactor(getSize(), maxSize, this->resizeFactor);
-                InsertResult rehashResult = rehash(newSize);
-                if (rehashResult != INSERT_DONE)
-                {
-                    insertResult = rehashResult;
-                }
-                if (rehashResult == INSERT_FAILED)  // something very wrong, allocation problems?
-                {
-                    break;
-                }
-            }
-            else // Reached maximum size
+            if (!inserted)
             {
-                break;
+                insertResult = rehashResult;
             }
+            break;
+        }
+        if (!inserted)
+        {
+            insertResult = insert(key, object);
+            inserted = (insertResult == INSERT_DONE) || (insertResult == INSERT_DUPLICATE);
         }
+        grow = !inserted;
     }
-    while ((insertResult != INSERT_DONE) || (this->collisionsInTheTable > 0));
 
     return insertResult;
 }
 
 
-template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
-enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
-HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::insert(const Key &key, const Object &object,
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::InsertResult
+HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::insert(const Key &key, const Object &object,
         Table table, uint_fast32_t size,
         HashTable &hashTable)
 {
@@ -453,11 +975,9 @@ HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::insert(const Key &key
     // The hash table size is a variable and not a constant - another complication
     // There is a modulus inside the method
     uint_fast32_t index = getIndex(key, size);
-    Statistics *statistics = &hashTable.statistics;
     TableEntry *tableEntry = &table[index];
 
-    Lock lock;
-    statistics->insertTotal++;
+    hashTable.statisticsAdd(&Statistics::insertTotal);
 
     // The following code is driven by necessity to release the lock before return from the
     // function. I want a single return point
@@ -466,10 +986,10 @@ HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::insert(const Key &key
     {
         insertResult = INSERT_COLLISION;
         tableEntry++;
-        const TableEntry *tableEntryLast = &table[index+MAX_COLLISIONS];
+        const TableEntry *tableEntryLast = &table[index+MAX_COLLISIONS-1];   // same window as search()
         for (;tableEntry <= tableEntryLast;tableEntry++)
         {
-            statistics->insertHashCollision++;
+            hashTable.statisticsAdd(&Statistics::insertHashCollision);
             hashTable.collisionsInTheTable++;
             if (*tableEntry == hashTable.illegalValue)
             {
@@ -481,7 +1001,7 @@ HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::insert(const Key &key
             if (result)
             {
                 insertResult = INSERT_DUPLICATE;
-                statistics->insertDuplicate++;
+                hashTable.statisticsAdd(&Statistics::insertDuplicate);
                 result = false;
                 break;
             }
@@ -496,31 +1016,110 @@ HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::insert(const Key &key
     }
     else
     {
-        statistics->insertHashMaxCollision++;
+        hashTable.statisticsAdd(&Statistics::insertHashMaxCollision);
     }
 
     return insertResult;
 }
 
-template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
-void HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::removeAll()
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::InsertResult
+HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::insert(const Key &key, const Object &object)
+{
+    Lock lock;
+    rehashMove();
+    // During incremental rehash the key can be in an old table
+    if ((oldTables != nullptr) && (findOld(key, false) != nullptr))
+    {
+        statisticsAdd(&Statistics::insertTotal);
+        statisticsAdd(&Statistics::insertDuplicate);
+        return INSERT_DUPLICATE;
+    }
+    InsertResult insertResult = insert(key, object, this->table, getSize(), *this);
+    return insertResult;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+typename HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::TableEntry *
+HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::find(const Key &key, TableEntry *tableEntry, bool skipKeyCompare)
+{
+    for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
+    {
+        if (*tableEntry != this->illegalValue)
+        {
+            if (skipKeyCompare || Comparator::equal(*tableEntry, key))
+            {
+                return tableEntry;
+            }
+        }
+        tableEntry++;                   // I can do this - table contains (size+MAX_COLLISIONS) entries
+    }
+    return nullptr;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+void HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::rehashMove(uint_fast32_t entries)
+{
+    rehashStalled = false;
+    while ((oldTables != nullptr) && (entries > 0))
+    {
+        OldTable **link = &oldTables;
+        while ((*link)->next != nullptr)
+        {
+            link = &(*link)->next;
+        }
+        OldTable *oldTable = *link;
+        const uint_fast32_t allocatedSize = getAllocatedSize(oldTable->size);
+        for (;(oldTable->rehashIndex < allocatedSize) && (entries > 0);oldTable->rehashIndex++, entries--)
+        {
+            TableEntry *tableEntry = &oldTable->table[oldTable->rehashIndex];
+            if (*tableEntry == this->illegalValue)
+            {
+                continue;
+            }
+            const Key &key = Hash::getKey(*tableEntry);
+            InsertResult insertResult = insert(key, *tableEntry, this->table, getSize(), *this);
+            if (insertResult != INSERT_DONE)
+            {
+                // Keep the entry in the old table and try again later
+                statisticsAdd(&Statistics::rehashCollision);
+                rehashStalled = true;
+                return;
+            }
+            this->count--;              // insert() counted the entry again
+            statisticsAdd(&Statistics::rehashDone);
+            *tableEntry = this->illegalValue;
+        }
+        if (oldTable->rehashIndex == allocatedSize)
+        {
+            *link = nullptr;
+            freeTable(oldTable->table);
+            Allocator::free((void *)oldTable);
+        }
+    }
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+void HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::removeAll()
 {
     Lock lock;
 
     uint_fast32_t bytes = getAllocatedSize(size) * sizeof(TableEntry);
     memset(table, 0, bytes);
+    freeOldTables();
     this->count = 0;
     this->collisionsInTheTable = 0;
 }
 
-template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
-bool HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::remove(const Key &key)
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+bool HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::remove(const Key &key)
 {
     bool result = false;
 
     Lock lock;
 
-    statistics.removeTotal++;
+    statisticsAdd(&Statistics::removeTotal);
+    rehashMove();
     uint_fast32_t index = getIndex(key, getSize());
     TableEntry *tableEntry = &this->table[index];
     for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
@@ -530,94 +1129,189 @@ bool HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::remove(const Key
             result = Comparator::equal(*tableEntry, key);
             if (result)
             {
-                statistics.removeOk++;
+                statisticsAdd(&Statistics::removeOk);
                 this->count--;
                 *tableEntry = this->illegalValue;
                 result = true;
                 this->collisionsInTheTable -= collisions;
+                break;
             }
             else
             {
-                statistics.removeCollision++;
+                statisticsAdd(&Statistics::removeCollision);
             }
         }
-        tableEntry++;                   // I can do this - table contains (size+MAX_COLLISIONS) entries
+        tableEntry++;                   // I can do this - table contains (size+MAX_COLLISIONS) entries
+    }
+
+    if (!result && (oldTables != nullptr))
+    {
+        tableEntry = findOld(key, false);
+        if (tableEntry != nullptr)
+        {
+            statisticsAdd(&Statistics::removeOk);
+            this->count--;
+            *tableEntry = this->illegalValue;
+            result = true;
+        }
+    }
+
+    if (!result)
+    {
+        statisticsAdd(&Statistics::removeFailed);
+    }
+
+
+    return result;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+bool HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::search(const Key &key, Object *object, bool skipKeyCompare)
+{
+    bool result = false;
+
+    Lock lock;
+    statisticsAdd(&Statistics::searchTotal);
+    rehashMove();
+
+    uint_fast32_t index = getIndex(key, getSize());
+    TableEntry *tableEntry = &this->table[index];
+    for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
+    {
+        if (*tableEntry != this->illegalValue)
+        {
+            result = skipKeyCompare;
+            if (!result)
+                result = Comparator::equal(*tableEntry, key);
+            else
+                statisticsAdd(&Statistics::searchSkipCompare);
+            if (result)
+            {
+                statisticsAdd(&Statistics::searchOk);
+                *object = *tableEntry;
+                result = true;
+                break;
+            }
+            else
+            {
+                statisticsAdd(&Statistics::removeCollision);
+            }
+        }
+        tableEntry++;                   // I can do this - table contains (size+MAX_COLLISIONS) entries
+    }
+
+    if (!result && (oldTables != nullptr))
+    {
+        tableEntry = findOld(key, skipKeyCompare);
+        if (tableEntry != nullptr)
+        {
+            statisticsAdd(&Statistics::searchOk);
+            *object = *tableEntry;
+            result = true;
+        }
     }
 
     if (!result)
     {
-        statistics.removeFailed++;
+        statisticsAdd(&Statistics::searchFailed);
     }
 
-
     return result;
 }
 
-template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
-bool HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::search(const Key &key, Object *object, bool skipKeyCompare)
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+size_t HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::searchBatch(const Key *keys, size_t count, Object *objects)
 {
-    bool result = false;
+    size_t found = 0;
 
     Lock lock;
-    statistics.searchTotal++;
+    rehashMove();
 
-    uint_fast32_t index = getIndex(key, getSize());
-    TableEntry *tableEntry = &this->table[index];
-    for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
+    for (size_t first = 0;first < count;first += SEARCH_BATCH)
     {
-        if (*tableEntry != this->illegalValue)
+        const size_t batch = ((count - first) < SEARCH_BATCH) ? (count - first) : SEARCH_BATCH;
+        TableEntry *tableEntries[SEARCH_BATCH];
+        // The first pass starts loading the entries, the second pass starts loading
+        // the objects in the first slots, the third pass compares the keys
+        for (size_t i = 0;i < batch;i++)
         {
-            result = skipKeyCompare;
-            if (!result)
-                result = Comparator::equal(*tableEntry, key);
-            else
-                statistics.searchSkipCompare++;
-            if (result)
+            tableEntries[i] = &this->table[getIndex(keys[first + i], getSize())];
+            __builtin_prefetch(tableEntries[i]);
+        }
+        for (size_t i = 0;i < batch;i++)
+        {
+            const Object &object = *tableEntries[i];
+            if (object != this->illegalValue)
             {
-                statistics.searchOk++;
-                *object = *tableEntry;
-                result = true;
-                break;
+                prefetchObject(object, std::is_pointer<Object>());
+            }
+        }
+        for (size_t i = 0;i < batch;i++)
+        {
+            const Key &key = keys[first + i];
+            TableEntry *tableEntry = find(key, tableEntries[i], false);
+            if ((tableEntry == nullptr) && (oldTables != nullptr))
+            {
+                tableEntry = findOld(key, false);
+            }
+            if (tableEntry != nullptr)
+            {
+                objects[first + i] = *tableEntry;
+                found++;
             }
             else
             {
-                statistics.removeCollision++;
+                objects[first + i] = this->illegalValue;
             }
         }
-        tableEntry++;                   // I can do this - table contains (size+MAX_COLLISIONS) entries
     }
 
-    if (!result)
-    {
-        statistics.searchFailed++;
-    }
+    statisticsAdd(&Statistics::searchTotal, count);
+    statisticsAdd(&Statistics::searchOk, found);
+    statisticsAdd(&Statistics::searchFailed, (count - found));
 
-    return result;
+    return found;
 }
 
-template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
-enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::GetNextResult
-HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::getNext(uint_fast32_t &index, Object *object) const
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::GetNextResult
+HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::getNext(uint_fast32_t &index, Object *object) const
 {
     enum GetNextResult result = GETNEXT_END_TABLE;
-    TableEntry *tableEntry = &table[index];
-    for (uint_fast32_t i = index;i < getAllocatedSize(getSize());i++)
+    // During incremental rehash the indexes above the current table are the old tables
+    const TableEntry *entries = table;
+    uint_fast32_t first = 0;
+    uint_fast32_t last = getAllocatedSize(getSize());
+    const OldTable *oldTable = oldTables;
+    uint_fast32_t i = index;
+    while (result != GETNEXT_OK)
     {
-        if (*tableEntry != this->illegalValue)
+        for (;i < last;i++)
+        {
+            if (entries[i - first] != this->illegalValue)
+            {
+                *object = entries[i - first];
+                index = i;
+                result = GETNEXT_OK;
+                break;
+            }
+        }
+        if ((result == GETNEXT_OK) || (oldTable == nullptr))
         {
-            *object = *tableEntry;
-            index = i;
-            result = GETNEXT_OK;
             break;
         }
-        tableEntry++;
+        entries = oldTable->table;
+        first = last;
+        last = first + getAllocatedSize(oldTable->size);
+        i = (i > first) ? i : first;
+        oldTable = oldTable->next;
     }
     return result;
 }
 
-template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
-enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
-HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::rehash(const HashTable *src, HashTable *dst)
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::InsertResult
+HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::rehash(const HashTable *src, HashTable *dst)
 {
     enum InsertResult rehashResult = INSERT_DONE;
     uint_fast32_t index = 0;
@@ -635,54 +1329,117 @@ HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::rehash(const HashTabl
     return rehashResult;
 }
 
-template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
-enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
-HashTable<Object, Key, Lock, Allocator, Hash, Comparator>::rehash(const uint_fast32_t size)
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::InsertResult
+HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::rehash(const uint_fast32_t size)
 {
     enum InsertResult rehashResult = INSERT_DONE;
     Object *newTable = allocateTable(size);
     if (newTable == nullptr)
     {
         Lock lock;
-        statistics.rehashTotal++;
-        statistics.rehashFailed++;
+        statisticsAdd(&Statistics::rehashTotal);
+        statisticsAdd(&Statistics::rehashFailed);
         return INSERT_FAILED;
     }
 
     Lock lock;
-    statistics.rehashTotal++;
+    statisticsAdd(&Statistics::rehashTotal);
 
+    uint_fast32_t count = this->count;
+    uint_fast32_t collisionsInTheTable = this->collisionsInTheTable;
     this->collisionsInTheTable = 0;
     this->count = 0;
-    TableEntry *tableEntry = &table[0];
-    for (int i = 0;i < getAllocatedSize(getSize());i++)
+    // Move the current table and the old tables of the incremental rehash
+    Table moveTable = this->table;
+    uint_fast32_t tableSize = getSize();
+    OldTable *oldTable = this->oldTables;
+    while ((moveTable != nullptr) && (rehashResult == INSERT_DONE))
     {
-        if (*tableEntry != this->illegalValue)
+        TableEntry *tableEntry = &moveTable[0];
+        for (uint_fast32_t i = 0;i < getAllocatedSize(tableSize);i++)
         {
-            const Key &key = Hash::getKey(*tableEntry);
-            InsertResult insertResult = insert(key, *tableEntry, newTable, size, *this);
-            if (insertResult != INSERT_DONE)
+            if (*tableEntry != this->illegalValue)
             {
-                rehashResult = INSERT_FAILED;
-                statistics.rehashCollision++;
+                const Key &key = Hash::getKey(*tableEntry);
+                InsertResult insertResult = insert(key, *tableEntry, newTable, size, *this);
+                if (insertResult != INSERT_DONE)
+                {
+                    rehashResult = INSERT_COLLISION;
+                    statisticsAdd(&Statistics::rehashCollision);
+                    break;
+                }
+                else
+                    statisticsAdd(&Statistics::rehashDone);
             }
-            else
-                statistics.rehashDone++;
+            tableEntry++;
         }
-        tableEntry++;
+        moveTable = (oldTable != nullptr) ? oldTable->table : nullptr;
+        tableSize = (oldTable != nullptr) ? oldTable->size : 0;
+        oldTable = (oldTable != nullptr) ? oldTable->next : nullptr;
+    }
+
+    // An object does not fit the new table - keep the existing tables, nothing is lost
+    if (rehashResult != INSERT_DONE)
+    {
+        freeTable(newTable);
+        this->count = count;
+        this->collisionsInTheTable = collisionsInTheTable;
+        return rehashResult;
     }
+
     freeTable(this->table);
+    freeOldTables();
+    this->rehashStalled = false;
     this->table = newTable;
     this->size = size;
 
     return rehashResult;
 }
 
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator, typename StatisticsPolicy>
+enum HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::InsertResult
+HashTable<Object, Key, Lock, Allocator, Hash, Comparator, StatisticsPolicy>::rehashIncremental(const uint_fast32_t size)
+{
+    Object *newTable = allocateTable(size);
+    OldTable *oldTable = (OldTable*)Allocator::alloc(sizeof(OldTable));
+    if ((newTable == nullptr) || (oldTable == nullptr))
+    {
+        if (newTable != nullptr)
+        {
+            freeTable(newTable);
+        }
+        if (oldTable != nullptr)
+        {
+            Allocator::free((void *)oldTable);
+        }
+        Lock lock;
+        statisticsAdd(&Statistics::rehashTotal);
+        statisticsAdd(&Statistics::rehashFailed);
+        return INSERT_FAILED;
+    }
+
+    Lock lock;
+    statisticsAdd(&Statistics::rehashTotal);
+    statisticsAdd(&Statistics::rehashIncremental);
+    // If a rehash is in progress the current table is the newest old table
+    oldTable->table = this->table;
+    oldTable->size = getSize();
+    oldTable->rehashIndex = 0;
+    oldTable->next = this->oldTables;
+    this->oldTables = oldTable;
+    this->table = newTable;
+    this->size = size;
+    this->collisionsInTheTable = 0;
+    this->rehashStalled = false;
+    return INSERT_DONE;
+}
+
 /**
  * Bob Jenkins hash function
  * http://burtleburtle.net/bob/hash/doobs.html
  */
-static uint_fast32_t one_at_a_time(uint8_t *key, uint_fast32_t len,
+static inline uint_fast32_t one_at_a_time(const uint8_t *key, uint_fast32_t len,
         uint_fast32_t seed = 0)
 {
     uint_fast32_t hash = seed;
@@ -699,6 +1456,312 @@ static uint_fast32_t one_at_a_time(uint8_t *key, uint_fast32_t len,
     return hash;
 }
 
+/**
+ * Hash functions faster than one_at_a_time
+ *
+ * hashCrc32c - CRC32 with the Castagnoli polynomial. On x86 the CPU instruction crc32 hashes
+ * 8 bytes in ~1 cycle. The instruction is compiled in regardless of the command line and used
+ * if the CPU supports SSE4.2 - the check is done once. With -msse4.2 or -march=native there is
+ * no check. Without SSE4.2 the function falls back to a table lookup and returns the same value.
+ * hashWy - 64 bits hash in the style of wyhash: multiply 64x64->128 and fold. Fast on any 64 bits
+ * CPU, good distribution for strings and binary keys of any length.
+ * hashMultiplicative - Fibonacci (Knuth) hashing for integer keys, one multiplication.
+ *
+ * Keys in the hash tables are often integers which differ only in the high bits or strings which
+ * differ only in the last characters. HashTrivial and a sloppy hash fill only a part of the table.
+ */
+static const uint32_t HASH_CRC32C_POLYNOMIAL = 0x82F63B78;
+
+/**
+ * Table for the software CRC32C, built once
+ */
+struct HashCrc32cTable
+{
+    HashCrc32cTable()
+    {
+        for (uint32_t i = 0;i < 256;i++)
+        {
+            uint32_t crc = i;
+            for (int bit = 0;bit < 8;bit++)
+            {
+                crc = (crc >> 1) ^ ((crc & 1) ? HASH_CRC32C_POLYNOMIAL : 0);
+            }
+            table[i] = crc;
+        }
+    }
+
+    static const uint32_t *get()
+    {
+        static const HashCrc32cTable instance;
+        return instance.table;
+    }
+
+    uint32_t table[256];
+};
+
+static inline uint32_t hashCrc32cSoftware(const uint8_t *key, size_t len, uint32_t crc)
+{
+    const uint32_t *table = HashCrc32cTable::get();
+    for (;len > 0;len--, key++)
+    {
+        crc = table[(crc ^ *key) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(HASH_CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+static inline uint32_t hashCrc32cSse42(const uint8_t *key, size_t len, uint32_t crc)
+{
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (;len >= sizeof(uint64_t);len -= sizeof(uint64_t), key += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, key, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (;len > 0;len--, key++)
+    {
+        crc = _mm_crc32_u8(crc, *key);
+    }
+    return crc;
+}
+
+static inline bool hashCrc32cDetect()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#endif
+
+/**
+ * True if hashCrc32c() uses the CPU instruction
+ */
+static inline bool hashCrc32cHardware()
+{
+#if defined(__SSE4_2__)
+    return true;
+#elif defined(HASH_CRC32C_SSE42)
+    static const bool supported = hashCrc32cDetect();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+static inline uint32_t hashCrc32c(const uint8_t *key, size_t len, uint32_t seed = 0)
+{
+    uint32_t crc = ~seed;
+#if defined(HASH_CRC32C_SSE42)
+    if (hashCrc32cHardware())
+    {
+        return ~hashCrc32cSse42(key, len, crc);
+    }
+#endif
+    return ~hashCrc32cSoftware(key, len, crc);
+}
+
+/**
+ * 64x64->128 bits multiplication, returns low half xor high half
+ */
+static inline uint64_t hashMix(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t aLow = (uint32_t)a, aHigh = a >> 32;
+    uint64_t bLow = (uint32_t)b, bHigh = b >> 32;
+    uint64_t lowLow = aLow * bLow, highLow = aHigh * bLow;
+    uint64_t lowHigh = aLow * bHigh, highHigh = aHigh * bHigh;
+    uint64_t middle = (lowLow >> 32) + (uint32_t)highLow + lowHigh;
+    uint64_t low = (middle << 32) | (uint32_t)lowLow;
+    uint64_t high = highHigh + (highLow >> 32) + (middle >> 32);
+    return low ^ high;
+#endif
+}
+
+static inline uint64_t hashRead64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hashRead32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hashWy(const uint8_t *key, size_t len, uint64_t seed = 0)
+{
+    static const uint64_t SECRET0 = 0xa0761d6478bd642full;
+    static const uint64_t SECRET1 = 0xe7037ed1a0b428dbull;
+    static const uint64_t SECRET2 = 0x8ebc6af09c88c6e3ull;
+    static const uint64_t SECRET3 = 0x589965cc75374cc3ull;
+    seed ^= hashMix(seed ^ SECRET0, SECRET1);
+    uint64_t a, b;
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            // Two overlapping reads cover 4..16 bytes without a loop
+            const size_t shift = (len >> 3) << 2;
+            a = (hashRead32(key) << 32) | hashRead32(key + shift);
+            b = (hashRead32(key + len - 4) << 32) | hashRead32(key + len - 4 - shift);
+        }
+        else if (len > 0)
+        {
+            a = ((uint64_t)key[0] << 16) | ((uint64_t)key[len >> 1] << 8) | key[len - 1];
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        size_t i = len;
+        if (i > 48)
+        {
+            // Three independent lanes keep the multipliers busy
+            uint64_t seed1 = seed, seed2 = seed;
+            do
+            {
+                seed = hashMix(hashRead64(key) ^ SECRET1, hashRead64(key + 8) ^ seed);
+                seed1 = hashMix(hashRead64(key + 16) ^ SECRET2, hashRead64(key + 24) ^ seed1);
+                seed2 = hashMix(hashRead64(key + 32) ^ SECRET3, hashRead64(key + 40) ^ seed2);
+                key += 48;
+                i -= 48;
+            }
+            while (i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (i > 16)
+        {
+            seed = hashMix(hashRead64(key) ^ SECRET1, hashRead64(key + 8) ^ seed);
+            key += 16;
+            i -= 16;
+        }
+        a = hashRead64(key + i - 16);
+        b = hashRead64(key + i - 8);
+    }
+    return hashMix(SECRET1 ^ len, hashMix(a ^ SECRET1, b ^ seed));
+}
+
+/**
+ * Fibonacci hashing: multiply by 2^64/phi and take the high bits.
+ * The tables use the low bits of the hash, the function returns the high 32 bits
+ * of the product which depend on all bits of the key
+ */
+static inline uint_fast32_t hashMultiplicative(uint64_t key)
+{
+    return (uint_fast32_t)((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+enum HashFunction
+{
+    HASH_ONE_AT_A_TIME,
+    HASH_CRC32C,
+    HASH_WY,
+    HASH_MULTIPLICATIVE,
+#if defined(__SSE4_2__)
+    HASH_DEFAULT = HASH_CRC32C
+#else
+    HASH_DEFAULT = HASH_WY
+#endif
+};
+
+/**
+ * Compile time selection of the hash function
+ * HashFunctionSelector<HASH_WY>::hash(data, len)
+ */
+template<enum HashFunction Function> struct HashFunctionSelector;
+
+template<> struct HashFunctionSelector<HASH_ONE_AT_A_TIME>
+{
+    static inline uint_fast32_t hash(const uint8_t *key, size_t len)
+    {
+        return one_at_a_time(key, len);
+    }
+};
+
+template<> struct HashFunctionSelector<HASH_CRC32C>
+{
+    static inline uint_fast32_t hash(const uint8_t *key, size_t len)
+    {
+        return hashCrc32c(key, len);
+    }
+};
+
+template<> struct HashFunctionSelector<HASH_WY>
+{
+    static inline uint_fast32_t hash(const uint8_t *key, size_t len)
+    {
+        return (uint_fast32_t)hashWy(key, len);
+    }
+};
+
+/**
+ * Keys up to 8 bytes. The function is not defined for longer keys, they are hashed
+ * with hashWy. HashPolicy does not allow the multiplicative hash for such keys
+ */
+template<> struct HashFunctionSelector<HASH_MULTIPLICATIVE>
+{
+    static inline uint_fast32_t hash(const uint8_t *key, size_t len)
+    {
+        if (len > sizeof(uint64_t))
+        {
+            return (uint_fast32_t)hashWy(key, len);
+        }
+        uint64_t value = 0;
+        memcpy(&value, key, len);
+        return hashMultiplicative(value);
+    }
+};
+
+/**
+ * Hash policy for the hash tables, the default is the multiplicative hash for
+ * the integers and hashCrc32c/hashWy for anything else
+ *
+ *   struct MyHash : HashPolicy<uint32_t>
+ *   {
+ *       static const uint32_t &getKey(const MyObject *object);
+ *   };
+ */
+template<typename Key> struct HashPolicyDefault
+{
+    static const enum HashFunction function = std::is_integral<Key>::value ? HASH_MULTIPLICATIVE : HASH_DEFAULT;
+};
+
+template<typename Key, enum HashFunction Function = HashPolicyDefault<Key>::function> struct HashPolicy
+{
+    static_assert((Function != HASH_MULTIPLICATIVE) || (sizeof(Key) <= sizeof(uint64_t)),
+        "The multiplicative hash is for keys up to 8 bytes");
+
+    static inline const uint_fast32_t hash(const Key &key)
+    {
+        return HashFunctionSelector<Function>::hash((const uint8_t*)&key, sizeof(Key));
+    }
+};
+
+/**
+ * Zero terminated strings are hashed by the content
+ */
+template<enum HashFunction Function> struct HashPolicy<const char*, Function>
+{
+    static inline const uint_fast32_t hash(const char *key)
+    {
+        return HashFunctionSelector<Function>::hash((const uint8_t*)key, strlen(key));
+    }
+};
+
 /**
  * A trivial allocator for testing
  */
@@ -731,7 +1794,7 @@ public:
 
     static const uint_fast32_t hash(const Key &key)
     {
-        uint_fast32_t result = one_at_a_time(&key, sizeof(Key));
+        uint_fast32_t result = one_at_a_time((const uint8_t*)&key, sizeof(Key));
         return result;
     }
 
@@ -826,7 +1889,7 @@ typedef Lock<SynchroObjectDummy> LockDummy;
 #define LockfreeHashTableTemplateTypes typename Object, Object IllegalData, typename Key, Key IllegalKey, typename Allocator, typename Hash
 #define LockfreeHashTableTemplateArgs Object, IllegalData, Key, IllegalKey, Allocator, Hash
 
-template<LockfreeHashTableTemplateTypes>
+template<LockfreeHashTableTemplateTypes, typename StatisticsPolicy = HashTableStatisticsShared>
 class LockfreeHashTable: public HashTableBase
 {
 public:
@@ -881,9 +1944,72 @@ public:
     bool remove(Key key, Object *o);
     bool search(Key key, Object *o);
 
+    /**
+     * Hash a group of keys and prefetch the entries, then look up the keys.
+     * Cache misses overlap. A key which is not found gets IllegalData
+     * Returns number of found keys
+     */
+    size_t searchBatch(const Key *keys, size_t count, Object *objects);
+
+    enum GetNextResult
+    {
+        GETNEXT_FAILED,
+        GETNEXT_OK,
+        GETNEXT_END_TABLE
+    };
+
+    /**
+     * Access the stored pairs. The function does not block the writers, a pair
+     * inserted or removed during the loop can be missed
+     *
+     * @param index - use zero to get the first stored pair
+     */
+    enum GetNextResult getNext(uint_fast32_t &index, Key *key, Object *o) const
+    {
+        for (uint_fast32_t i = index;i < this->size;i++)
+        {
+            const TableEntry *entry = &table[i];
+            Key entryKey = entry->key;
+            if (entryKey != IllegalKey)
+            {
+                *key = entryKey;
+                *o = entry->data;
+                index = i;
+                return GETNEXT_OK;
+            }
+        }
+        return GETNEXT_END_TABLE;
+    }
+
+    /**
+     * See HashTableStatisticsShared, HashTableStatisticsSharded
+     */
+    const struct Statistics *getStatistics()
+    {
+        counters.collect(statistics);
+        return &statistics;
+    }
+
+    void resetStatistics()
+    {
+        HashTableBase::resetStatistics();
+        counters.reset();
+    }
+
+    uint_fast32_t getCount() const
+    {
+        return counters.getCount(this->count);
+    }
+
+    bool isEmpty() const
+    {
+        return (getCount() == 0);
+    }
+
 protected:
 
     static const int MAX_COLLISIONS = 3;
+    static const size_t SEARCH_BATCH = 16;
 
     typedef struct
     {
@@ -919,6 +2045,8 @@ protected:
     size_t sizeEntries;
     size_t sizeBytes;
     TableEntry *table;
+
+    StatisticsPolicy counters;
 };
 
 
@@ -927,38 +2055,39 @@ protected:
  * If fails (not likely) try again with the next slot (linear probing)
  * continue until success or max_tries is hit
  */
-template<LockfreeHashTableTemplateTypes>
-enum LockfreeHashTable<LockfreeHashTableTemplateArgs>::InsertResult
-LockfreeHashTable<LockfreeHashTableTemplateArgs>::insert(Key key, const Object &o)
+template<LockfreeHashTableTemplateTypes, typename StatisticsPolicy>
+enum LockfreeHashTable<LockfreeHashTableTemplateArgs, StatisticsPolicy>::InsertResult
+LockfreeHashTable<LockfreeHashTableTemplateArgs, StatisticsPolicy>::insert(Key key, const Object &o)
 {
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
     const uint_fast32_t hash = Hash::hash(key);
 	const uint_fast32_t index = getIndex(hash);
 	/* I can do this for the last slot too - I allocated max_tries more slots */
 	const uint_fast32_t indexMax = index+MAX_COLLISIONS;
-    statistics.insertTotal++;
+    local.add(&Statistics::insertTotal);
 	for (TableEntry *entry = &table[index];entry < &table[indexMax];entry++)
 	{
 	    Key oldKey = hashtable_cmpxchg(&entry->key, IllegalKey, key);
 	    if (hashtable_likely(oldKey == IllegalKey)) /* Success */
 	    {
 	    	entry->data = o;
-	    	statistics.insertOk++;
-	    	this->count++;
+	    	local.add(&Statistics::insertOk);
+	    	local.addCount(1);
 	        return INSERT_DONE;
 	    }
 	    else if (oldKey == key)
 		{
 	    	entry->data = o;
-	    	statistics.insertDuplicate++;
+	    	local.add(&Statistics::insertDuplicate);
 	        return INSERT_DUPLICATE;
 		}
 	    else
 	    {
-	    	statistics.insertHashCollision++;
+	    	local.add(&Statistics::insertHashCollision);
 	    }
 	}
 
-	statistics.insertFailed++;
+	local.add(&Statistics::insertFailed);
 	return INSERT_FAILED;
 }
 
@@ -968,15 +2097,16 @@ LockfreeHashTable<LockfreeHashTableTemplateArgs>::insert(Key key, const Object &
  * read the pointer, remove using atomic operation
  * Only one context is allowed to remove a specific entry
  */
-template<LockfreeHashTableTemplateTypes>
+template<LockfreeHashTableTemplateTypes, typename StatisticsPolicy>
 bool
-LockfreeHashTable<LockfreeHashTableTemplateArgs>::remove(Key key, Object *o)
+LockfreeHashTable<LockfreeHashTableTemplateArgs, StatisticsPolicy>::remove(Key key, Object *o)
 {
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
     const uint_fast32_t hash = Hash::hash(key);
 	const uint_fast32_t index = getIndex(hash);
 	/* I can do this for the last slot too - I allocated max_tries more slots */
 	const uint_fast32_t indexMax = index+MAX_COLLISIONS;
-    statistics.removeTotal++;
+    local.add(&Statistics::removeTotal);
 	for (TableEntry *entry = &table[index];entry < &table[indexMax];entry++)
 	{
 	    Key oldKey = entry->key;
@@ -989,12 +2119,12 @@ LockfreeHashTable<LockfreeHashTableTemplateArgs>::remove(Key key, Object *o)
 	        hashtable_sync_access(&entry->data) = IllegalData;
 	        hashtable_barrier();
 	        hashtable_sync_access(&entry->key) = IllegalKey;
-	    	this->count--;
+	    	local.addCount(-1);
 	        return true;
 	    }
 	}
 
-    statistics.removeFailed++;
+    local.add(&Statistics::removeFailed);
 	return false;
 }
 
@@ -1002,15 +2132,16 @@ LockfreeHashTable<LockfreeHashTableTemplateArgs>::remove(Key key, Object *o)
  * Hash the key, get an index in the hashtable, find the relevant entry,
  * read the pointer
  */
-template<LockfreeHashTableTemplateTypes>
+template<LockfreeHashTableTemplateTypes, typename StatisticsPolicy>
 bool
-LockfreeHashTable<LockfreeHashTableTemplateArgs>::search(Key key, Object *o)
+LockfreeHashTable<LockfreeHashTableTemplateArgs, StatisticsPolicy>::search(Key key, Object *o)
 {
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
     const uint_fast32_t hash = Hash::hash(key);
 	const uint_fast32_t index = getIndex(hash);
 	/* I can do this for the last slot too - I allocated max_tries more slots */
 	const uint_fast32_t indexMax = index+MAX_COLLISIONS;
-    statistics.searchTotal++;
+    local.add(&Statistics::searchTotal);
 	for (TableEntry *entry = &table[index];entry < &table[indexMax];entry++)
 	{
 	    Key oldKey = entry->key;
@@ -1020,15 +2151,55 @@ LockfreeHashTable<LockfreeHashTableTemplateArgs>::search(Key key, Object *o)
 	        {
 	            *o = entry->data;
 	        }
-	        statistics.searchOk++;
+	        local.add(&Statistics::searchOk);
 	        return true;
 	    }
 	}
 
-    statistics.searchFailed++;
+    local.add(&Statistics::searchFailed);
 	return false;
 }
 
+/**
+ * Same as search() for a group of keys, all entries are prefetched before the first compare
+ */
+template<LockfreeHashTableTemplateTypes, typename StatisticsPolicy>
+size_t
+LockfreeHashTable<LockfreeHashTableTemplateArgs, StatisticsPolicy>::searchBatch(const Key *keys, size_t count, Object *objects)
+{
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
+    size_t found = 0;
+    for (size_t first = 0;first < count;first += SEARCH_BATCH)
+    {
+        const size_t batch = ((count - first) < SEARCH_BATCH) ? (count - first) : SEARCH_BATCH;
+        TableEntry *entries[SEARCH_BATCH];
+        for (size_t i = 0;i < batch;i++)
+        {
+            entries[i] = &table[getIndex(Hash::hash(keys[first + i]))];
+            __builtin_prefetch(entries[i]);
+        }
+        for (size_t i = 0;i < batch;i++)
+        {
+            const Key key = keys[first + i];
+            Object data = IllegalData;
+            for (TableEntry *entry = entries[i];entry < &entries[i][MAX_COLLISIONS];entry++)
+            {
+                if (entry->key == key)
+                {
+                    data = entry->data;
+                    found++;
+                    break;
+                }
+            }
+            objects[first + i] = data;
+        }
+    }
+    local.add(&Statistics::searchTotal, count);
+    local.add(&Statistics::searchOk, found);
+    local.add(&Statistics::searchFailed, (count - found));
+    return found;
+}
+
 struct HashTrivial
 {
     static const uint_fast32_t hash(uint32_t key)
@@ -0,0 +1,558 @@
+/**
+ * Bucketized cuckoo hash table
+ *
+ * A key can be in one of two buckets. A bucket is a cache line: an array of one byte
+ * fingerprints (tags) followed by the key/value slots. A lookup checks the tags of two
+ * buckets - at most two cache lines regardless of the load. The second bucket is
+ * prefetched while the first bucket is checked.
+ *
+ * If both buckets are full insert() looks for a short path of displacements (breadth first
+ * search, up to MAX_PATH moves): an entry of a full bucket moves to its alternative bucket
+ * and frees a slot. The alternative bucket is calculated from the bucket and the tag,
+ * the keys are not hashed again. With 4-8 slots in a bucket the table can be filled up
+ * to 95% before an insert fails, with 3 slots - above 90%. Compare with the probing window of
+ * HashTable and LockfreeHashTable which fails when a handful of adjacent slots are occupied.
+ *
+ * Number of slots in the bucket is up to 8, as many as fit a cache line together with the
+ * tags: 7 slots for 32 bits keys and values, 3 slots for 64 bits keys and values. Key/value
+ * pairs larger than 31 bytes do not compile - store a pointer. Keys and values shall be
+ * trivially copyable, Key shall implement operator==. The API follows HashTableFlat.
+ *
+ * Example of usage:
+ *
+ *   typedef HashTableCuckoo<uint32_t, uint32_t, LockDummy, AllocatorTrivial> MyTable;
+ *   MyTable *table = MyTable::create("myTable", 64*1024);
+ *   table->insert(key, value);
+ *   uint32_t value;
+ *   if (table->search(key, &value))
+ *       ...
+ */
+
+#pragma once
+
+#include <type_traits>
+
+#include "HashTable.h"
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash = HashPolicy<Key> >
+class HashTableCuckoo: public HashTableBase
+{
+protected:
+
+    struct Slot
+    {
+        Key key;
+        Value value;
+    };
+
+    static const size_t CACHE_LINE = 64;
+    static const size_t SLOTS_IN_LINE = CACHE_LINE / (sizeof(Slot) + 1);
+
+public:
+
+    static const size_t SLOTS = (SLOTS_IN_LINE > 8) ? 8 : SLOTS_IN_LINE;
+
+    /**
+     * Max number of displacements in one insert
+     */
+    static const int MAX_PATH = 5;
+
+    enum InsertResult
+    {
+        INSERT_DONE,
+        INSERT_COLLISION,
+        INSERT_DUPLICATE,
+        INSERT_FAILED
+    };
+
+    /**
+     * Returns INSERT_COLLISION if both buckets are full and a path of displacements
+     * is not found. If the key is in the table the function returns INSERT_DUPLICATE
+     * and does not modify the value
+     */
+    enum InsertResult insert(const Key &key, const Value &value)
+    {
+        Lock lock;
+        return insertNoLock(table, key, value);
+    }
+
+    /**
+     * Insert with automatic call to rehash if the insert fails.
+     * See setResizeFactor()
+     *
+     * @param maxSize - maximum size for the table
+     */
+    enum InsertResult insert(const Key &key, const Value &value, uint_fast32_t maxSize);
+
+    bool remove(const Key &key);
+
+    void removeAll();
+
+    bool search(const Key &key, Value *value);
+
+    /**
+     * Pointer to the value in the table, nullptr if there is no such key. The pointer is
+     * valid until the next insert or rehash
+     */
+    Value *find(const Key &key);
+
+    /**
+     * Allocate a new table of at least 'size' slots and move the entries. If an entry does
+     * not fit the new table the function returns INSERT_COLLISION and keeps the current table
+     */
+    enum InsertResult rehash(const uint_fast32_t size)
+    {
+        Lock lock;
+        return rehashNoLock(size);
+    }
+
+    enum GetNextResult
+    {
+        GETNEXT_FAILED,
+        GETNEXT_OK,
+        GETNEXT_END_TABLE
+    };
+
+    /**
+     * @param index - use zero to get the first stored pair
+     */
+    enum GetNextResult getNext(uint_fast32_t &index, Key *key, Value *value) const;
+
+    /**
+     * The size is rounded up to a power of two number of buckets
+     */
+    static HashTableCuckoo *create(const char *name, uint_fast32_t size)
+    {
+        Table table;
+        if (!allocateTable(size, &table))
+        {
+            return nullptr;
+        }
+        void *hashTableMemory = Allocator::alloc(sizeof(HashTableCuckoo));
+        if (hashTableMemory == nullptr)
+        {
+            freeTable(table);
+            return nullptr;
+        }
+        HashTableCuckoo *hashTable = new (hashTableMemory) HashTableCuckoo(name, table);
+        return hashTable;
+    }
+
+    static void destroy(HashTableCuckoo *hashTable)
+    {
+        freeTable(hashTable->table);
+        hashTable->~HashTableCuckoo();
+        Allocator::free((void *)hashTable);
+    }
+
+    /**
+     * Ratio between stored entries and slots
+     */
+    double getLoadFactor() const
+    {
+        return (double)this->count / this->size;
+    }
+
+protected:
+
+    struct alignas(CACHE_LINE) Bucket
+    {
+        uint8_t tags[SLOTS];
+        Slot slots[SLOTS];
+    };
+
+    /**
+     * An entry of bucket 'parent' in slot 'slot' can move to 'bucket'
+     */
+    struct PathNode
+    {
+        uint_fast32_t bucket;
+        int parent;
+        int slot;
+        int depth;
+    };
+
+    static const int MAX_QUEUE = 512;
+
+    /**
+     * Buckets are cache line aligned, 'memory' is the allocated block
+     */
+    struct Table
+    {
+        void *memory;
+        Bucket *buckets;
+        uint_fast32_t mask;
+    };
+
+    HashTableCuckoo(const char *name, const Table &table) : HashTableBase(name), table(table)
+    {
+        static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+            "HashTableCuckoo is intended to work only with trivially copyable keys and values");
+        static_assert(SLOTS >= 2, "HashTableCuckoo: less than two key/value slots fit a cache line");
+        static_assert(sizeof(Bucket) == CACHE_LINE, "HashTableCuckoo: a bucket shall be one cache line");
+        this->size = getSlots(table);
+        this->collisionsInTheTable = 0;
+    }
+
+    ~HashTableCuckoo()
+    {
+    }
+
+    /**
+     * Tag zero marks an empty slot
+     */
+    static inline uint8_t getTag(uint32_t hash)
+    {
+        uint8_t tag = (uint8_t)(hash >> 24);
+        return (tag != 0) ? tag : 1;
+    }
+
+    static inline uint_fast32_t getAltBucket(const Table &table, uint_fast32_t bucket, uint8_t tag)
+    {
+        return (bucket ^ (tag * 0x5BD1E995u)) & table.mask;
+    }
+
+    static inline uint_fast32_t getSlots(const Table &table)
+    {
+        return (table.mask + 1) * SLOTS;
+    }
+
+    static inline int findTag(const Bucket &bucket, uint8_t tag)
+    {
+        for (size_t slot = 0;slot < SLOTS;slot++)
+        {
+            if (bucket.tags[slot] == tag)
+            {
+                return slot;
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * The caller holds the lock
+     */
+    static inline Slot *findSlot(const Table &table, const Key &key)
+    {
+        uint32_t hash = Hash::hash(key);
+        uint8_t tag = getTag(hash);
+        uint_fast32_t bucket = hash & table.mask;
+        uint_fast32_t altBucket = getAltBucket(table, bucket, tag);
+        __builtin_prefetch(&table.buckets[altBucket]);
+        Bucket *candidates[2] = {&table.buckets[bucket], &table.buckets[altBucket]};
+        for (Bucket *candidate : candidates)
+        {
+            for (size_t slot = 0;slot < SLOTS;slot++)
+            {
+                if ((candidate->tags[slot] == tag) && (candidate->slots[slot].key == key))
+                {
+                    return &candidate->slots[slot];
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    static inline void move(Table &table, uint_fast32_t fromBucket, int fromSlot, uint_fast32_t toBucket, int toSlot)
+    {
+        Bucket *buckets = table.buckets;
+        buckets[toBucket].tags[toSlot] = buckets[fromBucket].tags[fromSlot];
+        buckets[toBucket].slots[toSlot] = buckets[fromBucket].slots[fromSlot];
+        buckets[fromBucket].tags[fromSlot] = 0;
+    }
+
+    static bool isOnPath(const PathNode *queue, int node, uint_fast32_t bucket)
+    {
+        for (;node >= 0;node = queue[node].parent)
+        {
+            if (queue[node].bucket == bucket)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Breadth first search for a path to a free slot, move the entries along the path.
+     * Returns true and the freed slot in one of the two buckets of the key
+     */
+    bool makeRoom(Table &table, uint_fast32_t bucket1, uint_fast32_t bucket2, uint_fast32_t *bucket, int *slot);
+
+    /**
+     * The caller holds the lock. Rehash inserts to a new table
+     */
+    enum InsertResult insertNoLock(Table &table, const Key &key, const Value &value);
+
+    enum InsertResult rehashNoLock(const uint_fast32_t size);
+
+    static bool allocateTable(uint_fast32_t size, Table *table);
+
+    static void freeTable(Table &table)
+    {
+        Allocator::free(table.memory);
+    }
+
+    Table table;
+};
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+bool HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::allocateTable(uint_fast32_t size, Table *table)
+{
+    uint_fast32_t bucketsCount = 2;
+    while ((bucketsCount * SLOTS) < size)
+    {
+        bucketsCount *= 2;
+    }
+    size_t bytes = bucketsCount * sizeof(Bucket);
+    // The allocator does not align the memory, buckets are cache line aligned
+    uint8_t *memory = (uint8_t*)Allocator::alloc(bytes + CACHE_LINE);
+    if (memory == nullptr)
+    {
+        return false;
+    }
+    uint8_t *aligned = memory + ((CACHE_LINE - ((uintptr_t)memory % CACHE_LINE)) % CACHE_LINE);
+    memset(aligned, 0, bytes);
+    table->memory = memory;
+    table->buckets = (Bucket*)aligned;
+    table->mask = bucketsCount - 1;
+    return true;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+bool HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::makeRoom(Table &table, uint_fast32_t bucket1,
+        uint_fast32_t bucket2, uint_fast32_t *bucket, int *slot)
+{
+    Bucket *buckets = table.buckets;
+    PathNode queue[MAX_QUEUE];
+    int head = 0;
+    int tail = 0;
+    queue[tail++] = {bucket1, -1, 0, 0};
+    queue[tail++] = {bucket2, -1, 0, 0};
+    while (head < tail)
+    {
+        const int node = head++;
+        const Bucket &current = buckets[queue[node].bucket];
+        for (size_t s = 0;s < SLOTS;s++)
+        {
+            uint_fast32_t altBucket = getAltBucket(table, queue[node].bucket, current.tags[s]);
+            if (isOnPath(queue, node, altBucket))
+            {
+                continue;
+            }
+            int freeSlot = findTag(buckets[altBucket], 0);
+            if (freeSlot >= 0)
+            {
+                // Move the entries starting from the end of the path
+                uint_fast32_t toBucket = altBucket;
+                int toSlot = freeSlot;
+                uint_fast32_t fromBucket = queue[node].bucket;
+                int fromSlot = s;
+                int moves = 0;
+                for (int n = node;;n = queue[n].parent)
+                {
+                    move(table, fromBucket, fromSlot, toBucket, toSlot);
+                    moves++;
+                    toBucket = fromBucket;
+                    toSlot = fromSlot;
+                    if (queue[n].parent < 0)
+                    {
+                        break;
+                    }
+                    fromBucket = queue[queue[n].parent].bucket;
+                    fromSlot = queue[n].slot;
+                }
+                statistics.insertHashCollision += moves;
+                *bucket = toBucket;
+                *slot = toSlot;
+                return true;
+            }
+            if ((queue[node].depth + 1 < MAX_PATH) && (tail < MAX_QUEUE))
+            {
+                queue[tail++] = {altBucket, node, (int)s, queue[node].depth + 1};
+            }
+        }
+    }
+    return false;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+enum HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::InsertResult
+HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::insertNoLock(Table &table, const Key &key, const Value &value)
+{
+    statistics.insertTotal++;
+    if (findSlot(table, key) != nullptr)
+    {
+        statistics.insertDuplicate++;
+        return INSERT_DUPLICATE;
+    }
+    uint32_t hash = Hash::hash(key);
+    uint8_t tag = getTag(hash);
+    uint_fast32_t bucket1 = hash & table.mask;
+    uint_fast32_t bucket2 = getAltBucket(table, bucket1, tag);
+    uint_fast32_t bucket = bucket1;
+    int slot = findTag(table.buckets[bucket1], 0);
+    if (slot < 0)
+    {
+        bucket = bucket2;
+        slot = findTag(table.buckets[bucket2], 0);
+    }
+    if ((slot < 0) && !makeRoom(table, bucket1, bucket2, &bucket, &slot))
+    {
+        statistics.insertHashMaxCollision++;
+        return INSERT_COLLISION;
+    }
+    table.buckets[bucket].tags[slot] = tag;
+    table.buckets[bucket].slots[slot].key = key;
+    table.buckets[bucket].slots[slot].value = value;
+    this->count++;
+    statistics.insertOk++;
+    return INSERT_DONE;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+enum HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::InsertResult
+HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::insert(const Key &key, const Value &value,
+        uint_fast32_t maxSize)
+{
+    Lock lock;
+    InsertResult insertResult = insertNoLock(table, key, value);
+    uint_fast32_t newSize = getSize();
+    while ((insertResult == INSERT_COLLISION) && (newSize < maxSize))
+    {
+        newSize = (newSize * (100 + this->resizeFactor)) / 100 + 1;
+        if (newSize > maxSize)
+        {
+            newSize = maxSize;
+        }
+        InsertResult rehashResult = rehashNoLock(newSize);
+        if (rehashResult == INSERT_FAILED)
+        {
+            insertResult = INSERT_FAILED;
+            break;
+        }
+        if (rehashResult == INSERT_DONE)
+        {
+            insertResult = insertNoLock(table, key, value);
+        }
+        // The number of buckets is a power of two, the table can be larger than requested
+        newSize = (getSize() > newSize) ? getSize() : newSize;
+    }
+    return insertResult;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+bool HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::remove(const Key &key)
+{
+    Lock lock;
+    statistics.removeTotal++;
+    Slot *slot = findSlot(table, key);
+    if (slot == nullptr)
+    {
+        statistics.removeFailed++;
+        return false;
+    }
+    // The slot is in the array of slots of the bucket
+    Bucket *bucket = &table.buckets[((uint8_t*)slot - (uint8_t*)table.buckets) / sizeof(Bucket)];
+    bucket->tags[slot - bucket->slots] = 0;
+    this->count--;
+    statistics.removeOk++;
+    return true;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+void HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::removeAll()
+{
+    Lock lock;
+    memset(table.buckets, 0, (table.mask + 1) * sizeof(Bucket));
+    this->count = 0;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+bool HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::search(const Key &key, Value *value)
+{
+    Lock lock;
+    statistics.searchTotal++;
+    const Slot *slot = findSlot(table, key);
+    if (slot == nullptr)
+    {
+        statistics.searchFailed++;
+        return false;
+    }
+    *value = slot->value;
+    statistics.searchOk++;
+    return true;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+Value *HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::find(const Key &key)
+{
+    Lock lock;
+    statistics.searchTotal++;
+    Slot *slot = findSlot(table, key);
+    if (slot == nullptr)
+    {
+        statistics.searchFailed++;
+        return nullptr;
+    }
+    statistics.searchOk++;
+    return &slot->value;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+enum HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::InsertResult
+HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::rehashNoLock(const uint_fast32_t size)
+{
+    statistics.rehashTotal++;
+    Table newTable;
+    if (!allocateTable(size, &newTable))
+    {
+        statistics.rehashFailed++;
+        return INSERT_FAILED;
+    }
+
+    uint_fast32_t count = this->count;
+    this->count = 0;
+    for (uint_fast32_t bucket = 0;bucket <= table.mask;bucket++)
+    {
+        for (size_t slot = 0;slot < SLOTS;slot++)
+        {
+            if (table.buckets[bucket].tags[slot] == 0)
+            {
+                continue;
+            }
+            const Slot &entry = table.buckets[bucket].slots[slot];
+            if (insertNoLock(newTable, entry.key, entry.value) != INSERT_DONE)
+            {
+                statistics.rehashCollision++;
+                this->count = count;
+                freeTable(newTable);
+                return INSERT_COLLISION;
+            }
+            statistics.rehashDone++;
+        }
+    }
+
+    freeTable(table);
+    table = newTable;
+    this->size = getSlots(table);
+    return INSERT_DONE;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+enum HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::GetNextResult
+HashTableCuckoo<Key, Value, Lock, Allocator, Hash>::getNext(uint_fast32_t &index, Key *key, Value *value) const
+{
+    for (uint_fast32_t i = index;i < getSize();i++)
+    {
+        const Bucket &bucket = table.buckets[i / SLOTS];
+        if (bucket.tags[i % SLOTS] != 0)
+        {
+            *key = bucket.slots[i % SLOTS].key;
+            *value = bucket.slots[i % SLOTS].value;
+            index = i;
+            return GETNEXT_OK;
+        }
+    }
+    return GETNEXT_END_TABLE;
+}
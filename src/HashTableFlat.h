@@ -0,0 +1,402 @@
+/**
+ * Hash table which keeps the keys and the values in the table
+ *
+ * HashTable stores pointers. A lookup loads the entry and dereferences the pointer to
+ * compare the key - two dependent cache misses. This table stores small trivially copyable
+ * key/value pairs in the slots and compares the key in the slot. A hit in the first slot
+ * costs one cache line.
+ *
+ * The collisions are handled like in HashTable: the key goes to one of MAX_COLLISIONS slots
+ * starting from hash % size, the table allocates MAX_COLLISIONS extra slots in the end.
+ * The slots are adjacent, the probing window is one or two cache lines.
+ *
+ * Key shall implement operator==. The default Hash is HashPolicy<Key>, it hashes all bytes
+ * of the key including the padding - use keys without padding or provide a Hash with
+ * static hash(const Key&).
+ *
+ * Example of usage:
+ *
+ *   struct Counters
+ *   {
+ *       uint32_t packets;
+ *       uint32_t bytes;
+ *   };
+ *   typedef HashTableFlat<uint64_t, Counters, LockDummy, AllocatorTrivial> FlowTable;
+ *   FlowTable *flowTable = FlowTable::create("flows", 1024);
+ *   Counters counters = {0, 0};
+ *   flowTable->insert(flowId, counters);
+ *   Counters *flow = flowTable->find(flowId);
+ *   if (flow != nullptr)
+ *       flow->packets++;
+ */
+
+#pragma once
+
+#include <type_traits>
+
+#include "HashTable.h"
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash = HashPolicy<Key> >
+class HashTableFlat: public HashTableBase
+{
+public:
+
+    enum InsertResult
+    {
+        INSERT_DONE,
+        INSERT_COLLISION,
+        INSERT_DUPLICATE,
+        INSERT_FAILED
+    };
+
+    /**
+     * Copy the key and the value to the table. The function fails with INSERT_COLLISION
+     * if all slots in the probing window are occupied. If the key is in the table the
+     * function returns INSERT_DUPLICATE and does not modify the value
+     */
+    enum InsertResult insert(const Key &key, const Value &value)
+    {
+        Lock lock;
+        return insert(key, value, table, getSize());
+    }
+
+    /**
+     * Insert with automatic call to rehash if the probing window is full.
+     * See setResizeFactor()
+     *
+     * @param maxSize - maximum size for the table
+     */
+    enum InsertResult insert(const Key &key, const Value &value, uint_fast32_t maxSize);
+
+    bool remove(const Key &key);
+
+    void removeAll();
+
+    /**
+     * Copy the value to 'value'
+     */
+    bool search(const Key &key, Value *value);
+
+    /**
+     * Pointer to the value in the table, nullptr if there is no such key. The pointer is
+     * valid until the next insert or rehash
+     */
+    Value *find(const Key &key);
+
+    /**
+     * Allocate a new table and move the slots. If a key does not fit the new table the
+     * function returns INSERT_COLLISION and keeps the current table
+     */
+    enum InsertResult rehash(const uint_fast32_t size)
+    {
+        Lock lock;
+        return rehashNoLock(size);
+    }
+
+    enum GetNextResult
+    {
+        GETNEXT_FAILED,
+        GETNEXT_OK,
+        GETNEXT_END_TABLE
+    };
+
+    /**
+     * @param index - use zero to get the first stored pair
+     */
+    enum GetNextResult getNext(uint_fast32_t &index, Key *key, Value *value) const;
+
+    static HashTableFlat *create(const char *name, uint_fast32_t size)
+    {
+        Slot *table = allocateTable(size);
+        if (table == nullptr)
+        {
+            return nullptr;
+        }
+        void *hashTableMemory = Allocator::alloc(sizeof(HashTableFlat));
+        if (hashTableMemory == nullptr)
+        {
+            freeTable(table);
+            return nullptr;
+        }
+        HashTableFlat *hashTable = new (hashTableMemory) HashTableFlat(name, size, table);
+        return hashTable;
+    }
+
+    static void destroy(HashTableFlat *hashTable)
+    {
+        hashTable->~HashTableFlat();
+        freeTable(hashTable->table);
+        Allocator::free((void *)hashTable);
+    }
+
+protected:
+
+    /**
+     * Slots are small, the window is longer than in HashTable and still fits one
+     * or two cache lines
+     */
+    static const int MAX_COLLISIONS = 8;
+
+    struct Slot
+    {
+        Key key;
+        Value value;
+        bool used;
+    };
+
+    HashTableFlat(const char *name, uint_fast32_t size, Slot *table) : HashTableBase(name)
+    {
+        static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+            "HashTableFlat is intended to work only with trivially copyable keys and values");
+        this->size = size;
+        this->table = table;
+        this->collisionsInTheTable = 0;
+    }
+
+    ~HashTableFlat()
+    {
+    }
+
+    static uint_fast32_t getIndex(const Key &key, uint_fast32_t size)
+    {
+        uint_fast32_t hash = Hash::hash(key);
+        uint_fast32_t index = hash % size;
+        return index;
+    }
+
+    static uint_fast32_t getAllocatedSize(uint_fast32_t size)
+    {
+        return size + MAX_COLLISIONS;
+    }
+
+    static Slot *allocateTable(uint_fast32_t size)
+    {
+        uint_fast32_t bytes = getAllocatedSize(size) * sizeof(Slot);
+        Slot *table = (Slot*)Allocator::alloc(bytes);
+        if (table != nullptr)
+        {
+            memset(table, 0, bytes);
+        }
+        return table;
+    }
+
+    static void freeTable(Slot *table)
+    {
+        Allocator::free((void*)table);
+    }
+
+    /**
+     * The caller holds the lock
+     */
+    inline Slot *findSlot(const Key &key)
+    {
+        Slot *slot = &table[getIndex(key, getSize())];
+        for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
+        {
+            if (slot->used && (slot->key == key))
+            {
+                return slot;
+            }
+            slot++;                     // I can do this - table contains (size+MAX_COLLISIONS) slots
+        }
+        return nullptr;
+    }
+
+    /**
+     * The caller holds the lock
+     */
+    enum InsertResult insert(const Key &key, const Value &value, Slot *table, uint_fast32_t size);
+
+    enum InsertResult rehashNoLock(const uint_fast32_t size);
+
+    Slot *table;
+};
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+enum HashTableFlat<Key, Value, Lock, Allocator, Hash>::InsertResult
+HashTableFlat<Key, Value, Lock, Allocator, Hash>::insert(const Key &key, const Value &value,
+        Slot *table, uint_fast32_t size)
+{
+    statistics.insertTotal++;
+    Slot *slot = &table[getIndex(key, size)];
+    Slot *freeSlot = nullptr;
+    int freeCollisions = 0;
+    for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
+    {
+        if (!slot->used)
+        {
+            if (freeSlot == nullptr)
+            {
+                freeSlot = slot;
+                freeCollisions = collisions;
+            }
+        }
+        else if (slot->key == key)
+        {
+            statistics.insertDuplicate++;
+            return INSERT_DUPLICATE;
+        }
+        slot++;
+    }
+
+    if (freeSlot == nullptr)
+    {
+        statistics.insertHashMaxCollision++;
+        return INSERT_COLLISION;
+    }
+
+    freeSlot->key = key;
+    freeSlot->value = value;
+    freeSlot->used = true;
+    statistics.insertHashCollision += freeCollisions;
+    this->collisionsInTheTable += freeCollisions;
+    this->count++;
+    statistics.insertOk++;
+    return INSERT_DONE;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+enum HashTableFlat<Key, Value, Lock, Allocator, Hash>::InsertResult
+HashTableFlat<Key, Value, Lock, Allocator, Hash>::insert(const Key &key, const Value &value,
+        uint_fast32_t maxSize)
+{
+    Lock lock;
+    InsertResult insertResult = insert(key, value, table, getSize());
+    uint_fast32_t newSize = getSize();
+    while ((insertResult == INSERT_COLLISION) && (newSize < maxSize))
+    {
+        // If a key does not fit the new table try a larger one
+        newSize = (newSize * (100 + this->resizeFactor)) / 100 + 1;
+        if (newSize > maxSize)
+        {
+            newSize = maxSize;
+        }
+        InsertResult rehashResult = rehashNoLock(newSize);
+        if (rehashResult == INSERT_FAILED)
+        {
+            insertResult = INSERT_FAILED;
+            break;
+        }
+        if (rehashResult == INSERT_DONE)
+        {
+            insertResult = insert(key, value, table, getSize());
+        }
+    }
+    return insertResult;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+bool HashTableFlat<Key, Value, Lock, Allocator, Hash>::remove(const Key &key)
+{
+    Lock lock;
+    statistics.removeTotal++;
+    Slot *first = &table[getIndex(key, getSize())];
+    Slot *slot = findSlot(key);
+    if (slot == nullptr)
+    {
+        statistics.removeFailed++;
+        return false;
+    }
+    slot->used = false;
+    this->collisionsInTheTable -= (slot - first);
+    this->count--;
+    statistics.removeOk++;
+    return true;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+void HashTableFlat<Key, Value, Lock, Allocator, Hash>::removeAll()
+{
+    Lock lock;
+    memset(table, 0, getAllocatedSize(getSize()) * sizeof(Slot));
+    this->count = 0;
+    this->collisionsInTheTable = 0;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+bool HashTableFlat<Key, Value, Lock, Allocator, Hash>::search(const Key &key, Value *value)
+{
+    Lock lock;
+    statistics.searchTotal++;
+    const Slot *slot = findSlot(key);
+    if (slot == nullptr)
+    {
+        statistics.searchFailed++;
+        return false;
+    }
+    *value = slot->value;
+    statistics.searchOk++;
+    return true;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+Value *HashTableFlat<Key, Value, Lock, Allocator, Hash>::find(const Key &key)
+{
+    Lock lock;
+    statistics.searchTotal++;
+    Slot *slot = findSlot(key);
+    if (slot == nullptr)
+    {
+        statistics.searchFailed++;
+        return nullptr;
+    }
+    statistics.searchOk++;
+    return &slot->value;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+enum HashTableFlat<Key, Value, Lock, Allocator, Hash>::InsertResult
+HashTableFlat<Key, Value, Lock, Allocator, Hash>::rehashNoLock(const uint_fast32_t size)
+{
+    statistics.rehashTotal++;
+    Slot *newTable = allocateTable(size);
+    if (newTable == nullptr)
+    {
+        statistics.rehashFailed++;
+        return INSERT_FAILED;
+    }
+
+    uint_fast32_t count = this->count;
+    uint_fast32_t collisionsInTheTable = this->collisionsInTheTable;
+    this->count = 0;
+    this->collisionsInTheTable = 0;
+    for (uint_fast32_t i = 0;i < getAllocatedSize(getSize());i++)
+    {
+        const Slot &slot = table[i];
+        if (slot.used)
+        {
+            if (insert(slot.key, slot.value, newTable, size) != INSERT_DONE)
+            {
+                statistics.rehashCollision++;
+                this->count = count;
+                this->collisionsInTheTable = collisionsInTheTable;
+                freeTable(newTable);
+                return INSERT_COLLISION;
+            }
+            statistics.rehashDone++;
+        }
+    }
+
+    freeTable(table);
+    table = newTable;
+    this->size = size;
+    return INSERT_DONE;
+}
+
+template<typename Key, typename Value, typename Lock, typename Allocator, typename Hash>
+enum HashTableFlat<Key, Value, Lock, Allocator, Hash>::GetNextResult
+HashTableFlat<Key, Value, Lock, Allocator, Hash>::getNext(uint_fast32_t &index, Key *key, Value *value) const
+{
+    for (uint_fast32_t i = index;i < getAllocatedSize(getSize());i++)
+    {
+        const Slot &slot = table[i];
+        if (slot.used)
+        {
+            *key = slot.key;
+            *value = slot.value;
+            index = i;
+            return GETNEXT_OK;
+        }
+    }
+    return GETNEXT_END_TABLE;
+}
@@ -0,0 +1,469 @@
+/**
+ * Read only image of a hash table in a file
+ *
+ * Large lookup tables are built from the source data when the process starts. The
+ * image keeps the built table in a file. The next process maps the file read only and
+ * searches the mapped pages - there is nothing to build. The pages are in the page cache
+ * and are shared by all processes which load the same image.
+ *
+ * The image is position independent: slots keep offsets instead of pointers.
+ * Keys which are trivially copyable (integers, small structures) are stored in the slot,
+ * strings (const char*) are stored after the slots and the slot keeps the offset of the
+ * string. Values shall be trivially copyable.
+ *
+ * The file starts with a header: magic, layout version, hash function and seed, sizes
+ * of the key, value and slot, number of slots and pairs, a checksum. The image is not
+ * loaded if the header does not match the expected layout or the sizes in the header do not
+ * match the size of the file. The image is written in the native byte order. The slots are open addressing with linear probing, the image is at most half full.
+ *
+ * save() writes a temporary file and renames it - processes which mapped the previous
+ * image keep using the old pages.
+ *
+ * Example of usage:
+ *
+ *   typedef HashTableImage<uint32_t, uint32_t> MyImage;
+ *   MyImage::save("/var/run/routes.bin", *lockfreeHashTable);
+ *   ....
+ *   MyImage image("/var/run/routes.bin");
+ *   uint32_t route;
+ *   if (image.isLoaded() && image.search(address, &route))
+ *       ...
+ *
+ * A HashTable stores pointers, the application provides functions which return the key
+ * and the value of the object:
+ *
+ *   MyImage::saveObjects<MyObject*>("/var/run/objects.bin", *hashTable, getKey, getValue);
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <type_traits>
+
+#include "HashTable.h"
+#include "MappedFile.h"
+
+struct HashTableImageHeader
+{
+    uint32_t magic;
+    uint32_t layoutVersion;
+    uint32_t hashFunction;
+    uint32_t seed;
+    uint16_t keySize;
+    uint16_t valueSize;
+    uint16_t slotSize;
+    uint16_t reserved;
+    uint64_t size;
+    uint64_t count;
+    uint64_t keysOffset;
+    uint64_t keysSize;
+    uint64_t checksum;
+};
+
+/**
+ * Trivially copyable keys are stored in the slot
+ */
+template<typename Key> struct HashTableImageKey
+{
+    typedef Key Stored;
+
+    static size_t getSize(const Key &)
+    {
+        return 0;
+    }
+
+    static Stored store(const Key &key, uint8_t *, uint64_t &)
+    {
+        return key;
+    }
+
+    static bool equal(const Stored &stored, const Key &key, const uint8_t *)
+    {
+        return (stored == key);
+    }
+
+    static bool verify(const Stored &, const uint8_t *, uint64_t)
+    {
+        return true;
+    }
+
+    static uint32_t hash(const Key &key, uint32_t seed)
+    {
+        return hashCrc32c((const uint8_t*)&key, sizeof(key), seed);
+    }
+};
+
+/**
+ * Strings are stored after the slots, the slot keeps offset of the string
+ */
+template<> struct HashTableImageKey<const char*>
+{
+    typedef uint64_t Stored;
+
+    static size_t getSize(const char *key)
+    {
+        return strlen(key) + 1;
+    }
+
+    static Stored store(const char *key, uint8_t *keys, uint64_t &keysUsed)
+    {
+        Stored offset = keysUsed;
+        size_t size = getSize(key);
+        memcpy(keys + offset, key, size);
+        keysUsed += size;
+        return offset;
+    }
+
+    static bool equal(const Stored &stored, const char *key, const uint8_t *keys)
+    {
+        return (strcmp((const char*)(keys + stored), key) == 0);
+    }
+
+    /**
+     * The string starts and is terminated inside of the keys area
+     */
+    static bool verify(const Stored &stored, const uint8_t *keys, uint64_t keysSize)
+    {
+        return (stored < keysSize) && (memchr(keys + stored, 0, keysSize - stored) != nullptr);
+    }
+
+    static uint32_t hash(const char *key, uint32_t seed)
+    {
+        return hashCrc32c((const uint8_t*)key, strlen(key), seed);
+    }
+};
+
+/**
+ * Pairs of a table which implements getNext(index, Key*, Value*) - LockfreeHashTable,
+ * HashTableFlat
+ */
+template<typename Table, typename Key, typename Value> class HashTableImagePairs
+{
+public:
+    HashTableImagePairs(const Table &table) : table(table), index(0)
+    {
+    }
+
+    void rewind()
+    {
+        index = 0;
+    }
+
+    bool next(Key *key, Value *value)
+    {
+        if (table.getNext(index, key, value) != Table::GETNEXT_OK)
+        {
+            return false;
+        }
+        index++;
+        return true;
+    }
+
+protected:
+    const Table &table;
+    uint_fast32_t index;
+};
+
+/**
+ * Objects of a HashTable, getNext(index, Object*)
+ */
+template<typename Table, typename Object, typename Key, typename Value, typename KeyOf, typename ValueOf>
+class HashTableImageObjects
+{
+public:
+    HashTableImageObjects(const Table &table, KeyOf keyOf, ValueOf valueOf) :
+        table(table), keyOf(keyOf), valueOf(valueOf), index(0)
+    {
+    }
+
+    void rewind()
+    {
+        index = 0;
+    }
+
+    bool next(Key *key, Value *value)
+    {
+        Object object;
+        if (table.getNext(index, &object) != Table::GETNEXT_OK)
+        {
+            return false;
+        }
+        *key = keyOf(object);
+        *value = valueOf(object);
+        index++;
+        return true;
+    }
+
+protected:
+    const Table &table;
+    KeyOf keyOf;
+    ValueOf valueOf;
+    uint_fast32_t index;
+};
+
+template<typename Key, typename Value>
+class HashTableImage
+{
+public:
+
+    static const uint32_t MAGIC = 0x48544249;
+    static const uint32_t LAYOUT_VERSION = 1;
+
+    /**
+     * Header is padded to a cache line, the slots are cache line aligned
+     */
+    static const size_t HEADER_SIZE = 64;
+
+    /**
+     * Map the image read only. Check isLoaded()
+     */
+    HashTableImage(const char *path) : file(path), header(nullptr), slots(nullptr), keys(nullptr)
+    {
+        static_assert(sizeof(HashTableImageHeader) <= HEADER_SIZE, "Header of the hash table image is too large");
+        static_assert(std::is_trivially_copyable<Value>::value, "HashTableImage stores trivially copyable values");
+        if (!file.isMapped() || (file.getSize() < HEADER_SIZE))
+        {
+            return;
+        }
+        const HashTableImageHeader *header = (const HashTableImageHeader*)file.getAddress();
+        bool loaded = (header->magic == MAGIC);
+        loaded = loaded && (header->layoutVersion == LAYOUT_VERSION);
+        loaded = loaded && (header->hashFunction == HASH_CRC32C);
+        loaded = loaded && (header->keySize == sizeof(typename KeyTraits::Stored));
+        loaded = loaded && (header->valueSize == sizeof(Value));
+        loaded = loaded && (header->slotSize == sizeof(Slot));
+        loaded = loaded && (header->size != 0) && ((header->size & (header->size - 1)) == 0);
+        loaded = loaded && (header->count < header->size);
+        // Compare the sizes without overflow, the slots and the keys shall fit the file
+        loaded = loaded && (header->size <= (file.getSize() - HEADER_SIZE) / sizeof(Slot));
+        loaded = loaded && (header->keysOffset == HEADER_SIZE + header->size * sizeof(Slot));
+        loaded = loaded && (header->keysSize == file.getSize() - header->keysOffset);
+        if (!loaded)
+        {
+            return;
+        }
+        this->header = header;
+        this->slots = (const Slot*)(file.getAddress() + HEADER_SIZE);
+        this->keys = file.getAddress() + header->keysOffset;
+    }
+
+    bool isLoaded() const
+    {
+        return (header != nullptr);
+    }
+
+    /**
+     * Calculate the checksum of the slots and the keys, check the number of used slots
+     * and that every string key is inside of the keys area. The constructor checks only
+     * the header - the startup does not read the whole file. Call verify() if the file
+     * can be damaged or comes from an untrusted source, search() in a file which failed
+     * verify() can read outside of the mapping
+     */
+    bool verify() const
+    {
+        if (!isLoaded())
+        {
+            return false;
+        }
+        if (header->checksum != MappedFile::checksum(file.getAddress() + HEADER_SIZE, file.getSize() - HEADER_SIZE))
+        {
+            return false;
+        }
+        uint64_t used = 0;
+        for (uint64_t i = 0;i < header->size;i++)
+        {
+            const Slot &slot = slots[i];
+            if (!slot.used)
+            {
+                continue;
+            }
+            if (!KeyTraits::verify(slot.key, keys, header->keysSize))
+            {
+                return false;
+            }
+            used++;
+        }
+        return (used == header->count);
+    }
+
+    bool search(const Key &key, Value *value) const
+    {
+        if (!isLoaded())
+        {
+            return false;
+        }
+        const Slot *slot = find(slots, header->size, keys, key, KeyTraits::hash(key, header->seed));
+        if ((slot == nullptr) || !slot->used)
+        {
+            return false;
+        }
+        *value = slot->value;
+        return true;
+    }
+
+    uint64_t getCount() const
+    {
+        return isLoaded() ? header->count : 0;
+    }
+
+    uint64_t getSize() const
+    {
+        return isLoaded() ? header->size : 0;
+    }
+
+    /**
+     * Write pairs of a LockfreeHashTable or a HashTableFlat to the file
+     */
+    template<typename Table> static bool save(const char *path, const Table &table, uint32_t seed = 0)
+    {
+        HashTableImagePairs<Table, Key, Value> pairs(table);
+        return write(path, pairs, seed);
+    }
+
+    /**
+     * Write objects of a HashTable, keyOf(object) and valueOf(object) return the key
+     * and the value of the object
+     */
+    template<typename Object, typename Table, typename KeyOf, typename ValueOf>
+    static bool saveObjects(const char *path, const Table &table, KeyOf keyOf, ValueOf valueOf, uint32_t seed = 0)
+    {
+        HashTableImageObjects<Table, Object, Key, Value, KeyOf, ValueOf> objects(table, keyOf, valueOf);
+        return write(path, objects, seed);
+    }
+
+    /**
+     * Pairs shall implement rewind() and next(Key*, Value*). The pairs are read twice:
+     * the first pass calculates size of the file. If the source table is modified
+     * between the passes the function can fail
+     */
+    template<typename Pairs> static bool write(const char *path, Pairs &pairs, uint32_t seed = 0);
+
+protected:
+
+    typedef HashTableImageKey<Key> KeyTraits;
+
+    struct Slot
+    {
+        typename KeyTraits::Stored key;
+        Value value;
+        uint32_t hash;
+        uint32_t used;
+    };
+
+    /**
+     * Returns the slot with the key or the first empty slot. Returns nullptr
+     * if all slots are occupied - possible only in a damaged file
+     */
+    static const Slot *find(const Slot *slots, uint64_t size, const uint8_t *keys, const Key &key, uint32_t hash)
+    {
+        const uint64_t mask = size - 1;
+        uint64_t index = hash & mask;
+        for (uint64_t probes = 0;probes < size;probes++)
+        {
+            const Slot *slot = &slots[index];
+            if (!slot->used)
+            {
+                return slot;
+            }
+            if ((slot->hash == hash) && KeyTraits::equal(slot->key, key, keys))
+            {
+                return slot;
+            }
+            index = (index + 1) & mask;
+        }
+        return nullptr;
+    }
+
+    MappedFile file;
+    const HashTableImageHeader *header;
+    const Slot *slots;
+    const uint8_t *keys;
+};
+
+template<typename Key, typename Value>
+template<typename Pairs>
+bool HashTableImage<Key, Value>::write(const char *path, Pairs &pairs, uint32_t seed)
+{
+    Key key;
+    Value value;
+    uint64_t count = 0;
+    uint64_t keysSize = 0;
+    pairs.rewind();
+    while (pairs.next(&key, &value))
+    {
+        count++;
+        keysSize += KeyTraits::getSize(key);
+    }
+
+    uint64_t size = 8;
+    while (size < 2 * count)
+    {
+        size *= 2;
+    }
+    const uint64_t keysOffset = HEADER_SIZE + size * sizeof(Slot);
+    const uint64_t fileSize = keysOffset + keysSize;
+
+    char tmpPath[256];
+    if (snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path) >= (int)sizeof(tmpPath))
+    {
+        return false;
+    }
+    bool res;
+    {
+        MappedFile file(tmpPath, fileSize);
+        if (!file.isMapped())
+        {
+            unlink(tmpPath);
+            return false;
+        }
+        uint8_t *address = file.getAddress();
+        memset(address, 0, fileSize);
+        Slot *slots = (Slot*)(address + HEADER_SIZE);
+        uint8_t *keys = address + keysOffset;
+        uint64_t keysUsed = 0;
+        uint64_t stored = 0;
+        res = true;
+        pairs.rewind();
+        while (pairs.next(&key, &value))
+        {
+            if ((stored == count) || ((keysUsed + KeyTraits::getSize(key)) > keysSize))
+            {
+                res = false;
+                break;
+            }
+            uint32_t hash = KeyTraits::hash(key, seed);
+            Slot *slot = const_cast<Slot*>(find(slots, size, keys, key, hash));
+            if (slot->used)
+            {
+                continue;
+            }
+            slot->key = KeyTraits::store(key, keys, keysUsed);
+            slot->value = value;
+            slot->hash = hash;
+            slot->used = 1;
+            stored++;
+        }
+
+        HashTableImageHeader *header = (HashTableImageHeader*)address;
+        header->magic = MAGIC;
+        header->layoutVersion = LAYOUT_VERSION;
+        header->hashFunction = HASH_CRC32C;
+        header->seed = seed;
+        header->keySize = sizeof(typename KeyTraits::Stored);
+        header->valueSize = sizeof(Value);
+        header->slotSize = sizeof(Slot);
+        header->size = size;
+        header->count = stored;
+        header->keysOffset = keysOffset;
+        header->keysSize = keysSize;
+        header->checksum = MappedFile::checksum(address + HEADER_SIZE, fileSize - HEADER_SIZE);
+        res = res && file.sync();
+    }
+    res = res && (rename(tmpPath, path) == 0);
+    if (!res)
+    {
+        unlink(tmpPath);
+    }
+    return res;
+}
@@ -0,0 +1,443 @@
+/**
+ * Hash table for read mostly data - configuration, routing tables. Same API and
+ * collision handling as HashTable
+ *
+ * The writers (insert, remove, rehash) are serialized by the Lock. search() does not take
+ * the lock and does not write to shared memory - the readers scale with the number of cores.
+ *
+ * The objects never move inside of a table. A writer updates an entry with an atomic store,
+ * a reader loads the entries of the probing window with atomic loads and sees
+ * either the old or the new object. rehash() builds a complete new table and replaces the
+ * current table with one store (RCU). The readers run inside of an EpochReclamation
+ * critical section, the old table returns to the Allocator after all readers which could
+ * read the old table are done.
+ *
+ * Limitations:
+ * - The table does not protect the objects. An object removed from the table can be still
+ * used by a reader. The application frees the removed objects after a grace period, for
+ * example using its own EpochReclamation.
+ * - search() does not update the statistics.
+ * - Up to 64 living threads search without a lock, see EpochReclamation. In other threads
+ *   search() takes the Lock and waits for the writers.
+ * - Object is a pointer, nullptr marks an empty entry.
+ *
+ * Example of usage:
+ *
+ *   typedef HashTableReadMostly<struct Route*, uint32_t, MyLock,
+ *                      AllocatorTrivial, struct Route, struct Route> RouteTable;
+ *   RouteTable *routeTable = RouteTable::create("routes", 1024);
+ *   routeTable->insert(route->prefix, route);   // control plane
+ *   Route *route;
+ *   if (routeTable->search(prefix, &route))    // data plane, any number of threads
+ *       forward(packet, route->nextHop);
+ */
+
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+
+#include "HashTable.h"
+#include "EpochReclamation.h"
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+class HashTableReadMostly: public HashTableBase
+{
+public:
+
+    enum InsertResult
+    {
+        INSERT_DONE,
+        INSERT_COLLISION,
+        INSERT_DUPLICATE,
+        INSERT_FAILED
+    };
+
+    /**
+     * Add a new entry to the hash table. The function fails with INSERT_COLLISION if
+     * all entries in the probe window are occupied
+     */
+    enum InsertResult insert(const Key &key, const Object &object)
+    {
+        Lock lock;
+        return insert(key, object, current.load(std::memory_order_relaxed), true);
+    }
+
+    /**
+     * Insert with automatic call to rehash if the probe window is full.
+     * See setResizeFactor()
+     *
+     * @param maxSize - maximum size for the table
+     */
+    enum InsertResult insert(const Key &key, const Object &object, uint_fast32_t maxSize);
+
+    bool remove(const Key &key);
+
+    void removeAll();
+
+    /**
+     * Lock free, can run in parallel with the writers. A thread without a slot in
+     * the EpochReclamation takes the Lock
+     */
+    bool search(const Key &key, Object *object);
+
+    /**
+     * Build a new table and replace the current table. If an object does not fit
+     * the new table the function returns INSERT_COLLISION and keeps the current table
+     */
+    enum InsertResult rehash(const uint_fast32_t size)
+    {
+        Lock lock;
+        return rehashNoLock(size);
+    }
+
+    enum GetNextResult
+    {
+        GETNEXT_FAILED,
+        GETNEXT_OK,
+        GETNEXT_END_TABLE
+    };
+
+    /**
+     * Writer side, shall not run in parallel with rehash()
+     * @param index - use zero to get the first stored object
+     */
+    enum GetNextResult getNext(uint_fast32_t &index, Object *object) const;
+
+    static HashTableReadMostly *create(const char *name, uint_fast32_t size)
+    {
+        Table *table = allocateTable(size);
+        if (table == nullptr)
+        {
+            return nullptr;
+        }
+        void *hashTableMemory = Allocator::alloc(sizeof(HashTableReadMostly));
+        if (hashTableMemory == nullptr)
+        {
+            freeTable(table);
+            return nullptr;
+        }
+        HashTableReadMostly *hashTable = new (hashTableMemory) HashTableReadMostly(name, table);
+        return hashTable;
+    }
+
+    /**
+     * No thread can call search()
+     */
+    static void destroy(HashTableReadMostly *hashTable)
+    {
+        hashTable->~HashTableReadMostly();
+        Allocator::free((void *)hashTable);
+    }
+
+protected:
+
+    static const int MAX_COLLISIONS = 3;
+
+    typedef std::atomic<Object> TableEntry;
+
+    struct Table
+    {
+        uint_fast32_t size;
+        TableEntry *entries;
+        /**
+         * Tables which could not be retired, see rehash()
+         */
+        Table *retired;
+    };
+
+    /**
+     * EpochReclamation returns the old tables here
+     */
+    struct TableReclamationPool
+    {
+        void free(Table *table)
+        {
+            freeTable(table);
+        }
+    };
+
+    typedef EpochReclamation<Table, TableReclamationPool, 64, 4> TableReclamation;
+
+    HashTableReadMostly(const char *name, Table *table) :
+        HashTableBase(name), current(table), reclamation(tableReclamationPool)
+    {
+        static_assert(std::is_pointer<Object>::value, "HashTableReadMostly keeps pointers, nullptr marks an empty entry");
+        this->size = table->size;
+        this->collisionsInTheTable = 0;
+    }
+
+    ~HashTableReadMostly()
+    {
+        freeTable(current.load());
+    }
+
+    /**
+     * The table is protected by the EpochReclamation or by the Lock
+     */
+    static bool search(const Key &key, Object *object, const Table *table);
+
+    static uint_fast32_t getIndex(const Key &key, uint_fast32_t size)
+    {
+        uint_fast32_t hash = Hash::hash(key);
+        uint_fast32_t index = hash % size;
+        return index;
+    }
+
+    static uint_fast32_t getAllocatedSize(uint_fast32_t size)
+    {
+        return size + MAX_COLLISIONS;
+    }
+
+    static Table *allocateTable(uint_fast32_t size)
+    {
+        uint_fast32_t entries = getAllocatedSize(size);
+        void *memory = Allocator::alloc(sizeof(Table) + entries * sizeof(TableEntry));
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+        Table *table = new (memory) Table();
+        table->size = size;
+        table->entries = reinterpret_cast<TableEntry*>(table + 1);
+        table->retired = nullptr;
+        for (uint_fast32_t i = 0;i < entries;i++)
+        {
+            new (&table->entries[i]) TableEntry(nullptr);
+        }
+        return table;
+    }
+
+    static void freeTable(Table *table)
+    {
+        while (table != nullptr)
+        {
+            Table *retired = table->retired;
+            table->~Table();
+            Allocator::free((void *)table);
+            table = retired;
+        }
+    }
+
+    /**
+     * The caller holds the lock
+     */
+    enum InsertResult insert(const Key &key, const Object &object, Table *table, bool updateCount);
+
+    enum InsertResult rehashNoLock(const uint_fast32_t size);
+
+    std::atomic<Table*> current;
+    TableReclamationPool tableReclamationPool;
+    TableReclamation reclamation;
+};
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
+HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::insert(const Key &key, const Object &object,
+        Table *table, bool updateCount)
+{
+    statistics.insertTotal++;
+    TableEntry *tableEntry = &table->entries[getIndex(key, table->size)];
+    TableEntry *freeEntry = nullptr;
+    int freeCollisions = 0;
+    for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
+    {
+        Object entry = tableEntry->load(std::memory_order_relaxed);
+        if (entry == nullptr)
+        {
+            if (freeEntry == nullptr)
+            {
+                freeEntry = tableEntry;
+                freeCollisions = collisions;
+            }
+        }
+        else if (Comparator::equal(entry, key))
+        {
+            statistics.insertDuplicate++;
+            return INSERT_DUPLICATE;
+        }
+        tableEntry++;                   // I can do this - table contains (size+MAX_COLLISIONS) entries
+    }
+
+    if (freeEntry == nullptr)
+    {
+        statistics.insertHashMaxCollision++;
+        return INSERT_COLLISION;
+    }
+
+    // The object shall be initialized before a reader can find it
+    freeEntry->store(object, std::memory_order_release);
+    statistics.insertHashCollision += freeCollisions;
+    this->collisionsInTheTable += freeCollisions;
+    if (updateCount)
+    {
+        this->count++;
+    }
+    statistics.insertOk++;
+    return INSERT_DONE;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
+HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::insert(const Key &key, const Object &object,
+        uint_fast32_t maxSize)
+{
+    Lock lock;
+    InsertResult insertResult = insert(key, object, current.load(std::memory_order_relaxed), true);
+    uint_fast32_t newSize = getSize();
+    while ((insertResult == INSERT_COLLISION) && (newSize < maxSize))
+    {
+        // If an object does not fit the new table try a larger one
+        newSize = (newSize * (100 + this->resizeFactor)) / 100 + 1;
+        if (newSize > maxSize)
+        {
+            newSize = maxSize;
+        }
+        InsertResult rehashResult = rehashNoLock(newSize);
+        if (rehashResult == INSERT_FAILED)
+        {
+            insertResult = INSERT_FAILED;
+            break;
+        }
+        if (rehashResult == INSERT_DONE)
+        {
+            insertResult = insert(key, object, current.load(std::memory_order_relaxed), true);
+        }
+    }
+    return insertResult;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+bool HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::remove(const Key &key)
+{
+    Lock lock;
+    statistics.removeTotal++;
+    Table *table = current.load(std::memory_order_relaxed);
+    TableEntry *tableEntry = &table->entries[getIndex(key, table->size)];
+    for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
+    {
+        Object entry = tableEntry->load(std::memory_order_relaxed);
+        if (entry != nullptr)
+        {
+            if (Comparator::equal(entry, key))
+            {
+                statistics.removeOk++;
+                tableEntry->store(nullptr, std::memory_order_release);
+                this->count--;
+                this->collisionsInTheTable -= collisions;
+                return true;
+            }
+            statistics.removeCollision++;
+        }
+        tableEntry++;
+    }
+    statistics.removeFailed++;
+    return false;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+bool HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::search(const Key &key, Object *object)
+{
+    typename TableReclamation::Guard guard(reclamation);
+    if (hashtable_likely(guard.isActive()))
+    {
+        return search(key, object, current.load(std::memory_order_acquire));
+    }
+    // The writers replace the table under the lock
+    Lock lock;
+    return search(key, object, current.load(std::memory_order_acquire));
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+bool HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::search(const Key &key, Object *object, const Table *table)
+{
+    const TableEntry *tableEntry = &table->entries[getIndex(key, table->size)];
+    for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
+    {
+        Object entry = tableEntry->load(std::memory_order_acquire);
+        if ((entry != nullptr) && Comparator::equal(entry, key))
+        {
+            *object = entry;
+            return true;
+        }
+        tableEntry++;
+    }
+    return false;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+void HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::removeAll()
+{
+    Lock lock;
+    Table *table = current.load(std::memory_order_relaxed);
+    for (uint_fast32_t i = 0;i < getAllocatedSize(table->size);i++)
+    {
+        table->entries[i].store(nullptr, std::memory_order_release);
+    }
+    this->count = 0;
+    this->collisionsInTheTable = 0;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
+HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::rehashNoLock(const uint_fast32_t size)
+{
+    statistics.rehashTotal++;
+    Table *newTable = allocateTable(size);
+    if (newTable == nullptr)
+    {
+        statistics.rehashFailed++;
+        return INSERT_FAILED;
+    }
+
+    Table *table = current.load(std::memory_order_relaxed);
+    uint_fast32_t collisions = this->collisionsInTheTable;
+    this->collisionsInTheTable = 0;
+    for (uint_fast32_t i = 0;i < getAllocatedSize(table->size);i++)
+    {
+        Object entry = table->entries[i].load(std::memory_order_relaxed);
+        if (entry != nullptr)
+        {
+            if (insert(Hash::getKey(entry), entry, newTable, false) != INSERT_DONE)
+            {
+                statistics.rehashCollision++;
+                this->collisionsInTheTable = collisions;
+                freeTable(newTable);
+                return INSERT_COLLISION;
+            }
+            statistics.rehashDone++;
+        }
+    }
+
+    current.store(newTable, std::memory_order_release);
+    this->size = size;
+    // Readers can still use the old table. If the retire list is full keep the
+    // old table until destroy()
+    if (!reclamation.retire(table))
+    {
+        newTable->retired = table;
+    }
+    else
+    {
+        reclamation.reclaim();
+    }
+    return INSERT_DONE;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::GetNextResult
+HashTableReadMostly<Object, Key, Lock, Allocator, Hash, Comparator>::getNext(uint_fast32_t &index, Object *object) const
+{
+    const Table *table = current.load(std::memory_order_acquire);
+    for (uint_fast32_t i = index;i < getAllocatedSize(table->size);i++)
+    {
+        Object entry = table->entries[i].load(std::memory_order_acquire);
+        if (entry != nullptr)
+        {
+            *object = entry;
+            index = i;
+            return GETNEXT_OK;
+        }
+    }
+    return GETNEXT_END_TABLE;
+}
@@ -0,0 +1,469 @@
+/**
+ * Linear probing hash table with Robin Hood insertion, same API as HashTable
+ *
+ * HashTable limits the probing to MAX_COLLISIONS slots and the insert with maxSize
+ * grows the table on every collision. The typical size/count ratio is 3-5.
+ * This table keeps for every slot the distance from the slot the object hashes to.
+ * An insert which meets an object closer to its home slot than the inserted object
+ * takes the slot and continues with the displaced object ("take from the rich").
+ * The probe lengths are short and similar for all objects and the table can run
+ * at 90% load.
+ *
+ * A search stops at an empty slot or when the distance of the slot is smaller than
+ * the distance of the searched key. Only slots with the exact distance are
+ * compared with the key.
+ *
+ * remove() shifts the following objects back by one slot (backward shift deletion).
+ * There are no tombstones, the table does not degrade after many removes.
+ *
+ * Object, Key, Lock, Allocator, Hash and Comparator are the same as in HashTable
+ *
+ * Example of usage:
+ *
+ *   typedef HashTableRobinHood<struct MyHashObject*, const char*, LockDummy,
+ *                      AllocatorTrivial, struct MyHashObject,
+ *                      struct MyHashObject> MyHashTable;
+ *   MyHashTable *hashTable = MyHashTable::create("myHashTable", 1024);
+ *   hashTable->insert(o1.getKey(&o1), &o1);
+ */
+
+#pragma once
+
+#include "HashTable.h"
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+class HashTableRobinHood: public HashTableBase
+{
+public:
+
+    enum InsertResult
+    {
+        INSERT_DONE,
+        INSERT_COLLISION,
+        INSERT_DUPLICATE,
+        INSERT_FAILED
+    };
+
+    /**
+     * Add a new entry to the hash table. The function fails if the table is full
+     * or the probe length reached the limit, see also insert() with maxSize
+     */
+    enum InsertResult insert(const Key &key, const Object &object)
+    {
+        Lock lock;
+        return insertNoLock(key, object);
+    }
+
+    /**
+     * Insert with automatic call to rehash if the table is full. See setResizeFactor()
+     *
+     * @param maxSize - maximum size for the table
+     */
+    enum InsertResult insert(const Key &key, const Object &object, uint_fast32_t maxSize);
+
+    bool remove(const Key &key);
+
+    void removeAll();
+
+    bool search(const Key &key, Object *object, bool skipKeyCompare=false);
+
+    /**
+     * Allocate a new table for 'size' objects and move the objects
+     */
+    enum InsertResult rehash(const uint_fast32_t size);
+
+    enum GetNextResult
+    {
+        GETNEXT_FAILED,
+        GETNEXT_OK,
+        GETNEXT_END_TABLE
+    };
+
+    /**
+     * @param index - use zero to get the first stored object
+     */
+    enum GetNextResult getNext(uint_fast32_t &index, Object *object) const;
+
+    /**
+     * The longest probe sequence since the last rehash
+     */
+    uint_fast32_t getMaxProbeLength() const
+    {
+        return maxDistance;
+    }
+
+    /**
+     * @param size - initial number of objects the table can store
+     */
+    static HashTableRobinHood *create(const char *name, uint_fast32_t size)
+    {
+        uint_fast32_t capacity = getCapacity(size);
+        Table table = allocateTable(capacity);
+        if (table.distances == nullptr)
+        {
+            return nullptr;
+        }
+        void *hashTableMemory = Allocator::alloc(sizeof(HashTableRobinHood));
+        if (hashTableMemory == nullptr)
+        {
+            freeTable(table);
+            return nullptr;
+        }
+        HashTableRobinHood *hashTable = new (hashTableMemory) HashTableRobinHood(name, table, capacity);
+        return hashTable;
+    }
+
+    static void destroy(HashTableRobinHood *hashTable)
+    {
+        hashTable->~HashTableRobinHood();
+        freeTable(hashTable->table);
+        Allocator::free((void *)hashTable);
+    }
+
+protected:
+
+    /**
+     * Distance zero is an empty slot, the object in the home slot has distance 1
+     */
+    typedef uint8_t Distance;
+    static const Distance DISTANCE_EMPTY = 0;
+    static const Distance DISTANCE_MAX = 255;
+
+    /**
+     * Maximum load in percents
+     */
+    static const uint_fast32_t MAX_LOAD = 90;
+
+    struct Table
+    {
+        Distance *distances;
+        Object *slots;
+    };
+
+    HashTableRobinHood(const char *name, Table table, uint_fast32_t capacity) : HashTableBase(name)
+    {
+        static_assert(sizeof(Object) <= sizeof(uintptr_t), "HashTableRobinHood is intended to work only with integral types or pointers");
+        this->table = table;
+        this->mask = capacity - 1;
+        this->size = getMaxCount(capacity);
+        this->collisionsInTheTable = 0;
+        this->maxDistance = 0;
+    }
+
+    ~HashTableRobinHood()
+    {
+    }
+
+    static uint_fast32_t getCapacity(uint_fast32_t size)
+    {
+        uint_fast32_t capacity = 16;
+        while (getMaxCount(capacity) < size)
+        {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    static uint_fast32_t getMaxCount(uint_fast32_t capacity)
+    {
+        return (capacity * MAX_LOAD) / 100;
+    }
+
+    static Table allocateTable(uint_fast32_t capacity)
+    {
+        Table table;
+        size_t distancesSize = (capacity * sizeof(Distance) + sizeof(Object) - 1) & ~(sizeof(Object) - 1);
+        table.distances = (Distance*)Allocator::alloc(distancesSize + capacity * sizeof(Object));
+        table.slots = nullptr;
+        if (table.distances != nullptr)
+        {
+            memset(table.distances, DISTANCE_EMPTY, capacity * sizeof(Distance));
+            table.slots = reinterpret_cast<Object*>((uint8_t*)table.distances + distancesSize);
+        }
+        return table;
+    }
+
+    static void freeTable(Table table)
+    {
+        Allocator::free((void*)table.distances);
+    }
+
+    /**
+     * Find the slot of the key, returns -1 if the key is not in the table
+     */
+    inline int_fast32_t find(const Key &key, bool skipKeyCompare) const;
+
+    enum InsertResult insertNoLock(const Key &key, const Object &object);
+
+    Table table;
+    uint_fast32_t mask;
+    uint_fast32_t maxDistance;
+};
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+inline int_fast32_t HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::find(const Key &key, bool skipKeyCompare) const
+{
+    uint_fast32_t index = Hash::hash(key) & mask;
+    for (uint_fast32_t distance = 1;distance <= maxDistance;distance++)
+    {
+        Distance slotDistance = table.distances[index];
+        // An object with this key would have displaced the object in the slot
+        if (slotDistance < distance)
+        {
+            break;
+        }
+        if (slotDistance == distance)
+        {
+            if (skipKeyCompare || Comparator::equal(table.slots[index], key))
+            {
+                return index;
+            }
+        }
+        index = (index + 1) & mask;
+    }
+    return -1;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
+HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::insertNoLock(const Key &key, const Object &object)
+{
+    statistics.insertTotal++;
+    if (find(key, false) >= 0)
+    {
+        statistics.insertDuplicate++;
+        return INSERT_DUPLICATE;
+    }
+    if (this->count >= getSize())
+    {
+        statistics.insertFailed++;
+        return INSERT_FAILED;
+    }
+
+    // Check that the displaced objects do not exceed the maximum distance before
+    // modifying the table
+    uint_fast32_t index = Hash::hash(key) & mask;
+    uint_fast32_t distance = 1;
+    uint_fast32_t first = index;
+    while (table.distances[index] != DISTANCE_EMPTY)
+    {
+        if (table.distances[index] < distance)
+        {
+            distance = table.distances[index];
+        }
+        if (distance == DISTANCE_MAX)
+        {
+            statistics.insertHashMaxCollision++;
+            statistics.insertFailed++;
+            return INSERT_FAILED;
+        }
+        distance++;
+        index = (index + 1) & mask;
+    }
+
+    // An object out of its home slot is a collision. The inserted object is counted
+    // where it lands, a displaced object when it leaves its home slot
+    index = first;
+    Object carry = object;
+    Distance carryDistance = 1;
+    bool carryInserted = true;
+    while (true)
+    {
+        Distance slotDistance = table.distances[index];
+        if (slotDistance == DISTANCE_EMPTY)
+        {
+            table.distances[index] = carryDistance;
+            table.slots[index] = carry;
+            if (carryDistance > maxDistance)
+            {
+                maxDistance = carryDistance;
+            }
+            if (carryInserted && (carryDistance > 1))
+            {
+                this->collisionsInTheTable++;
+            }
+            break;
+        }
+        if (slotDistance < carryDistance)
+        {
+            Object displaced = table.slots[index];
+            table.slots[index] = carry;
+            table.distances[index] = carryDistance;
+            if (carryDistance > maxDistance)
+            {
+                maxDistance = carryDistance;
+            }
+            if (carryInserted && (carryDistance > 1))
+            {
+                this->collisionsInTheTable++;
+            }
+            if (slotDistance == 1)
+            {
+                this->collisionsInTheTable++;
+            }
+            carry = displaced;
+            carryDistance = slotDistance;
+            carryInserted = false;
+        }
+        statistics.insertHashCollision++;
+        carryDistance++;
+        index = (index + 1) & mask;
+    }
+
+    this->count++;
+    statistics.insertOk++;
+    return INSERT_DONE;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
+HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::insert(const Key &key, const Object &object,
+        uint_fast32_t maxSize)
+{
+    InsertResult insertResult = insert(key, object);
+    while ((insertResult == INSERT_FAILED) && (getSize() < maxSize))
+    {
+        uint_fast32_t newSize = (getSize() * (100 + this->resizeFactor)) / 100;
+        if (newSize <= getSize())
+        {
+            newSize = getSize() + 1;
+        }
+        if (newSize > maxSize)
+        {
+            newSize = maxSize;
+        }
+        if (rehash(newSize) != INSERT_DONE)
+        {
+            break;
+        }
+        insertResult = insert(key, object);
+    }
+    return insertResult;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+bool HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::remove(const Key &key)
+{
+    Lock lock;
+    statistics.removeTotal++;
+    int_fast32_t slot = find(key, false);
+    if (slot < 0)
+    {
+        statistics.removeFailed++;
+        return false;
+    }
+    uint_fast32_t index = slot;
+    if (table.distances[index] > 1)
+    {
+        this->collisionsInTheTable--;
+    }
+    // Shift the following objects back until an empty slot or an object in its home slot
+    uint_fast32_t next = (index + 1) & mask;
+    while (table.distances[next] > 1)
+    {
+        table.slots[index] = table.slots[next];
+        table.distances[index] = table.distances[next] - 1;
+        if (table.distances[index] == 1)
+        {
+            this->collisionsInTheTable--;
+        }
+        index = next;
+        next = (next + 1) & mask;
+    }
+    table.distances[index] = DISTANCE_EMPTY;
+    this->count--;
+    statistics.removeOk++;
+    return true;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+void HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::removeAll()
+{
+    Lock lock;
+    memset(table.distances, DISTANCE_EMPTY, (mask + 1) * sizeof(Distance));
+    this->count = 0;
+    this->collisionsInTheTable = 0;
+    this->maxDistance = 0;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+bool HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::search(const Key &key, Object *object, bool skipKeyCompare)
+{
+    Lock lock;
+    statistics.searchTotal++;
+    int_fast32_t slot = find(key, skipKeyCompare);
+    if (slot < 0)
+    {
+        statistics.searchFailed++;
+        return false;
+    }
+    if (skipKeyCompare)
+    {
+        statistics.searchSkipCompare++;
+    }
+    *object = table.slots[slot];
+    statistics.searchOk++;
+    return true;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::GetNextResult
+HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::getNext(uint_fast32_t &index, Object *object) const
+{
+    for (uint_fast32_t i = index;i <= mask;i++)
+    {
+        if (table.distances[i] != DISTANCE_EMPTY)
+        {
+            *object = table.slots[i];
+            index = i;
+            return GETNEXT_OK;
+        }
+    }
+    return GETNEXT_END_TABLE;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
+HashTableRobinHood<Object, Key, Lock, Allocator, Hash, Comparator>::rehash(const uint_fast32_t size)
+{
+    uint_fast32_t newCapacity = getCapacity(size);
+    Table newTable = allocateTable(newCapacity);
+
+    Lock lock;
+    statistics.rehashTotal++;
+    if (newTable.distances == nullptr)
+    {
+        statistics.rehashFailed++;
+        return INSERT_FAILED;
+    }
+
+    Table oldTable = table;
+    uint_fast32_t oldCapacity = mask + 1;
+    table = newTable;
+    mask = newCapacity - 1;
+    this->size = getMaxCount(newCapacity);
+    this->count = 0;
+    this->collisionsInTheTable = 0;
+    this->maxDistance = 0;
+
+    enum InsertResult rehashResult = INSERT_DONE;
+    for (uint_fast32_t i = 0;i < oldCapacity;i++)
+    {
+        if (oldTable.distances[i] == DISTANCE_EMPTY)
+        {
+            continue;
+        }
+        const Object &object = oldTable.slots[i];
+        if (insertNoLock(Hash::getKey(object), object) != INSERT_DONE)
+        {
+            rehashResult = INSERT_FAILED;
+            statistics.rehashCollision++;
+        }
+        else
+        {
+            statistics.rehashDone++;
+        }
+    }
+    freeTable(oldTable);
+    return rehashResult;
+}
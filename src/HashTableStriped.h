@@ -0,0 +1,536 @@
+/**
+ * Hash table with striped locks, same API and collision handling as HashTable
+ *
+ * HashTable constructs a stateless Lock object in every API - all operations in
+ * the table are serialized by one mutex. This table keeps an array of mutexes (stripes),
+ * every stripe guards groups of STRIPE_ENTRIES entries: the group i is guarded by
+ * the stripe (i % Stripes). insert, remove and search lock only the stripes covering the
+ * probe window of the key - one stripe, sometimes two. Operations on different keys run
+ * in parallel. rehash() and removeAll() lock all stripes.
+ *
+ * An operation reads the table pointer and the size without a lock, locks the stripes
+ * and checks the rehash sequence. If a rehash replaced the table in the meantime the
+ * operation unlocks the stripes and starts again.
+ *
+ * Mutex is any type which implements lock() and unlock(), for example std::mutex. The
+ * stripes are padded to the cache line.
+ *
+ * The statistics follow StatisticsPolicy, see HashTableStatisticsSharded. Operations on
+ * different stripes update the counters in parallel, the default sharded policy keeps the
+ * counters exact. The count is updated with atomic adds. getNext() shall not run in
+ * parallel with rehash().
+ *
+ * Example of usage:
+ *
+ *   typedef HashTableStriped<struct MyHashObject*, const char*, std::mutex,
+ *                      AllocatorTrivial, struct MyHashObject,
+ *                      struct MyHashObject> MyHashTable;
+ *   MyHashTable *hashTable = MyHashTable::create("myHashTable", 1024);
+ *   hashTable->insert(o1.getKey(&o1), &o1);
+ */
+
+#pragma once
+
+#include <atomic>
+
+#include "HashTable.h"
+
+template<typename Object, typename Key, typename Mutex, typename Allocator, typename Hash, typename Comparator, size_t Stripes = 64,
+    typename StatisticsPolicy = HashTableStatisticsSharded<> >
+class HashTableStriped: public HashTableBase
+{
+public:
+
+    enum InsertResult
+    {
+        INSERT_DONE,
+        INSERT_COLLISION,
+        INSERT_DUPLICATE,
+        INSERT_FAILED
+    };
+
+    /**
+     * Add a new entry to the hash table. The function fails with INSERT_COLLISION if
+     * all entries in the probe window are occupied
+     */
+    enum InsertResult insert(const Key &key, const Object &object);
+
+    /**
+     * Insert with automatic call to rehash if the probe window is full.
+     * See setResizeFactor()
+     *
+     * @param maxSize - maximum size for the table
+     */
+    enum InsertResult insert(const Key &key, const Object &object, uint_fast32_t maxSize);
+
+    bool remove(const Key &key);
+
+    void removeAll();
+
+    bool search(const Key &key, Object *object);
+
+    /**
+     * Lock all stripes, allocate a new table and move the objects. If an object
+     * does not fit the new table the function returns INSERT_COLLISION and keeps
+     * the existing table
+     */
+    enum InsertResult rehash(const uint_fast32_t size)
+    {
+        return rehash(0, size);
+    }
+
+    enum GetNextResult
+    {
+        GETNEXT_FAILED,
+        GETNEXT_OK,
+        GETNEXT_END_TABLE
+    };
+
+    /**
+     * @param index - use zero to get the first stored object
+     */
+    enum GetNextResult getNext(uint_fast32_t &index, Object *object) const;
+
+    const struct Statistics *getStatistics()
+    {
+        counters.collect(statistics);
+        return &statistics;
+    }
+
+    void resetStatistics()
+    {
+        HashTableBase::resetStatistics();
+        counters.reset();
+    }
+
+    /**
+     * By default the table assumes that nullptr means that the entry is not
+     * occupied
+     */
+    void setIllegalValue(const Object value)
+    {
+        this->illegalValue = value;
+    }
+
+    static HashTableStriped *create(const char *name, uint_fast32_t size)
+    {
+        Table table = allocateTable(size);
+        if (table == nullptr)
+        {
+            return nullptr;
+        }
+        void *hashTableMemory = Allocator::alloc(sizeof(HashTableStriped));
+        if (hashTableMemory == nullptr)
+        {
+            freeTable(table);
+            return nullptr;
+        }
+        HashTableStriped *hashTable = new (hashTableMemory) HashTableStriped(name, size, table);
+        return hashTable;
+    }
+
+    static void destroy(HashTableStriped *hashTable)
+    {
+        Table table = hashTable->table.load(std::memory_order_relaxed);
+        hashTable->~HashTableStriped();
+        freeTable(table);
+        Allocator::free((void *)hashTable);
+    }
+
+protected:
+
+    static const int MAX_COLLISIONS = 3;
+    /**
+     * 8 pointers, a cache line, share a stripe
+     */
+    static const uint_fast32_t STRIPE_ENTRIES = 8;
+
+    typedef Object TableEntry;
+    typedef TableEntry *Table;
+
+    struct alignas(64) Stripe
+    {
+        Mutex mutex;
+    };
+
+    /**
+     * Locks the stripes covering the probe window of the key in the current table
+     */
+    class StripeGuard
+    {
+    public:
+        StripeGuard(HashTableStriped &hashTable, const Key &key);
+
+        ~StripeGuard()
+        {
+            unlock();
+        }
+
+        /**
+         * The first entry of the probe window in the current table
+         */
+        TableEntry *getWindow() const
+        {
+            return window;
+        }
+
+    protected:
+
+        void unlock()
+        {
+            hashTable.stripes[last].mutex.unlock();
+            if (last != first)
+            {
+                hashTable.stripes[first].mutex.unlock();
+            }
+        }
+
+        HashTableStriped &hashTable;
+        TableEntry *window;
+        uint_fast32_t first;
+        uint_fast32_t last;
+    };
+
+    HashTableStriped(const char *name, uint_fast32_t size, Table table) : HashTableBase(name)
+    {
+        static_assert(sizeof(Object) <= sizeof(uintptr_t), "HashTableStriped is intended to work only with integral types or pointers");
+        this->size = size;
+        this->table.store(table, std::memory_order_relaxed);
+        this->tableSize.store(size, std::memory_order_relaxed);
+        this->sequence.store(0, std::memory_order_relaxed);
+        this->illegalValue = nullptr;
+        this->collisionsInTheTable = 0;
+    }
+
+    ~HashTableStriped()
+    {
+    }
+
+    static uint_fast32_t getIndex(const Key &key, uint_fast32_t size)
+    {
+        uint_fast32_t hash = Hash::hash(key);
+        uint_fast32_t index = hash % size;
+        return index;
+    }
+
+    static uint_fast32_t getStripe(uint_fast32_t index)
+    {
+        return (index / STRIPE_ENTRIES) % Stripes;
+    }
+
+    static uint_fast32_t getAllocatedSize(uint_fast32_t size)
+    {
+        return size + MAX_COLLISIONS;
+    }
+
+    static Table allocateTable(uint_fast32_t size)
+    {
+        uint_fast32_t bytes = getAllocatedSize(size) * sizeof(TableEntry);
+        Table table = (Table)Allocator::alloc(bytes);
+        if (table != nullptr)
+        {
+            memset(table, 0, bytes);
+        }
+        return table;
+    }
+
+    static void freeTable(Table table)
+    {
+        Allocator::free((void*)table);
+    }
+
+    void lockAll()
+    {
+        for (size_t i = 0;i < Stripes;i++)
+        {
+            stripes[i].mutex.lock();
+        }
+    }
+
+    void unlockAll()
+    {
+        for (size_t i = Stripes;i > 0;i--)
+        {
+            stripes[i-1].mutex.unlock();
+        }
+    }
+
+    /**
+     * Rehash if the size of the table is still 'expectedSize'. Threads which fail
+     * to insert in the same time grow the table only once.
+     * @param expectedSize - zero if the caller does not care
+     */
+    enum InsertResult rehash(uint_fast32_t expectedSize, uint_fast32_t size);
+
+    /**
+     * Place the object in the window, the caller holds the stripes
+     */
+    enum InsertResult insert(const Key &key, const Object &object, TableEntry *window, bool updateCount);
+
+    std::atomic<Table> table;
+    std::atomic<uint_fast32_t> tableSize;
+    /**
+     * Incremented every time the table is replaced
+     */
+    std::atomic<uint_fast32_t> sequence;
+    TableEntry illegalValue;
+    Stripe stripes[Stripes];
+    StatisticsPolicy counters;
+};
+
+template<typename Object, typename Key, typename Mutex, typename Allocator, typename Hash, typename Comparator, size_t Stripes, typename StatisticsPolicy>
+HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::StripeGuard::StripeGuard(HashTableStriped &hashTable, const Key &key) :
+    hashTable(hashTable)
+{
+    while (true)
+    {
+        uint_fast32_t sequence = hashTable.sequence.load(std::memory_order_acquire);
+        Table table = hashTable.table.load(std::memory_order_acquire);
+        uint_fast32_t size = hashTable.tableSize.load(std::memory_order_acquire);
+        uint_fast32_t index = getIndex(key, size);
+        // The window covers at most two neighbour stripes, lock in the ascending order
+        first = getStripe(index);
+        last = getStripe(index + MAX_COLLISIONS - 1);
+        if (first > last)
+        {
+            std::swap(first, last);
+        }
+        hashTable.stripes[first].mutex.lock();
+        if (last != first)
+        {
+            hashTable.stripes[last].mutex.lock();
+        }
+        // rehash() holds all stripes while it replaces the table
+        if (hashTable.sequence.load(std::memory_order_acquire) == sequence)
+        {
+            window = &table[index];
+            return;
+        }
+        unlock();
+    }
+}
+
+template<typename Object, typename Key, typename Mutex, typename Allocator, typename Hash, typename Comparator, size_t Stripes, typename StatisticsPolicy>
+enum HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::InsertResult
+HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::insert(const Key &key, const Object &object,
+        TableEntry *window, bool updateCount)
+{
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
+    local.add(&Statistics::insertTotal);
+    TableEntry *freeEntry = nullptr;
+    int freeCollisions = 0;
+    for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
+    {
+        TableEntry *tableEntry = &window[collisions];
+        if (*tableEntry == this->illegalValue)
+        {
+            if (freeEntry == nullptr)
+            {
+                freeEntry = tableEntry;
+                freeCollisions = collisions;
+            }
+        }
+        else if (Comparator::equal(*tableEntry, key))
+        {
+            local.add(&Statistics::insertDuplicate);
+            return INSERT_DUPLICATE;
+        }
+    }
+
+    if (freeEntry == nullptr)
+    {
+        local.add(&Statistics::insertHashMaxCollision);
+        return INSERT_COLLISION;
+    }
+
+    *freeEntry = object;
+    if (freeCollisions > 0)
+    {
+        local.add(&Statistics::insertHashCollision, freeCollisions);
+        __sync_fetch_and_add(&this->collisionsInTheTable, freeCollisions);
+    }
+    if (updateCount)
+    {
+        __sync_fetch_and_add(&this->count, 1);
+    }
+    local.add(&Statistics::insertOk);
+    return INSERT_DONE;
+}
+
+template<typename Object, typename Key, typename Mutex, typename Allocator, typename Hash, typename Comparator, size_t Stripes, typename StatisticsPolicy>
+enum HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::InsertResult
+HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::insert(const Key &key, const Object &object)
+{
+    StripeGuard guard(*this, key);
+    return insert(key, object, guard.getWindow(), true);
+}
+
+template<typename Object, typename Key, typename Mutex, typename Allocator, typename Hash, typename Comparator, size_t Stripes, typename StatisticsPolicy>
+enum HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::InsertResult
+HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::insert(const Key &key, const Object &object,
+        uint_fast32_t maxSize)
+{
+    InsertResult insertResult = insert(key, object);
+    uint_fast32_t size = getSize();
+    uint_fast32_t newSize = size;
+    while ((insertResult == INSERT_COLLISION) && (newSize < maxSize))
+    {
+        // If an object does not fit the new table try a larger one
+        newSize = (newSize * (100 + this->resizeFactor)) / 100 + 1;
+        if (newSize > maxSize)
+        {
+            newSize = maxSize;
+        }
+        InsertResult rehashResult = rehash(size, newSize);
+        if (rehashResult == INSERT_FAILED)
+        {
+            insertResult = INSERT_FAILED;
+            break;
+        }
+        if (getSize() != size)
+        {
+            // The table changed, this thread or another one grew it
+            insertResult = insert(key, object);
+            size = getSize();
+            newSize = size;
+        }
+    }
+    return insertResult;
+}
+
+template<typename Object, typename Key, typename Mutex, typename Allocator, typename Hash, typename Comparator, size_t Stripes, typename StatisticsPolicy>
+bool HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::remove(const Key &key)
+{
+    StripeGuard guard(*this, key);
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
+    local.add(&Statistics::removeTotal);
+    TableEntry *tableEntry = guard.getWindow();
+    for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
+    {
+        if (*tableEntry != this->illegalValue)
+        {
+            if (Comparator::equal(*tableEntry, key))
+            {
+                local.add(&Statistics::removeOk);
+                *tableEntry = this->illegalValue;
+                __sync_fetch_and_sub(&this->count, 1);
+                if (collisions > 0)
+                {
+                    __sync_fetch_and_sub(&this->collisionsInTheTable, collisions);
+                }
+                return true;
+            }
+            local.add(&Statistics::removeCollision);
+        }
+        tableEntry++;                   // I can do this - table contains (size+MAX_COLLISIONS) entries
+    }
+    local.add(&Statistics::removeFailed);
+    return false;
+}
+
+template<typename Object, typename Key, typename Mutex, typename Allocator, typename Hash, typename Comparator, size_t Stripes, typename StatisticsPolicy>
+bool HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::search(const Key &key, Object *object)
+{
+    StripeGuard guard(*this, key);
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
+    local.add(&Statistics::searchTotal);
+    TableEntry *tableEntry = guard.getWindow();
+    for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++)
+    {
+        if ((*tableEntry != this->illegalValue) && Comparator::equal(*tableEntry, key))
+        {
+            local.add(&Statistics::searchOk);
+            *object = *tableEntry;
+            return true;
+        }
+        tableEntry++;
+    }
+    local.add(&Statistics::searchFailed);
+    return false;
+}
+
+template<typename Object, typename Key, typename Mutex, typename Allocator, typename Hash, typename Comparator, size_t Stripes, typename StatisticsPolicy>
+void HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::removeAll()
+{
+    lockAll();
+    uint_fast32_t bytes = getAllocatedSize(getSize()) * sizeof(TableEntry);
+    memset(table.load(std::memory_order_relaxed), 0, bytes);
+    this->count = 0;
+    this->collisionsInTheTable = 0;
+    unlockAll();
+}
+
+template<typename Object, typename Key, typename Mutex, typename Allocator, typename Hash, typename Comparator, size_t Stripes, typename StatisticsPolicy>
+enum HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::InsertResult
+HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::rehash(uint_fast32_t expectedSize, uint_fast32_t size)
+{
+    lockAll();
+    counters.add(statistics, &Statistics::rehashTotal);
+    if ((expectedSize != 0) && (expectedSize != getSize()))
+    {
+        // Another thread grew the table
+        unlockAll();
+        return INSERT_DONE;
+    }
+    Table newTable = allocateTable(size);
+    if (newTable == nullptr)
+    {
+        counters.add(statistics, &Statistics::rehashFailed);
+        unlockAll();
+        return INSERT_FAILED;
+    }
+
+    Table oldTable = table.load(std::memory_order_relaxed);
+    uint_fast32_t oldSize = getSize();
+    uint_fast32_t collisions = this->collisionsInTheTable;
+    this->collisionsInTheTable = 0;
+    InsertResult result = INSERT_DONE;
+    for (uint_fast32_t i = 0;i < getAllocatedSize(oldSize);i++)
+    {
+        const TableEntry &tableEntry = oldTable[i];
+        if (tableEntry != this->illegalValue)
+        {
+            const Key &key = Hash::getKey(tableEntry);
+            if (insert(key, tableEntry, &newTable[getIndex(key, size)], false) != INSERT_DONE)
+            {
+                result = INSERT_COLLISION;
+                break;
+            }
+            counters.add(statistics, &Statistics::rehashDone);
+        }
+    }
+
+    if (result == INSERT_DONE)
+    {
+        table.store(newTable, std::memory_order_relaxed);
+        tableSize.store(size, std::memory_order_relaxed);
+        this->size = size;
+        sequence.fetch_add(1, std::memory_order_release);
+        freeTable(oldTable);
+    }
+    else
+    {
+        counters.add(statistics, &Statistics::rehashCollision);
+        this->collisionsInTheTable = collisions;
+        freeTable(newTable);
+    }
+    unlockAll();
+    return result;
+}
+
+template<typename Object, typename Key, typename Mutex, typename Allocator, typename Hash, typename Comparator, size_t Stripes, typename StatisticsPolicy>
+enum HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::GetNextResult
+HashTableStriped<Object, Key, Mutex, Allocator, Hash, Comparator, Stripes, StatisticsPolicy>::getNext(uint_fast32_t &index, Object *object) const
+{
+    const Table table = this->table.load(std::memory_order_acquire);
+    for (uint_fast32_t i = index;i < getAllocatedSize(getSize());i++)
+    {
+        if (table[i] != this->illegalValue)
+        {
+            *object = table[i];
+            index = i;
+            return GETNEXT_OK;
+        }
+    }
+    return GETNEXT_END_TABLE;
+}
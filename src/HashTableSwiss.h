@@ -0,0 +1,512 @@
+/**
+ * Open addressing hash table with control bytes, same API as HashTable
+ *
+ * HashTable compares the stored objects one by one. Every compare dereferences the
+ * object - a cache miss for every collision. This table keeps an array of control
+ * bytes, one byte for every slot. A control byte is EMPTY, DELETED or 7 bits of the
+ * hash of the stored object. The slots are split into groups of 16. A search loads
+ * the 16 control bytes of the group and compares them with the hash fragment in one
+ * SSE2 instruction (pcmpeqb + pmovmskb). Only the slots with matching fragment
+ * are compared with the key, a false match happens in 1 of 128 slots.
+ *
+ * The groups are probed in the quadratic order. The table is a power of 2 number of groups
+ * and keeps at least 1/8 of the slots free - a search always finds an empty slot and stops.
+ *
+ * Without SSE2 the group is matched with 64 bits arithmetic, 8 bytes at a time.
+ *
+ * Object, Key, Lock, Allocator, Hash and Comparator are the same as in HashTable
+ *
+ * Example of usage:
+ *
+ *   typedef HashTableSwiss<struct MyHashObject*, const char*, LockDummy,
+ *                      AllocatorTrivial, struct MyHashObject,
+ *                      struct MyHashObject> MyHashTable;
+ *   MyHashTable *hashTable = MyHashTable::create("myHashTable", 1024);
+ *   hashTable->insert(o1.getKey(&o1), &o1);
+ */
+
+#pragma once
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "HashTable.h"
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+class HashTableSwiss: public HashTableBase
+{
+public:
+
+    enum InsertResult
+    {
+        INSERT_DONE,
+        INSERT_COLLISION,
+        INSERT_DUPLICATE,
+        INSERT_FAILED
+    };
+
+    /**
+     * Add a new entry to the hash table. The function fails if the table is full,
+     * see also insert() with maxSize. Removed entries occupy space until the next
+     * call to rehash()
+     */
+    enum InsertResult insert(const Key &key, const Object &object)
+    {
+        Lock lock;
+        return insertNoLock(key, object);
+    }
+
+    /**
+     * Insert with automatic call to rehash if the table is full. See setResizeFactor()
+     * If the live entries take less than 25/32 of the slots and the insert failed because
+     * of the removed entries the table is rehashed at the same size first - a table with
+     * churn does not grow
+     *
+     * @param maxSize - maximum size for the table
+     */
+    enum InsertResult insert(const Key &key, const Object &object, uint_fast32_t maxSize);
+
+    bool remove(const Key &key);
+
+    void removeAll();
+
+    /**
+     * @param skipKeyCompare - the first slot with matching hash fragment is a hit. Works only
+     * if the hash function has no collisions for the stored keys
+     */
+    bool search(const Key &key, Object *object, bool skipKeyCompare=false);
+
+    /**
+     * Allocate a new table for 'size' objects and move the objects
+     */
+    enum InsertResult rehash(const uint_fast32_t size);
+
+    enum GetNextResult
+    {
+        GETNEXT_FAILED,
+        GETNEXT_OK,
+        GETNEXT_END_TABLE
+    };
+
+    /**
+     * @param index - use zero to get the first stored object
+     */
+    enum GetNextResult getNext(uint_fast32_t &index, Object *object) const;
+
+    /**
+     * @param size - initial number of objects the table can store
+     */
+    static HashTableSwiss *create(const char *name, uint_fast32_t size)
+    {
+        uint_fast32_t capacity = getCapacity(size);
+        Table table = allocateTable(capacity);
+        if (table.control == nullptr)
+        {
+            return nullptr;
+        }
+        void *hashTableMemory = Allocator::alloc(sizeof(HashTableSwiss));
+        if (hashTableMemory == nullptr)
+        {
+            freeTable(table);
+            return nullptr;
+        }
+        HashTableSwiss *hashTable = new (hashTableMemory) HashTableSwiss(name, table, capacity);
+        return hashTable;
+    }
+
+    static void destroy(HashTableSwiss *hashTable)
+    {
+        hashTable->~HashTableSwiss();
+        freeTable(hashTable->table);
+        Allocator::free((void *)hashTable);
+    }
+
+protected:
+
+    static const int GROUP_SIZE = 16;
+    static const uint8_t CONTROL_EMPTY = 0x80;
+    static const uint8_t CONTROL_DELETED = 0xFE;
+
+    struct Table
+    {
+        uint8_t *control;
+        Object *slots;
+    };
+
+    /**
+     * Bit i is set if the control byte i in the group matches
+     */
+    typedef uint32_t GroupMask;
+
+    HashTableSwiss(const char *name, Table table, uint_fast32_t capacity) : HashTableBase(name)
+    {
+        static_assert(sizeof(Object) <= sizeof(uintptr_t), "HashTableSwiss is intended to work only with integral types or pointers");
+        this->table = table;
+        this->capacity = capacity;
+        this->size = getMaxCount(capacity);
+        this->collisionsInTheTable = 0;
+        this->deleted = 0;
+    }
+
+    ~HashTableSwiss()
+    {
+    }
+
+    /**
+     * Number of slots - power of 2 number of groups, 1/8 of slots is always free
+     */
+    static uint_fast32_t getCapacity(uint_fast32_t size)
+    {
+        uint_fast32_t capacity = GROUP_SIZE;
+        while (getMaxCount(capacity) < size)
+        {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    static uint_fast32_t getMaxCount(uint_fast32_t capacity)
+    {
+        return capacity - (capacity / 8);
+    }
+
+    static Table allocateTable(uint_fast32_t capacity)
+    {
+        Table table;
+        table.control = (uint8_t*)Allocator::alloc(capacity + capacity * sizeof(Object));
+        table.slots = nullptr;
+        if (table.control != nullptr)
+        {
+            memset(table.control, CONTROL_EMPTY, capacity);
+            table.slots = reinterpret_cast<Object*>(table.control + capacity);
+        }
+        return table;
+    }
+
+    static void freeTable(Table table)
+    {
+        Allocator::free((void*)table.control);
+    }
+
+    /**
+     * 7 bits of the hash in the control byte, the rest selects the group
+     */
+    static inline uint8_t getFragment(uint_fast32_t hash)
+    {
+        return (hash & 0x7F);
+    }
+
+    static inline uint_fast32_t getGroup(uint_fast32_t hash, uint_fast32_t groups)
+    {
+        return ((hash >> 7) & (groups - 1));
+    }
+
+    static inline GroupMask match(const uint8_t *control, uint8_t value);
+
+    static inline GroupMask matchEmpty(const uint8_t *control)
+    {
+        return match(control, CONTROL_EMPTY);
+    }
+
+    /**
+     * Empty or deleted slots - the high bit is set
+     */
+    static inline GroupMask matchFree(const uint8_t *control);
+
+    /**
+     * Find the slot of the key, returns -1 if the key is not in the table
+     */
+    inline int_fast32_t find(const Key &key, uint_fast32_t hash, bool skipKeyCompare);
+
+    enum InsertResult insertNoLock(const Key &key, const Object &object);
+
+    Table table;
+    uint_fast32_t capacity;
+    uint_fast32_t deleted;
+};
+
+#if defined(__SSE2__)
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+inline typename HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::GroupMask
+HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::match(const uint8_t *control, uint8_t value)
+{
+    __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(control));
+    __m128i cmp = _mm_cmpeq_epi8(group, _mm_set1_epi8((char)value));
+    return (GroupMask)_mm_movemask_epi8(cmp);
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+inline typename HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::GroupMask
+HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::matchFree(const uint8_t *control)
+{
+    __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(control));
+    return (GroupMask)_mm_movemask_epi8(group);
+}
+#else
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+inline typename HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::GroupMask
+HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::match(const uint8_t *control, uint8_t value)
+{
+    const uint64_t lsb = 0x0101010101010101ULL;
+    const uint64_t msb = 0x8080808080808080ULL;
+    GroupMask mask = 0;
+    for (int half = 0;half < 2;half++)
+    {
+        uint64_t word;
+        memcpy(&word, control + half * 8, sizeof(word));
+        // A zero byte in x is a match, exact test for every byte
+        uint64_t x = word ^ (lsb * value);
+        uint64_t zero = ~(((x & ~msb) + ~msb) | x | ~msb);
+        for (int i = 0;i < 8;i++)
+        {
+            mask |= (GroupMask)((zero >> (i * 8 + 7)) & 1) << (half * 8 + i);
+        }
+    }
+    return mask;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+inline typename HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::GroupMask
+HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::matchFree(const uint8_t *control)
+{
+    GroupMask mask = 0;
+    for (int i = 0;i < GROUP_SIZE;i++)
+    {
+        mask |= (GroupMask)(control[i] >> 7) << i;
+    }
+    return mask;
+}
+#endif
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+inline int_fast32_t HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::find(const Key &key, uint_fast32_t hash, bool skipKeyCompare)
+{
+    uint_fast32_t groups = capacity / GROUP_SIZE;
+    uint_fast32_t group = getGroup(hash, groups);
+    uint8_t fragment = getFragment(hash);
+    for (uint_fast32_t probe = 1;probe <= groups;probe++)
+    {
+        const uint8_t *control = &table.control[group * GROUP_SIZE];
+        GroupMask mask = match(control, fragment);
+        while (mask != 0)
+        {
+            int_fast32_t slot = group * GROUP_SIZE + __builtin_ctz(mask);
+            if (skipKeyCompare)
+            {
+                statistics.searchSkipCompare++;
+                return slot;
+            }
+            if (Comparator::equal(table.slots[slot], key))
+            {
+                return slot;
+            }
+            mask &= (mask - 1);
+        }
+        if (matchEmpty(control) != 0)
+        {
+            break;
+        }
+        // Quadratic (triangular) probing visits all groups
+        group = (group + probe) & (groups - 1);
+    }
+    return -1;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
+HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::insertNoLock(const Key &key, const Object &object)
+{
+    statistics.insertTotal++;
+    uint_fast32_t hash = Hash::hash(key);
+    if (find(key, hash, false) >= 0)
+    {
+        statistics.insertDuplicate++;
+        return INSERT_DUPLICATE;
+    }
+    // Deleted slots are reused, but keep one empty slot in every probe sequence
+    if ((this->count + this->deleted) >= getMaxCount(capacity))
+    {
+        statistics.insertFailed++;
+        return INSERT_FAILED;
+    }
+
+    uint_fast32_t groups = capacity / GROUP_SIZE;
+    uint_fast32_t group = getGroup(hash, groups);
+    for (uint_fast32_t probe = 1;probe <= groups;probe++)
+    {
+        uint8_t *control = &table.control[group * GROUP_SIZE];
+        GroupMask mask = matchFree(control);
+        if (mask != 0)
+        {
+            uint_fast32_t slot = group * GROUP_SIZE + __builtin_ctz(mask);
+            if (table.control[slot] == CONTROL_DELETED)
+            {
+                this->deleted--;
+            }
+            if (probe > 1)
+            {
+                this->collisionsInTheTable++;
+            }
+            table.control[slot] = getFragment(hash);
+            table.slots[slot] = object;
+            this->count++;
+            statistics.insertOk++;
+            return INSERT_DONE;
+        }
+        statistics.insertMaxSearch++;
+        group = (group + probe) & (groups - 1);
+    }
+    statistics.insertFailed++;
+    return INSERT_FAILED;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
+HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::insert(const Key &key, const Object &object,
+        uint_fast32_t maxSize)
+{
+    InsertResult insertResult = insert(key, object);
+    if ((insertResult == INSERT_FAILED) && (this->deleted > 0) && ((this->count * 32) <= (this->capacity * 25)))
+    {
+        if (rehash(getSize()) == INSERT_DONE)
+        {
+            insertResult = insert(key, object);
+        }
+    }
+    while ((insertResult == INSERT_FAILED) && (getSize() < maxSize))
+    {
+        uint_fast32_t newSize = (getSize() * (100 + this->resizeFactor)) / 100;
+        if (newSize <= getSize())
+        {
+            newSize = getSize() + 1;
+        }
+        if (newSize > maxSize)
+        {
+            newSize = maxSize;
+        }
+        if (rehash(newSize) != INSERT_DONE)
+        {
+            break;
+        }
+        insertResult = insert(key, object);
+    }
+    return insertResult;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+bool HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::remove(const Key &key)
+{
+    Lock lock;
+    statistics.removeTotal++;
+    uint_fast32_t hash = Hash::hash(key);
+    int_fast32_t slot = find(key, hash, false);
+    if (slot < 0)
+    {
+        statistics.removeFailed++;
+        return false;
+    }
+    // If the group has an empty slot no probe sequence continues past this group
+    const uint8_t *control = &table.control[(slot / GROUP_SIZE) * GROUP_SIZE];
+    if (matchEmpty(control) != 0)
+    {
+        table.control[slot] = CONTROL_EMPTY;
+    }
+    else
+    {
+        table.control[slot] = CONTROL_DELETED;
+        this->deleted++;
+    }
+    this->count--;
+    statistics.removeOk++;
+    return true;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+void HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::removeAll()
+{
+    Lock lock;
+    memset(table.control, CONTROL_EMPTY, capacity);
+    this->count = 0;
+    this->deleted = 0;
+    this->collisionsInTheTable = 0;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+bool HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::search(const Key &key, Object *object, bool skipKeyCompare)
+{
+    Lock lock;
+    statistics.searchTotal++;
+    uint_fast32_t hash = Hash::hash(key);
+    int_fast32_t slot = find(key, hash, skipKeyCompare);
+    if (slot < 0)
+    {
+        statistics.searchFailed++;
+        return false;
+    }
+    *object = table.slots[slot];
+    statistics.searchOk++;
+    return true;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::GetNextResult
+HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::getNext(uint_fast32_t &index, Object *object) const
+{
+    for (uint_fast32_t i = index;i < capacity;i++)
+    {
+        if ((table.control[i] & 0x80) == 0)
+        {
+            *object = table.slots[i];
+            index = i;
+            return GETNEXT_OK;
+        }
+    }
+    return GETNEXT_END_TABLE;
+}
+
+template<typename Object, typename Key, typename Lock, typename Allocator, typename Hash, typename Comparator>
+enum HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::InsertResult
+HashTableSwiss<Object, Key, Lock, Allocator, Hash, Comparator>::rehash(const uint_fast32_t size)
+{
+    uint_fast32_t newCapacity = getCapacity(size);
+    Table newTable = allocateTable(newCapacity);
+
+    Lock lock;
+    statistics.rehashTotal++;
+    if (newTable.control == nullptr)
+    {
+        statistics.rehashFailed++;
+        return INSERT_FAILED;
+    }
+
+    Table oldTable = table;
+    uint_fast32_t oldCapacity = capacity;
+    table = newTable;
+    capacity = newCapacity;
+    this->size = getMaxCount(newCapacity);
+    this->count = 0;
+    this->deleted = 0;
+    this->collisionsInTheTable = 0;
+
+    enum InsertResult rehashResult = INSERT_DONE;
+    for (uint_fast32_t i = 0;i < oldCapacity;i++)
+    {
+        if ((oldTable.control[i] & 0x80) != 0)
+        {
+            continue;
+        }
+        const Object &object = oldTable.slots[i];
+        if (insertNoLock(Hash::getKey(object), object) != INSERT_DONE)
+        {
+            rehashResult = INSERT_FAILED;
+            statistics.rehashCollision++;
+        }
+        else
+        {
+            statistics.rehashDone++;
+        }
+    }
+    freeTable(oldTable);
+    return rehashResult;
+}
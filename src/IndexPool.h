@@ -0,0 +1,179 @@
+/**
+ * Pool of objects which returns 32 bits handles instead of pointers
+ * This is a generalization of fastpool.cpp. Free objects are linked in a list
+ * through the objects themselves, the link is an index in the array of objects.
+ * A handle is half of a pointer on a 64 bits machine - tables of handles
+ * are half the size of tables of pointers.
+ *
+ * If Generations is true every slot keeps a generation counter. The counter is
+ * a part of the handle and is incremented by allocate() and free(). A handle
+ * which survived free() of the object is detected by get() and free().
+ *
+ * Without Generations a double free links the object into the free list twice and
+ * two following allocations return the same object. Debug builds (NDEBUG is not
+ * defined) keep the counters anyway and free() of a free object fails.
+ *
+ * The free list is stored in the memory of the objects, T shall be trivially copyable.
+ *
+ * The pool keeps no pointers, the free list and the handles are indexes. A pool placed
+ * in a MemoryRegionFile is reattached after restart of the process as is.
+ *
+ * The code is not thread safe.
+ *
+ * Example of usage:
+ *
+ *   static IndexPool<MyObject, 128, true> myPool;
+ *   IndexPool<MyObject, 128, true>::Handle handle;
+ *   if (myPool.allocate(&handle)) {
+ *       MyObject *o = myPool.get(handle);
+ *       myPool.free(handle);
+ *   }
+ */
+
+#pragma once
+
+#include <type_traits>
+
+#ifdef NDEBUG
+#define INDEX_POOL_CHECK_FREE false
+#else
+#define INDEX_POOL_CHECK_FREE true
+#endif
+
+template<typename T, size_t N, bool Generations = false> class IndexPool {
+public:
+
+    typedef uint32_t Handle;
+
+    static const Handle ILLEGAL_HANDLE = (Handle)(~0);
+
+    IndexPool() :
+        head(END), carved(0), count(0) {
+        static_assert(sizeof(T) >= sizeof(uint32_t), "IndexPool stores the free list in the objects, object is too small");
+        static_assert(INDEX_BITS < 32, "IndexPool is too large for 32 bits handles");
+        static_assert(std::is_trivially_copyable<T>::value, "IndexPool stores the free list in the objects, object shall be trivially copyable");
+        memset(generations, 0, sizeof(generations));
+    }
+
+    inline bool allocate(Handle* handle);
+
+    inline bool free(Handle handle);
+
+    /**
+     * Returns nullptr if the handle is illegal or (if Generations is set) stale
+     */
+    inline T* get(Handle handle);
+
+    inline const T* get(Handle handle) const {
+        return const_cast<IndexPool*>(this)->get(handle);
+    }
+
+    /**
+     * Number of allocated objects
+     */
+    size_t getCount() const {
+        return count;
+    }
+
+protected:
+
+    /**
+     * Number of bits I need for index 0..N. Index N is never a legal index, and
+     * a handle with all bits set is never a legal handle
+     */
+    static constexpr int indexBits(size_t n, int bits = 0) {
+        return (((size_t)1 << bits) > n) ? bits : indexBits(n, bits+1);
+    }
+
+    static const int INDEX_BITS = indexBits(N);
+    static const uint32_t INDEX_MASK = (uint32_t)(((uint64_t)1 << INDEX_BITS) - 1);
+    static const uint32_t GENERATION_MASK = (uint32_t)((((uint64_t)1 << 32) - 1) >> INDEX_BITS);
+    static const uint32_t END = N;
+    /**
+     * Keep the generation counters - the handles carry the generation only if Generations is set
+     */
+    static const bool TRACK_GENERATIONS = Generations || INDEX_POOL_CHECK_FREE;
+
+    inline uint32_t getNext(uint32_t index) const {
+        uint32_t next;
+        memcpy(&next, &objects[index], sizeof(next));
+        return next;
+    }
+
+    inline void setNext(uint32_t index, uint32_t next) {
+        memcpy(&objects[index], &next, sizeof(next));
+    }
+
+    /**
+     * Odd generation is an allocated object, even generation is a free object
+     */
+    inline bool isValid(Handle handle, uint32_t index) const {
+        if ((index >= N) || (index >= carved))
+            return false;
+        if (!TRACK_GENERATIONS)
+            return true;
+        uint32_t generation = generations[index];
+        bool res = ((generation & 1) != 0);
+        if (Generations)
+            res = res && ((handle >> INDEX_BITS) == (generation & GENERATION_MASK));
+        return res;
+    }
+
+    T objects[N];
+    uint32_t generations[TRACK_GENERATIONS ? N : 1];
+    uint32_t head;
+    /**
+     * High-water mark in the objects[], see MemoryPoolRaw::carved
+     */
+    uint32_t carved;
+    size_t count;
+};
+
+template<typename T, size_t N, bool Generations>
+inline bool IndexPool<T, N, Generations>::allocate(Handle* handle) {
+    uint32_t index;
+    if (head != END) {
+        index = head;
+        head = getNext(index);
+    }
+    else if (carved < N) {
+        index = carved;
+        carved++;
+    }
+    else {
+        return false;
+    }
+
+    Handle res = index;
+    if (TRACK_GENERATIONS) {
+        generations[index]++;
+    }
+    if (Generations) {
+        res |= (generations[index] & GENERATION_MASK) << INDEX_BITS;
+    }
+    count++;
+    *handle = res;
+    return true;
+}
+
+template<typename T, size_t N, bool Generations>
+inline bool IndexPool<T, N, Generations>::free(Handle handle) {
+    uint32_t index = handle & INDEX_MASK;
+    if (!isValid(handle, index))
+        return false;
+    if (TRACK_GENERATIONS) {
+        generations[index]++;
+    }
+    setNext(index, head);
+    head = index;
+    count--;
+    return true;
+}
+
+template<typename T, size_t N, bool Generations>
+inline T* IndexPool<T, N, Generations>::get(Handle handle) {
+    uint32_t index = handle & INDEX_MASK;
+    if (!isValid(handle, index))
+        return nullptr;
+    return &objects[index];
+}
@@ -0,0 +1,409 @@
+/**
+ * Lockfree hashtable where any thread can insert, update and remove any key
+ *
+ * LockfreeHashTable sets the key with compare-and-set and writes the data with a plain
+ * store. A reader can see the key before the data and two writers of the same key
+ * overwrite each other. This table keeps the key and the data in one word and updates
+ * both with one compare-and-set:
+ * - key and data fit 64 bits (two uint32_t for example) - cmpxchg of a 64 bits word
+ * - key and data fit 128 bits - cmpxchg16b, requires -mcx16 on x86_64 (the Makefile
+ *   adds it). The 128 bits word is loaded with cmpxchg16b as well
+ *
+ * remove() replaces the data with IllegalData, the key stays in the slot. insert() of
+ * the same key reuses the slot, insert() of another key reuses the first dead slot in
+ * the window if the key is not in the window. Two threads inserting the same key can
+ * take two different slots. After the compare-and-set the thread scans the window: the
+ * slot closest to the start of the window wins, the thread in a farther slot marks its
+ * slot dead and updates the winner, the winner marks the farther slots dead. search()
+ * and remove() use the first slot with the key.
+ * The probing window is MAX_COLLISIONS slots, insert() fails if the window does not have
+ * the key, an empty or a dead slot. IllegalKey can not be inserted, IllegalData can not be
+ * inserted either - the slot would be dead.
+ *
+ * The default statistics policy is sharded - the count is exact when many threads
+ * insert and remove.
+ *
+ * Example of usage:
+ *
+ *   typedef LockfreeHashTableMultiWriter<uint32_t, (uint32_t)-1, uint32_t, (uint32_t)-1,
+ *       AllocatorTrivial, HashPolicy<uint32_t> > MyHashTable;
+ *   MyHashTable *hashTable = MyHashTable::create("myHashTable", 16);
+ *   hashTable->insert(key, value);      // any thread
+ *   hashTable->remove(key, &value);     // any thread
+ */
+
+#pragma once
+
+#include <type_traits>
+
+#include "HashTable.h"
+
+/**
+ * The smallest word which keeps the key and the data
+ */
+template<size_t Bytes, bool Fits64 = (Bytes <= sizeof(uint64_t))> struct LockfreeHashTablePair
+{
+    typedef uint64_t Word;
+};
+
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+template<size_t Bytes> struct LockfreeHashTablePair<Bytes, false>
+{
+    typedef unsigned __int128 Word;
+};
+#endif
+
+template<LockfreeHashTableTemplateTypes, typename StatisticsPolicy = HashTableStatisticsSharded<> >
+class LockfreeHashTableMultiWriter: public HashTableBase
+{
+public:
+    enum InsertResult
+    {
+        INSERT_DONE,
+        INSERT_COLLISION,
+        INSERT_DUPLICATE,
+        INSERT_FAILED
+    };
+
+    static LockfreeHashTableMultiWriter* create(const char *name, int sizeBits)
+    {
+        size_t sizeEntries = ((size_t)1 << sizeBits);
+        TableEntry *table = (TableEntry*)Allocator::alloc(sizeof(TableEntry) * (sizeEntries + MAX_COLLISIONS));
+        if (table == nullptr)
+        {
+            return nullptr;
+        }
+        // cmpxchg requires aligned words
+        if (((uintptr_t)table % sizeof(TableEntry)) != 0)
+        {
+            Allocator::free((void *)table);
+            return nullptr;
+        }
+        for (size_t i = 0;i < sizeEntries+MAX_COLLISIONS;i++)
+        {
+            table[i].word = pack(IllegalKey, IllegalData);
+        }
+        void *hashTableMemory = Allocator::alloc(sizeof(LockfreeHashTableMultiWriter));
+        if (hashTableMemory == nullptr)
+        {
+            Allocator::free((void *)table);
+            return nullptr;
+        }
+        return new (hashTableMemory) LockfreeHashTableMultiWriter(name, sizeEntries, table);
+    }
+
+    static void destroy(LockfreeHashTableMultiWriter *hashTable)
+    {
+        TableEntry *table = hashTable->table;
+        hashTable->~LockfreeHashTableMultiWriter();
+        Allocator::free((void *)table);
+        Allocator::free((void *)hashTable);
+    }
+
+    /**
+     * Insert a new key or update the data of an existing key. Returns INSERT_DUPLICATE
+     * if the key was in the table, INSERT_FAILED if the probing window is full
+     */
+    InsertResult insert(Key key, const Object &o);
+
+    bool remove(Key key, Object *o);
+
+    bool search(Key key, Object *o);
+
+    const struct Statistics *getStatistics()
+    {
+        counters.collect(statistics);
+        return &statistics;
+    }
+
+    uint_fast32_t getCount() const
+    {
+        return counters.getCount(this->count);
+    }
+
+protected:
+
+    static const int MAX_COLLISIONS = 8;
+
+    static_assert(std::is_integral<Key>::value && std::is_integral<Object>::value,
+        "LockfreeHashTableMultiWriter packs integral keys and data into one word");
+    static_assert((sizeof(Key) + sizeof(Object)) <= sizeof(typename LockfreeHashTablePair<sizeof(Key) + sizeof(Object)>::Word),
+        "Key and data do not fit 64 bits and 128 bits compare-and-set is not available (try -mcx16)");
+
+    typedef typename LockfreeHashTablePair<sizeof(Key) + sizeof(Object)>::Word Word;
+    typedef typename std::make_unsigned<Key>::type KeyBits;
+    typedef typename std::make_unsigned<Object>::type ObjectBits;
+
+    /**
+     * The key is in the low bits of the word
+     */
+    static const int DATA_SHIFT = (sizeof(Word) * 8) / 2;
+
+    struct alignas(sizeof(Word)) TableEntry
+    {
+        Word word;
+    };
+
+    static inline Word pack(Key key, Object data)
+    {
+        return (Word)(KeyBits)key | ((Word)(ObjectBits)data << DATA_SHIFT);
+    }
+
+    static inline Key getKey(Word word)
+    {
+        return (Key)(KeyBits)word;
+    }
+
+    static inline Object getData(Word word)
+    {
+        return (Object)(ObjectBits)(word >> DATA_SHIFT);
+    }
+
+    /**
+     * The key of a dead slot can change - the two halves of a 128 bits word are not
+     * loaded separately. cmpxchg16b with equal old and new words is an atomic load
+     */
+    static inline Word load(const TableEntry *entry)
+    {
+        if (sizeof(Word) == sizeof(uint64_t))
+        {
+            return __atomic_load_n(reinterpret_cast<const uint64_t*>(&entry->word), __ATOMIC_ACQUIRE);
+        }
+        return __sync_val_compare_and_swap(const_cast<Word*>(&entry->word), (Word)0, (Word)0);
+    }
+
+    static inline bool cmpxchg(TableEntry *entry, Word oldWord, Word newWord)
+    {
+        return __sync_bool_compare_and_swap(&entry->word, oldWord, newWord);
+    }
+
+    LockfreeHashTableMultiWriter(const char *name, size_t sizeEntries, TableEntry *table) :
+        HashTableBase(name), sizeEntries(sizeEntries), table(table)
+    {
+        this->size = sizeEntries;
+    }
+
+    ~LockfreeHashTableMultiWriter()
+    {
+    }
+
+    inline TableEntry *getWindow(Key key)
+    {
+        return &table[Hash::hash(key) & (sizeEntries - 1)];
+    }
+
+    static inline bool isFree(Word word)
+    {
+        return (getKey(word) == IllegalKey) || (getData(word) == IllegalData);
+    }
+
+    /**
+     * Mark a live slot with the key dead, returns true if the slot was live
+     */
+    static inline bool kill(TableEntry *entry, Key key)
+    {
+        for (;;)
+        {
+            Word word = load(entry);
+            if ((getKey(word) != key) || (getData(word) == IllegalData))
+            {
+                return false;
+            }
+            if (cmpxchg(entry, word, pack(key, IllegalData)))
+            {
+                return true;
+            }
+        }
+    }
+
+    /**
+     * The slot got the key, check the other slots in the window. Returns false if the
+     * key is in a slot closer to the start of the window
+     */
+    template<typename Local> bool resolve(TableEntry *window, TableEntry *slot, Key key, Local &local);
+
+    size_t sizeEntries;
+    TableEntry *table;
+    StatisticsPolicy counters;
+};
+
+/**
+ * Look for the key in the window and remember the first free slot. If the key is found
+ * update the data in the slot, otherwise take the free slot. If the compare-and-set fails
+ * another thread modified the slot - start again
+ */
+template<LockfreeHashTableTemplateTypes, typename StatisticsPolicy>
+enum LockfreeHashTableMultiWriter<LockfreeHashTableTemplateArgs, StatisticsPolicy>::InsertResult
+LockfreeHashTableMultiWriter<LockfreeHashTableTemplateArgs, StatisticsPolicy>::insert(Key key, const Object &o)
+{
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
+    local.add(&Statistics::insertTotal);
+    if ((key == IllegalKey) || (o == IllegalData))
+    {
+        local.add(&Statistics::insertFailed);
+        return INSERT_FAILED;
+    }
+    const Word newWord = pack(key, o);
+    TableEntry *window = getWindow(key);
+    for (;;)
+    {
+        TableEntry *entry = window;
+        TableEntry *freeEntry = nullptr;
+        Word word = 0, freeWord = 0;
+        for (;entry < &window[MAX_COLLISIONS];entry++)
+        {
+            word = load(entry);
+            Key entryKey = getKey(word);
+            if (entryKey == key)
+            {
+                break;
+            }
+            if ((freeEntry == nullptr) && isFree(word))
+            {
+                freeEntry = entry;
+                freeWord = word;
+            }
+            if (entryKey == IllegalKey)
+            {
+                entry = &window[MAX_COLLISIONS];    // the keys are never removed from the slots
+                break;
+            }
+            local.add(&Statistics::insertHashCollision);
+        }
+        if (entry < &window[MAX_COLLISIONS])
+        {
+            if (!cmpxchg(entry, word, newWord))
+            {
+                continue;
+            }
+            if (getData(word) != IllegalData)
+            {
+                local.add(&Statistics::insertDuplicate);
+                return INSERT_DUPLICATE;
+            }
+        }
+        else if (freeEntry == nullptr)
+        {
+            break;
+        }
+        else if (cmpxchg(freeEntry, freeWord, newWord))
+        {
+            entry = freeEntry;
+        }
+        else
+        {
+            continue;
+        }
+        local.addCount(1);
+        if (resolve(window, entry, key, local))
+        {
+            local.add(&Statistics::insertOk);
+            return INSERT_DONE;
+        }
+    }
+    local.add(&Statistics::insertFailed);
+    return INSERT_FAILED;
+}
+
+template<LockfreeHashTableTemplateTypes, typename StatisticsPolicy>
+template<typename Local>
+bool
+LockfreeHashTableMultiWriter<LockfreeHashTableTemplateArgs, StatisticsPolicy>::resolve(TableEntry *window, TableEntry *slot, Key key, Local &local)
+{
+    for (TableEntry *entry = window;entry < &window[MAX_COLLISIONS];entry++)
+    {
+        if ((entry == slot) || (getKey(load(entry)) != key))
+        {
+            continue;
+        }
+        if (entry < slot)
+        {
+            if (kill(slot, key))
+            {
+                local.addCount(-1);
+            }
+            return false;
+        }
+        if (kill(entry, key))
+        {
+            local.addCount(-1);
+        }
+    }
+    return true;
+}
+
+template<LockfreeHashTableTemplateTypes, typename StatisticsPolicy>
+bool
+LockfreeHashTableMultiWriter<LockfreeHashTableTemplateArgs, StatisticsPolicy>::remove(Key key, Object *o)
+{
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
+    local.add(&Statistics::removeTotal);
+    const Word removedWord = pack(key, IllegalData);
+    TableEntry *entry = getWindow(key);
+    for (int collisions = 0;collisions < MAX_COLLISIONS;)
+    {
+        Word word = load(entry);
+        Key entryKey = getKey(word);
+        if (entryKey == IllegalKey)
+        {
+            break;                      // the keys are never removed, the key is not in the window
+        }
+        if (entryKey != key)
+        {
+            entry++;
+            collisions++;
+            continue;
+        }
+        Object data = getData(word);
+        if (data == IllegalData)
+        {
+            break;
+        }
+        if (cmpxchg(entry, word, removedWord))
+        {
+            if (o)
+            {
+                *o = data;
+            }
+            local.addCount(-1);
+            local.add(&Statistics::removeOk);
+            return true;
+        }
+    }
+    local.add(&Statistics::removeFailed);
+    return false;
+}
+
+template<LockfreeHashTableTemplateTypes, typename StatisticsPolicy>
+bool
+LockfreeHashTableMultiWriter<LockfreeHashTableTemplateArgs, StatisticsPolicy>::search(Key key, Object *o)
+{
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
+    local.add(&Statistics::searchTotal);
+    const TableEntry *entry = getWindow(key);
+    for (int collisions = 0;collisions < MAX_COLLISIONS;collisions++, entry++)
+    {
+        Word word = load(entry);
+        Key entryKey = getKey(word);
+        if (entryKey == IllegalKey)
+        {
+            break;
+        }
+        if (entryKey == key)
+        {
+            Object data = getData(word);
+            if (data == IllegalData)
+            {
+                break;
+            }
+            if (o)
+            {
+                *o = data;
+            }
+            local.add(&Statistics::searchOk);
+            return true;
+        }
+    }
+    local.add(&Statistics::searchFailed);
+    return false;
+}
@@ -0,0 +1,651 @@
+/**
+ * Lockfree hashtable which grows online
+ *
+ * LockfreeHashTable is allocated once and an insert fails when the probing window
+ * is full. The application sizes the table for the worst case. This table starts small
+ * and doubles the size when half of the slots are taken. The migration to the new table
+ * is cooperative - every insert, remove and search moves a chunk of slots. There
+ * is no stop-the-world phase and no lock.
+ *
+ * The table is linear probing with wrap around and unlimited probe length. A key
+ * occupies the slot until the migration, remove() only clears the data. Removed keys
+ * are dropped when the slots are moved to the next table. If most of the keys in the
+ * table are removed (or the table reached the maximum size) the next table has the
+ * same size - the migration reclaims the slots of the removed keys.
+ *
+ * A slot in the old table is moved in two steps: the data is copied to the new table,
+ * the data in the old table is replaced by MovedData with compare-and-set. If a writer
+ * modified the slot in the meantime the copy is repeated. An operation which finds
+ * MovedData repeats in the new table. IllegalData and MovedData are reserved values
+ * and can not be stored in the table. A chunk of slots which could not be moved (the
+ * next table is full) is released and is retried by the next pass over the chunks.
+ *
+ * All operations run inside of an EpochReclamation critical section. The old table is
+ * returned to the Allocator when all threads which could read the table are done.
+ *
+ * The statistics and the count follow StatisticsPolicy, sharded by default. startResize()
+ * compares the count with the occupied slots, the count shall be exact when many threads
+ * insert and remove - HashTableStatisticsNone is not supported.
+ *
+ * Limitation: same as LockfreeHashTable - a specific key is inserted and removed by one
+ * thread. The number of living threads which access the table is limited by the
+ * EpochReclamation, in other threads all operations fail.
+ *
+ * Example of usage:
+ *
+ *   typedef LockfreeHashTableResizable<uint32_t, (uint32_t)-1, uint32_t, (uint32_t)-1,
+ *       AllocatorTrivial, HashTrivial, (uint32_t)-2> MyHashTable;
+ *   MyHashTable *hashTable = MyHashTable::create("myHashTable", 4, 20);
+ *   hashTable->insert(key, value);
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <type_traits>
+
+#include "HashTable.h"
+#include "EpochReclamation.h"
+
+#define LockfreeHashTableResizableTemplateTypes LockfreeHashTableTemplateTypes, Object MovedData
+#define LockfreeHashTableResizableTemplateArgs LockfreeHashTableTemplateArgs, MovedData
+
+template<LockfreeHashTableResizableTemplateTypes, typename StatisticsPolicy = HashTableStatisticsSharded<> >
+class LockfreeHashTableResizable: public HashTableBase
+{
+public:
+    enum InsertResult
+    {
+        INSERT_DONE,
+        INSERT_COLLISION,
+        INSERT_DUPLICATE,
+        INSERT_FAILED
+    };
+
+    /**
+     * @param sizeBits - initial size of the table
+     * @param maxSizeBits - the table does not grow above (1 << maxSizeBits) entries
+     */
+    static LockfreeHashTableResizable* create(const char *name, int sizeBits, int maxSizeBits)
+    {
+        Table *table = allocateTable(sizeBits);
+        if (table == nullptr)
+        {
+            return nullptr;
+        }
+        void *hashTableMemory = Allocator::alloc(sizeof(LockfreeHashTableResizable));
+        if (hashTableMemory == nullptr)
+        {
+            freeTable(table);
+            return nullptr;
+        }
+        LockfreeHashTableResizable *hashTable = new (hashTableMemory) LockfreeHashTableResizable(name, maxSizeBits, table);
+        return hashTable;
+    }
+
+    static void destroy(LockfreeHashTableResizable *hashTable)
+    {
+        hashTable->~LockfreeHashTableResizable();
+        Allocator::free((void *)hashTable);
+    }
+
+    InsertResult insert(Key key, const Object &o);
+    bool remove(Key key, Object *o);
+    bool search(Key key, Object *o);
+
+    const struct Statistics *getStatistics()
+    {
+        counters.collect(statistics);
+        return &statistics;
+    }
+
+    uint_fast32_t getCount() const
+    {
+        return counters.getCount(this->count);
+    }
+
+    /**
+     * True if the migration to the next table is in progress
+     */
+    bool isResizing() const
+    {
+        Table *table = current.load(std::memory_order_acquire);
+        return (table->next.load(std::memory_order_acquire) != nullptr);
+    }
+
+protected:
+
+    /**
+     * Every operation migrates up to CHUNK_SIZE slots of the old table
+     */
+    static const size_t CHUNK_SIZE = 256;
+
+    /**
+     * Start resize if the probing takes too long
+     */
+    static const size_t MAX_PROBES = 32;
+
+    /**
+     * An insert which finds no room in the next table yields and retries
+     */
+    static const int MAX_MIGRATION_WAITS = 1024;
+
+    struct TableEntry
+    {
+        volatile Key key;
+        volatile Object data;
+    };
+
+    struct Table
+    {
+        size_t sizeBits;
+        size_t mask;
+        TableEntry *entries;
+        /**
+         * Number of slots with a key
+         */
+        std::atomic<size_t> slots;
+        /**
+         * Number of slots with a key moved to the next table
+         */
+        std::atomic<size_t> movedSlots;
+        /**
+         * Not nullptr if the migration is in progress
+         */
+        std::atomic<Table*> next;
+        /**
+         * Claims cycle over the chunks until all chunks are moved
+         */
+        std::atomic<size_t> nextChunk;
+        std::atomic<size_t> chunksDone;
+        /**
+         * A bit is set while a thread moves the chunk and stays set after the chunk is moved
+         */
+        std::atomic<uint64_t> *chunksClaimed;
+        /**
+         * Tables which could not be retired, see promote()
+         */
+        Table *retired;
+
+        size_t getChunks() const
+        {
+            return getChunks(mask + 1);
+        }
+
+        static size_t getChunks(size_t entries)
+        {
+            size_t chunks = entries / CHUNK_SIZE;
+            return (chunks > 0) ? chunks : 1;
+        }
+    };
+
+    static const size_t CHUNK_BITS = 64;
+
+    /**
+     * EpochReclamation returns the old tables here
+     */
+    struct TableReclamationPool
+    {
+        void free(Table *table)
+        {
+            freeTable(table);
+        }
+    };
+
+    typedef EpochReclamation<Table, TableReclamationPool, 64, 4> TableReclamation;
+
+    LockfreeHashTableResizable(const char *name, int maxSizeBits, Table *table) :
+        HashTableBase(name), maxSizeBits(maxSizeBits), current(table), reclamation(tableReclamationPool)
+    {
+        static_assert(!std::is_same<StatisticsPolicy, HashTableStatisticsNone>::value,
+            "LockfreeHashTableResizable requires the count of the entries, see startResize()");
+        this->size = table->mask + 1;
+    }
+
+    ~LockfreeHashTableResizable()
+    {
+        Table *table = current.load();
+        Table *next = table->next.load();
+        if (next != nullptr)
+        {
+            freeTable(next);
+        }
+        freeTable(table);
+    }
+
+    /**
+     * The bitmap of the chunks follows the header, the entries follow the bitmap
+     */
+    static Table *allocateTable(size_t sizeBits)
+    {
+        size_t entries = ((size_t)1 << sizeBits);
+        size_t chunkWords = (Table::getChunks(entries) + CHUNK_BITS - 1) / CHUNK_BITS;
+        void *memory = Allocator::alloc(sizeof(Table) + chunkWords * sizeof(std::atomic<uint64_t>) + entries * sizeof(TableEntry));
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+        Table *table = new (memory) Table();
+        table->sizeBits = sizeBits;
+        table->mask = entries - 1;
+        table->chunksClaimed = reinterpret_cast<std::atomic<uint64_t>*>(table + 1);
+        for (size_t i = 0;i < chunkWords;i++)
+        {
+            new (&table->chunksClaimed[i]) std::atomic<uint64_t>(0);
+        }
+        table->entries = reinterpret_cast<TableEntry*>(table->chunksClaimed + chunkWords);
+        table->slots.store(0);
+        table->movedSlots.store(0);
+        table->next.store(nullptr);
+        table->nextChunk.store(0);
+        table->chunksDone.store(0);
+        table->retired = nullptr;
+        for (size_t i = 0;i < entries;i++)
+        {
+            table->entries[i].key = IllegalKey;
+            table->entries[i].data = IllegalData;
+        }
+        return table;
+    }
+
+    static void freeTable(Table *table)
+    {
+        while (table != nullptr)
+        {
+            Table *retired = table->retired;
+            table->~Table();
+            Allocator::free((void *)table);
+            table = retired;
+        }
+    }
+
+    /**
+     * Find the slot of the key. If 'claim' is true and the key is not in the table
+     * take an empty slot for the key, but keep 'reserved' empty slots
+     */
+    TableEntry *findSlot(Table *table, Key key, uint_fast32_t hash, bool claim, size_t reserved = 0);
+
+    /**
+     * Allocate the next table if the table is the current one. The next table is
+     * larger unless most of the keys are removed or the table is at the maximum size
+     */
+    void startResize(Table *table);
+
+    /**
+     * Move a chunk of slots to the next table, replace the current table if
+     * all chunks are moved. A chunk which failed is retried by the next pass
+     */
+    void helpMigrate(Table *table);
+
+    /**
+     * @param movedSlots - incremented if the slot had a key and was moved by this call
+     * @return false if the next table is full
+     */
+    bool migrateSlot(Table *next, TableEntry *entry, size_t &movedSlots);
+
+    /**
+     * Empty slots in the next table which the migration of the table can require
+     */
+    static size_t getReserved(const Table *table)
+    {
+        size_t slots = table->slots.load(std::memory_order_relaxed);
+        size_t movedSlots = table->movedSlots.load(std::memory_order_relaxed);
+        return (slots > movedSlots) ? (slots - movedSlots) : 0;
+    }
+
+    void promote(Table *table, Table *next);
+
+    int maxSizeBits;
+    std::atomic<Table*> current;
+    TableReclamationPool tableReclamationPool;
+    TableReclamation reclamation;
+    StatisticsPolicy counters;
+};
+
+template<LockfreeHashTableResizableTemplateTypes, typename StatisticsPolicy>
+typename LockfreeHashTableResizable<LockfreeHashTableResizableTemplateArgs, StatisticsPolicy>::TableEntry *
+LockfreeHashTableResizable<LockfreeHashTableResizableTemplateArgs, StatisticsPolicy>::findSlot(Table *table, Key key, uint_fast32_t hash, bool claim, size_t reserved)
+{
+    for (size_t probe = 0;probe <= table->mask;probe++)
+    {
+        TableEntry *entry = &table->entries[(hash + probe) & table->mask];
+        Key oldKey = entry->key;
+        if (hashtable_likely(oldKey == key))
+        {
+            return entry;
+        }
+        if (oldKey != IllegalKey)
+        {
+            continue;
+        }
+        if (!claim)
+        {
+            return nullptr;
+        }
+        if ((table->slots.load(std::memory_order_relaxed) + reserved) > table->mask)
+        {
+            return nullptr;
+        }
+        oldKey = hashtable_cmpxchg(&entry->key, IllegalKey, key);
+        if ((oldKey == IllegalKey) || (oldKey == key))
+        {
+            size_t slots = table->slots.fetch_add(1, std::memory_order_relaxed) + 1;
+            if ((slots > (table->mask / 2)) || (probe > MAX_PROBES))
+            {
+                startResize(table);
+            }
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+template<LockfreeHashTableResizableTemplateTypes, typename StatisticsPolicy>
+void LockfreeHashTableResizable<LockfreeHashTableResizableTemplateArgs, StatisticsPolicy>::startResize(Table *table)
+{
+    if (table != current.load(std::memory_order_acquire))
+    {
+        return;
+    }
+    if (table->next.load(std::memory_order_acquire) != nullptr)
+    {
+        return;
+    }
+    // Removed keys keep the slots until the migration. The count is exact, the slots
+    // counter runs ahead of the count by the inserts in progress
+    size_t slots = table->slots.load(std::memory_order_relaxed);
+    size_t live = counters.getCount(this->count);
+    size_t removed = (slots > live) ? (slots - live) : 0;
+    size_t sizeBits = table->sizeBits;
+    bool compact = (removed >= (table->mask / 8)) && ((live <= (table->mask / 4)) || ((int)sizeBits >= maxSizeBits));
+    if (!compact)
+    {
+        if ((int)sizeBits >= maxSizeBits)
+        {
+            return;
+        }
+        sizeBits++;
+    }
+    Table *next = allocateTable(sizeBits);
+    if (next == nullptr)
+    {
+        counters.add(statistics, &Statistics::rehashFailed);
+        return;
+    }
+    Table *expected = nullptr;
+    if (!table->next.compare_exchange_strong(expected, next, std::memory_order_acq_rel))
+    {
+        freeTable(next);
+        return;
+    }
+    counters.add(statistics, &Statistics::rehashTotal);
+}
+
+template<LockfreeHashTableResizableTemplateTypes, typename StatisticsPolicy>
+bool LockfreeHashTableResizable<LockfreeHashTableResizableTemplateArgs, StatisticsPolicy>::migrateSlot(Table *next, TableEntry *entry, size_t &movedSlots)
+{
+    TableEntry *copy = nullptr;
+    Object data = entry->data;
+    while (true)
+    {
+        if (data == MovedData)
+        {
+            // Moved by the previous pass over the chunk
+            return true;
+        }
+        if (data == IllegalData)
+        {
+            // Removed (or never inserted) key, there is nothing to copy
+            if (copy != nullptr)
+            {
+                copy->data = IllegalData;
+            }
+        }
+        else
+        {
+            // The data is set after the key, the key is already in the slot
+            if (copy == nullptr)
+            {
+                Key key = entry->key;
+                copy = findSlot(next, key, Hash::hash(key), true);
+                if (copy == nullptr)
+                {
+                    return false;
+                }
+            }
+            copy->data = data;
+        }
+        Object oldData = hashtable_cmpxchg(&entry->data, data, MovedData);
+        if (oldData == data)
+        {
+            if (entry->key != IllegalKey)
+            {
+                movedSlots++;
+            }
+            return true;
+        }
+        data = oldData;
+    }
+}
+
+template<LockfreeHashTableResizableTemplateTypes, typename StatisticsPolicy>
+void LockfreeHashTableResizable<LockfreeHashTableResizableTemplateArgs, StatisticsPolicy>::helpMigrate(Table *table)
+{
+    Table *next = table->next.load(std::memory_order_acquire);
+    if (hashtable_likely(next == nullptr))
+    {
+        return;
+    }
+    size_t chunks = table->getChunks();
+    size_t chunk = table->nextChunk.fetch_add(1, std::memory_order_relaxed) % chunks;
+    // Two threads can not move the same slot - a stale copy would overwrite the data
+    // updated in the next table
+    std::atomic<uint64_t> &claimed = table->chunksClaimed[chunk / CHUNK_BITS];
+    const uint64_t bit = (uint64_t)1 << (chunk % CHUNK_BITS);
+    if (claimed.fetch_or(bit, std::memory_order_acq_rel) & bit)
+    {
+        return;
+    }
+    size_t first = chunk * CHUNK_SIZE;
+    size_t last = (chunk == (chunks - 1)) ? (table->mask + 1) : (first + CHUNK_SIZE);
+    size_t movedSlots = 0;
+    for (size_t i = first;i < last;i++)
+    {
+        if (!migrateSlot(next, &table->entries[i], movedSlots))
+        {
+            // The next table is full. The table remains consistent, the moved slots
+            // are found in the next table. Release the chunk for the next pass
+            counters.add(statistics, &Statistics::rehashCollision);
+            table->movedSlots.fetch_add(movedSlots, std::memory_order_relaxed);
+            claimed.fetch_and(~bit, std::memory_order_release);
+            return;
+        }
+    }
+    table->movedSlots.fetch_add(movedSlots, std::memory_order_relaxed);
+    size_t chunksDone = table->chunksDone.fetch_add(1, std::memory_order_acq_rel) + 1;
+    if (chunksDone == chunks)
+    {
+        promote(table, next);
+    }
+}
+
+template<LockfreeHashTableResizableTemplateTypes, typename StatisticsPolicy>
+void LockfreeHashTableResizable<LockfreeHashTableResizableTemplateArgs, StatisticsPolicy>::promote(Table *table, Table *next)
+{
+    current.store(next, std::memory_order_release);
+    this->size = next->mask + 1;
+    counters.add(statistics, &Statistics::rehashDone);
+    // Threads which still read the old table are inside of critical sections.
+    // If the retire list is full keep the table until the next table is freed.
+    // The threads in the old table follow the pointer to the next table
+    if (!reclamation.retire(table))
+    {
+        next->retired = table;
+    }
+}
+
+/**
+ * Find the key in the current table. If the slot is moved repeat in the next table.
+ * New keys go to the next table if the migration is in progress. The new keys do not
+ * take the slots the migration needs - if there is no room the thread helps
+ * the migration and waits for the end of the migration
+ */
+template<LockfreeHashTableResizableTemplateTypes, typename StatisticsPolicy>
+enum LockfreeHashTableResizable<LockfreeHashTableResizableTemplateArgs, StatisticsPolicy>::InsertResult
+LockfreeHashTableResizable<LockfreeHashTableResizableTemplateArgs, StatisticsPolicy>::insert(Key key, const Object &o)
+{
+    typename TableReclamation::Guard guard(reclamation);
+    const uint_fast32_t hash = Hash::hash(key);
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
+    local.add(&Statistics::insertTotal);
+    if (!guard.isActive())
+    {
+        local.add(&Statistics::insertFailed);
+        return INSERT_FAILED;
+    }
+    Table *table = current.load(std::memory_order_acquire);
+    helpMigrate(table);
+    Table *previous = nullptr;
+    int waits = 0;
+    while (table != nullptr)
+    {
+        Table *next = table->next.load(std::memory_order_acquire);
+        size_t reserved = (previous != nullptr) ? getReserved(previous) : 0;
+        TableEntry *entry = findSlot(table, key, hash, (next == nullptr), reserved);
+        if (entry == nullptr)
+        {
+            if ((next == nullptr) && (previous != nullptr) && (waits < MAX_MIGRATION_WAITS))
+            {
+                helpMigrate(previous);
+                std::this_thread::yield();
+                waits++;
+                table = current.load(std::memory_order_acquire);
+                previous = nullptr;
+                continue;
+            }
+            if (next == nullptr)
+            {
+                startResize(table);
+                next = table->next.load(std::memory_order_acquire);
+            }
+            previous = table;
+            table = next;
+            continue;
+        }
+        Object data = entry->data;
+        while (data != MovedData)
+        {
+            Object oldData = hashtable_cmpxchg(&entry->data, data, o);
+            if (hashtable_likely(oldData == data))
+            {
+                if (data == IllegalData)
+                {
+                    local.add(&Statistics::insertOk);
+                    local.addCount(1);
+                    return INSERT_DONE;
+                }
+                local.add(&Statistics::insertDuplicate);
+                return INSERT_DUPLICATE;
+            }
+            data = oldData;
+        }
+        previous = table;
+        table = table->next.load(std::memory_order_acquire);
+    }
+
+    local.add(&Statistics::insertFailed);
+    return INSERT_FAILED;
+}
+
+template<LockfreeHashTableResizableTemplateTypes, typename StatisticsPolicy>
+bool LockfreeHashTableResizable<LockfreeHashTableResizableTemplateArgs, StatisticsPolicy>::remove(Key key, Object *o)
+{
+    typename TableReclamation::Guard guard(reclamation);
+    const uint_fast32_t hash = Hash::hash(key);
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
+    local.add(&Statistics::removeTotal);
+    if (!guard.isActive())
+    {
+        local.add(&Statistics::removeFailed);
+        return false;
+    }
+    Table *table = current.load(std::memory_order_acquire);
+    helpMigrate(table);
+    while (table != nullptr)
+    {
+        TableEntry *entry = findSlot(table, key, hash, false);
+        if (entry == nullptr)
+        {
+            table = table->next.load(std::memory_order_acquire);
+            continue;
+        }
+        Object data = entry->data;
+        while ((data != MovedData) && (data != IllegalData))
+        {
+            Object oldData = hashtable_cmpxchg(&entry->data, data, IllegalData);
+            if (hashtable_likely(oldData == data))
+            {
+                if (o)
+                {
+                    *o = data;
+                }
+                local.add(&Statistics::removeOk);
+                local.addCount(-1);
+                return true;
+            }
+            data = oldData;
+        }
+        if (data == IllegalData)
+        {
+            break;
+        }
+        table = table->next.load(std::memory_order_acquire);
+    }
+
+    local.add(&Statistics::removeFailed);
+    return false;
+}
+
+template<LockfreeHashTableResizableTemplateTypes, typename StatisticsPolicy>
+bool LockfreeHashTableResizable<LockfreeHashTableResizableTemplateArgs, StatisticsPolicy>::search(Key key, Object *o)
+{
+    typename TableReclamation::Guard guard(reclamation);
+    const uint_fast32_t hash = Hash::hash(key);
+    typename StatisticsPolicy::Local local = counters.getLocal(statistics, this->count);
+    local.add(&Statistics::searchTotal);
+    if (!guard.isActive())
+    {
+        local.add(&Statistics::searchFailed);
+        return false;
+    }
+    Table *table = current.load(std::memory_order_acquire);
+    helpMigrate(table);
+    while (table != nullptr)
+    {
+        TableEntry *entry = findSlot(table, key, hash, false);
+        if (entry == nullptr)
+        {
+            table = table->next.load(std::memory_order_acquire);
+            continue;
+        }
+        Object data = entry->data;
+        if (data == IllegalData)
+        {
+            break;
+        }
+        if (hashtable_likely(data != MovedData))
+        {
+            if (o)
+            {
+                *o = data;
+            }
+            local.add(&Statistics::searchOk);
+            return true;
+        }
+        table = table->next.load(std::memory_order_acquire);
+    }
+
+    local.add(&Statistics::searchFailed);
+    return false;
+}
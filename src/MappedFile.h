@@ -0,0 +1,121 @@
+/**
+ * A file mapped to the memory of the process, POSIX only
+ * Used for memory regions and tables which survive restart of the process
+ */
+
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+class MappedFile {
+
+public:
+
+    /**
+     * Map a file for read and write. The file is created if it does not exist and
+     * is resized to 'size' bytes. New bytes are zero.
+     */
+    MappedFile(const char* path, size_t size) :
+        fd(-1), address(nullptr), size(0) {
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            return;
+        }
+        if (ftruncate(fd, size) != 0) {
+            return;
+        }
+        map(size, PROT_READ | PROT_WRITE);
+    }
+
+    /**
+     * Map an existing file read only, size of the mapping is size of the file.
+     * Pages are shared with all processes which map the same file
+     */
+    MappedFile(const char* path) :
+        fd(-1), address(nullptr), size(0) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return;
+        }
+        map(st.st_size, PROT_READ);
+    }
+
+    /**
+     * The object owns the mapping and the descriptor
+     */
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (address != nullptr) {
+            munmap(address, size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    bool isMapped() const {
+        return (address != nullptr);
+    }
+
+    uint8_t* getAddress() const {
+        return address;
+    }
+
+    size_t getSize() const {
+        return size;
+    }
+
+    /**
+     * Flush the modified pages to the file
+     */
+    bool sync() const {
+        bool res = isMapped();
+        res = res && (msync(address, size, MS_SYNC) == 0);
+        return res;
+    }
+
+    /**
+     * 64 bits FNV-1a over 64 bits words, the tail is hashed byte by byte
+     */
+    static uint64_t checksum(const uint8_t* data, size_t size) {
+        const uint64_t prime = 0x100000001b3ULL;
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        size_t words = size / sizeof(uint64_t);
+        for (size_t i = 0;i < words;i++) {
+            uint64_t word;
+            memcpy(&word, data + i*sizeof(uint64_t), sizeof(word));
+            hash = (hash ^ word) * prime;
+        }
+        for (size_t i = words*sizeof(uint64_t);i < size;i++) {
+            hash = (hash ^ data[i]) * prime;
+        }
+        return hash;
+    }
+
+protected:
+
+    void map(size_t size, int protection) {
+        if (size == 0) {
+            return;
+        }
+        void* ptr = mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            return;
+        }
+        this->address = static_cast<uint8_t*>(ptr);
+        this->size = size;
+    }
+
+    int fd;
+    uint8_t* address;
+    size_t size;
+};
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include "ObjectRegistry.h"
+
 class MemoryRegion {
 
 public:
@@ -22,6 +24,18 @@ public:
         return address;
     }
 
+    /**
+     * Offsets instead of pointers make the content of a region relocatable,
+     * see MemoryRegionFile
+     */
+    size_t getOffset(const void* ptr) const {
+        return reinterpret_cast<uintptr_t>(ptr) - address;
+    }
+
+    template<typename T> T* getPointer(size_t offset) const {
+        return reinterpret_cast<T*>(address + offset);
+    }
+
 protected:
 
     const char* name;
@@ -34,12 +48,24 @@ protected:
 class MemoryAllocatorRaw {
 
 public:
-    MemoryAllocatorRaw(MemoryRegion memoryRegion,
+    /**
+     * @param offset - the blocks are carved starting from this offset in the region,
+     * see MemoryLayout
+     */
+    MemoryAllocatorRaw(const MemoryRegion& memoryRegion,
             size_t blockSize,
-            size_t count, unsigned int alignment);
+            size_t count, unsigned int alignment, size_t offset = 0);
     uint8_t* getBlock();
+    inline uint8_t* getBlock(size_t index) const;
+    inline size_t getBlockIndex(const void* block) const;
     bool blockBelongs(const void* block) const;
     const MemoryRegion& getRegion() const;
+    size_t getBlockSize() const {
+        return blockSize;
+    }
+    size_t getAlignedBlockSize() const {
+        return alignedBlockSize;
+    }
     void reset();
     constexpr static size_t predictMemorySize(size_t blockSize, size_t count, unsigned int alignment);
 
@@ -50,6 +76,7 @@ protected:
     size_t count;
     size_t sizeTotalBytes;
     size_t alignedBlockSize;
+    uintptr_t startAddress;
     uintptr_t firstNotAllocatedAddress;
 
     static constexpr size_t alignConst(size_t value, unsigned int alignment);
@@ -71,19 +98,20 @@ const MemoryRegion& MemoryAllocatorRaw::getRegion() const {
 }
 
 void MemoryAllocatorRaw::reset() {
-    firstNotAllocatedAddress = memoryRegion.getAddress();
+    firstNotAllocatedAddress = startAddress;
 }
 
 constexpr size_t MemoryAllocatorRaw::predictMemorySize(size_t blockSize, size_t count, unsigned int alignment) {
     return count * alignConst(blockSize, alignment);
 }
 
-MemoryAllocatorRaw::MemoryAllocatorRaw(MemoryRegion memoryRegion, size_t blockSize, size_t count, unsigned int alignment) :
+MemoryAllocatorRaw::MemoryAllocatorRaw(const MemoryRegion& memoryRegion, size_t blockSize, size_t count, unsigned int alignment, size_t offset) :
     alignment(alignment), blockSize(blockSize), memoryRegion(memoryRegion), count(count)  {  // initialize internal data
 
     alignedBlockSize = alignAddress(blockSize, alignment);
     sizeTotalBytes = alignedBlockSize * count;
-    if (sizeTotalBytes > memoryRegion.getSize()) {
+    startAddress = memoryRegion.getAddress() + offset;
+    if ((offset + sizeTotalBytes) > memoryRegion.getSize()) {
         // handle error
     }
     reset();
@@ -96,69 +124,193 @@ uint8_t* MemoryAllocatorRaw::getBlock() {
     return (uint8_t*)block;
 }
 
+/**
+ * Address of the block number 'index'. Blocks are carved by getBlock() one
+ * after another starting from the aligned start of the region
+ */
+uint8_t* MemoryAllocatorRaw::getBlock(size_t index) const {
+    uintptr_t block = alignAddress(startAddress, alignment);
+    block += index * alignedBlockSize;
+    return (uint8_t*)block;
+}
+
+/**
+ * Reverse of getBlock(index). The caller is expected to check blockBelongs() first
+ */
+size_t MemoryAllocatorRaw::getBlockIndex(const void* block) const {
+    uintptr_t base = alignAddress(startAddress, alignment);
+    size_t index = ((uintptr_t)block - base) / alignedBlockSize;
+    return index;
+}
+
 bool MemoryAllocatorRaw::blockBelongs(const void* block) const {
     uintptr_t blockPtr = (uintptr_t)block;
     bool res = true;
-    res = res && blockPtr >= memoryRegion.getAddress();
-    size_t maxAddress = memoryRegion.getAddress()+sizeTotalBytes;
-    res = res && (blockPtr <= maxAddress);
+    res = res && blockPtr >= startAddress;
+    size_t maxAddress = startAddress+sizeTotalBytes;
+    res = res && (blockPtr < maxAddress);
     uintptr_t alignedAddress = alignAddress(blockPtr, alignment);
     res = res && (blockPtr == alignedAddress);
     return res;
 }
 
-template<typename Lock, size_t Size> class MemoryPoolRaw {
+/**
+ * All memory pools in the system inherit this class and are kept in a registry.
+ * The registry allows to dump usage of all pools, for example:
+ *
+ *   MemoryPoolBase::Report reports[8];
+ *   size_t count = MemoryPoolBase::getReports(reports, 8);
+ *   for (size_t i = 0;i < count;i++) {
+ *       cout << reports[i].name << " " << reports[i].statistics.maxInUse << "/" << reports[i].size << endl;
+ *   }
+ */
+class MemoryPoolBase : ObjectRegistry<MemoryPoolBase*, 32> {
 
 public:
 
-    MemoryPoolRaw(const char* name, MemoryAllocatorRaw& memoryAllocator);
-
-    ~MemoryPoolRaw() {
-        memoryAllocator.reset();
-    }
+    struct Statistics {
+        uint32_t inUse;
+        uint32_t maxInUse;
+        uint32_t errBadBlock;
+        uint32_t errAllocate;
+    };
+
+    struct Report {
+        const char* name;
+        /**
+         * Number of blocks in the pool
+         */
+        size_t size;
+        size_t blockSize;
+        size_t alignedBlockSize;
+        /**
+         * Bytes lost to alignment of the blocks, (alignedBlockSize-blockSize)*size
+         */
+        size_t bytesWasted;
+        Statistics statistics;
+    };
 
     inline void resetMaxInUse() const {
         statistics.maxInUse = 0;
     }
 
-    typedef struct {
-        uint32_t inUse;
-        uint32_t maxInUse;
-        uint32_t errBadBlock;
-    } Statistics;
+    inline const Statistics &getStatistics(void) const {return statistics;}
 
-    inline bool allocate(uint8_t** block);
+    const char* getName() const {
+        return name;
+    }
 
-    inline bool free(uint8_t* block);
+    size_t getBlockSize() const {
+        return blockSize;
+    }
 
-    inline const Statistics &getStatistics(void) const {return statistics;}
+    void getReport(Report* report) const {
+        report->name = name;
+        report->size = size;
+        report->blockSize = blockSize;
+        report->alignedBlockSize = alignedBlockSize;
+        report->bytesWasted = (alignedBlockSize - blockSize) * size;
+        report->statistics = statistics;
+    }
+
+    /**
+     * Copy reports of up to maxReports registered pools to the array reports
+     * @return number of reports
+     */
+    static size_t getReports(Report* reports, size_t maxReports) {
+        size_t count = 0;
+        uint_fast32_t index = 0;
+        MemoryPoolBase* pool;
+        while ((count < maxReports) && (getNext(index, &pool) == GETNEXT_OK)) {
+            pool->getReport(&reports[count]);
+            count++;
+            index++;
+        }
+        return count;
+    }
 
 protected:
+
+    MemoryPoolBase(const char* name, size_t size, size_t blockSize, size_t alignedBlockSize) :
+        name(name), size(size), blockSize(blockSize), alignedBlockSize(alignedBlockSize) {
+        memset(&this->statistics, 0, sizeof(this->statistics));
+        addRegistration(this);
+    }
+
+    ~MemoryPoolBase() {
+        removeRegistration(this);
+    }
+
+    inline void statisticsAllocate(bool res) {
+        if (res) {
+            statistics.inUse++;
+            if (statistics.inUse > statistics.maxInUse)
+                statistics.maxInUse = statistics.inUse;
+        }
+        else {
+            statistics.errAllocate++;
+        }
+    }
+
+    inline void statisticsFree(bool res) {
+        if (res) {
+            statistics.inUse--;
+        }
+        else {
+            statistics.errBadBlock++;
+        }
+    }
+
     mutable Statistics statistics;
     const char* name;
+    size_t size;
+    size_t blockSize;
+    size_t alignedBlockSize;
+};
+
+template<typename Lock, size_t Size> class MemoryPoolRaw : public MemoryPoolBase {
+
+public:
+
+    MemoryPoolRaw(const char* name, MemoryAllocatorRaw& memoryAllocator);
+
+    ~MemoryPoolRaw() {
+        memoryAllocator.reset();
+    }
+
+    inline bool allocate(uint8_t** block);
+
+    inline bool free(uint8_t* block);
+
+protected:
     Stack<uint8_t, LockDummy,  Size> pool;
     MemoryAllocatorRaw& memoryAllocator;
+    /**
+     * Number of blocks carved from the allocator so far. The constructor does not
+     * touch the memory - blocks are carved on demand, the free list is used only
+     * after all Size blocks were handed out at least once
+     */
+    size_t carved;
 };
 
 template<typename Lock, size_t Size> MemoryPoolRaw<Lock, Size>::MemoryPoolRaw(const char* name, MemoryAllocatorRaw& memoryAllocator) :
-    name(name), memoryAllocator(memoryAllocator) {
-    memset(&this->statistics, 0, sizeof(this->statistics));
-    for (size_t i = 0;i < Size;i++) {
-        uint8_t *block = memoryAllocator.getBlock();
-        pool.push(block);
-    }
+    MemoryPoolBase(name, Size, memoryAllocator.getBlockSize(), memoryAllocator.getAlignedBlockSize()),
+    memoryAllocator(memoryAllocator), carved(0) {
 }
 
 template<typename Lock, size_t Size>
 inline bool MemoryPoolRaw<Lock, Size>::allocate(uint8_t** block) {
     bool res;
     Lock lock;
-    res = pool.pop(block);
-    if (res) {
-        statistics.inUse++;
-        if (statistics.inUse > statistics.maxInUse)
-            statistics.maxInUse = statistics.inUse;
+    if (carved < Size) {
+        *block = memoryAllocator.getBlock();
+        carved++;
+        res = true;
+    }
+    else {
+        res = pool.pop(block);
     }
+    statisticsAllocate(res);
     return res;
 }
 
@@ -167,20 +319,17 @@ inline bool MemoryPoolRaw<Lock, Size>::free(uint8_t* block) {
     bool res;
     Lock lock;
     res = memoryAllocator.blockBelongs(block);
-    if (res) {
-        res = pool.push(block);
-        statistics.inUse--;
-    }
-    else {
-        statistics.errBadBlock++;
-    }
+    // A block above the high-water mark is not carved yet, getBlock() will return it
+    res = res && (memoryAllocator.getBlockIndex(block) < carved);
+    res = res && pool.push(block);
+    statisticsFree(res);
     return res;
 }
 
 template<typename Lock, typename ObjectType, size_t Size>
-class MemoryPool {
+class MemoryPool : public MemoryPoolBase {
 public:
-    MemoryPool();
+    MemoryPool(const char* name = "");
     ~MemoryPool() {}
 
     inline bool allocate(ObjectType **obj);
@@ -189,20 +338,30 @@ public:
 protected:
     Stack<ObjectType, LockDummy,  Size> pool;
     ObjectType objects[Size];
+    /**
+     * High-water mark in the objects[], see MemoryPoolRaw::carved
+     */
+    size_t carved;
 };
 
 template<typename Lock, typename ObjectType, size_t Size>
-MemoryPool<Lock, ObjectType, Size>::MemoryPool() {
-    for (int i = 0;i < Size;i++) {
-        pool.push(&objects[i]);
-    }
+MemoryPool<Lock, ObjectType, Size>::MemoryPool(const char* name) :
+    MemoryPoolBase(name, Size, sizeof(ObjectType), sizeof(ObjectType)), carved(0) {
 }
 
 template<typename Lock, typename ObjectType, size_t Size>
 bool MemoryPool<Lock, ObjectType, Size>::allocate(ObjectType **obj) {
     bool res;
     Lock lock;
-    res = pool.pop(obj);
+    if (carved < Size) {
+        *obj = &objects[carved];
+        carved++;
+        res = true;
+    }
+    else {
+        res = pool.pop(obj);
+    }
+    statisticsAllocate(res);
     return res;
 }
 
@@ -210,14 +369,16 @@ template<typename Lock, typename ObjectType, size_t Size>
 bool MemoryPool<Lock, ObjectType, Size>::free(ObjectType *obj) {
     bool res;
     Lock lock;
-    res = pool.push(obj);
+    res = (obj >= &objects[0]) && (obj < &objects[carved]);
+    res = res && pool.push(obj);
+    statisticsFree(res);
     return res;
 }
 
 template<typename Lock, typename ObjectType>
-class MemoryPoolDynamic {
+class MemoryPoolDynamic : public MemoryPoolBase {
 public:
-    MemoryPoolDynamic(size_t size);
+    MemoryPoolDynamic(size_t size, const char* name = "");
     ~MemoryPoolDynamic() {}
 
     inline bool allocate(ObjectType **obj);
@@ -226,22 +387,31 @@ public:
 protected:
     StackDynamic<ObjectType, LockDummy> pool;
     ObjectType *objects;
+    /**
+     * High-water mark in the objects[], see MemoryPoolRaw::carved
+     */
+    size_t carved;
 };
 
 template<typename Lock, typename ObjectType>
-MemoryPoolDynamic<Lock, ObjectType>::MemoryPoolDynamic(size_t size):
-    pool(size) {
-    ObjectType *objects = new ObjectType[size];
-    for (int i = 0;i < size;i++) {
-        pool.push(&objects[i]);
-    }
+MemoryPoolDynamic<Lock, ObjectType>::MemoryPoolDynamic(size_t size, const char* name):
+    MemoryPoolBase(name, size, sizeof(ObjectType), sizeof(ObjectType)), pool(size), carved(0) {
+    objects = new ObjectType[size];
 }
 
 template<typename Lock, typename ObjectType>
 bool MemoryPoolDynamic<Lock, ObjectType>::allocate(ObjectType **obj) {
     bool res;
     Lock lock;
-    res = pool.pop(obj);
+    if (carved < size) {
+        *obj = &objects[carved];
+        carved++;
+        res = true;
+    }
+    else {
+        res = pool.pop(obj);
+    }
+    statisticsAllocate(res);
     return res;
 }
 
@@ -249,6 +419,243 @@ template<typename Lock, typename ObjectType>
 bool MemoryPoolDynamic<Lock, ObjectType>::free(ObjectType *obj) {
     bool res;
     Lock lock;
-    res = pool.push(obj);
+    res = (obj >= &objects[0]) && (obj < &objects[carved]);
+    res = res && pool.push(obj);
+    statisticsFree(res);
     return res;
 }
+
+/**
+ * Two level bitmap of Size blocks. A bit set in the leaf word means that the block
+ * is allocated, a bit set in the summary word means that the leaf word is full.
+ * A zeroed bitmap is a pool where all blocks are free.
+ * The search for a free block costs two bit scans (tzcnt/bsf) and always returns the
+ * lowest free block - allocations are packed in the beginning of the memory region.
+ */
+template<size_t Size> class BlockBitmap {
+
+public:
+    BlockBitmap() :
+        firstSummary(0) {
+        memset(leaves, 0, sizeof(leaves));
+        memset(summary, 0, sizeof(summary));
+    }
+
+    inline bool allocate(size_t* index);
+    inline void free(size_t index);
+
+    inline bool isAllocated(size_t index) const {
+        return ((leaves[index / BITS] >> (index % BITS)) & 1);
+    }
+
+protected:
+    typedef unsigned long long Word;
+    static const size_t BITS = 8*sizeof(Word);
+    static const size_t LEAVES = (Size + BITS - 1) / BITS;
+    static const size_t SUMMARIES = (LEAVES + BITS - 1) / BITS;
+
+    Word leaves[LEAVES];
+    Word summary[SUMMARIES];
+    /**
+     * All summary words below this one are full
+     */
+    size_t firstSummary;
+};
+
+template<size_t Size>
+inline bool BlockBitmap<Size>::allocate(size_t* index) {
+    for (size_t s = firstSummary;s < SUMMARIES;s++) {
+        Word notFull = ~summary[s];
+        if (notFull == 0) {
+            firstSummary = s + 1;
+            continue;
+        }
+        size_t leaf = s * BITS + __builtin_ctzll(notFull);
+        if (leaf >= LEAVES) {
+            break;
+        }
+        size_t bit = __builtin_ctzll(~leaves[leaf]);
+        size_t block = leaf * BITS + bit;
+        // The tail of the last leaf is never allocated. Everything below is taken
+        if (block >= Size) {
+            break;
+        }
+        leaves[leaf] |= ((Word)1 << bit);
+        if (leaves[leaf] == ~(Word)0) {
+            summary[s] |= ((Word)1 << (leaf % BITS));
+        }
+        firstSummary = s;
+        *index = block;
+        return true;
+    }
+    return false;
+}
+
+template<size_t Size>
+inline void BlockBitmap<Size>::free(size_t index) {
+    size_t leaf = index / BITS;
+    size_t s = leaf / BITS;
+    leaves[leaf] &= ~((Word)1 << (index % BITS));
+    summary[s] &= ~((Word)1 << (leaf % BITS));
+    if (s < firstSummary) {
+        firstSummary = s;
+    }
+}
+
+/**
+ * Same API as MemoryPoolRaw, but the free blocks are tracked by a BlockBitmap
+ * instead of a stack of pointers - one bit of metadata per block instead of a pointer.
+ * Allocation prefers low addresses which keeps the working set compact.
+ * Free detects double free and blocks which do not belong to the pool
+ */
+template<typename Lock, size_t Size> class MemoryPoolBitmap : public MemoryPoolBase {
+
+public:
+
+    MemoryPoolBitmap(const char* name, MemoryAllocatorRaw& memoryAllocator);
+
+    inline bool allocate(uint8_t** block);
+
+    inline bool free(uint8_t* block);
+
+protected:
+    BlockBitmap<Size> bitmap;
+    MemoryAllocatorRaw& memoryAllocator;
+};
+
+template<typename Lock, size_t Size> MemoryPoolBitmap<Lock, Size>::MemoryPoolBitmap(const char* name, MemoryAllocatorRaw& memoryAllocator) :
+    MemoryPoolBase(name, Size, memoryAllocator.getBlockSize(), memoryAllocator.getAlignedBlockSize()),
+    memoryAllocator(memoryAllocator) {
+}
+
+template<typename Lock, size_t Size>
+inline bool MemoryPoolBitmap<Lock, Size>::allocate(uint8_t** block) {
+    bool res;
+    Lock lock;
+    size_t index;
+    res = bitmap.allocate(&index);
+    if (res) {
+        *block = memoryAllocator.getBlock(index);
+    }
+    statisticsAllocate(res);
+    return res;
+}
+
+template<typename Lock, size_t Size>
+inline bool MemoryPoolBitmap<Lock, Size>::free(uint8_t* block) {
+    bool res;
+    Lock lock;
+    res = memoryAllocator.blockBelongs(block);
+    size_t index = 0;
+    if (res) {
+        index = memoryAllocator.getBlockIndex(block);
+        res = (index < Size) && (memoryAllocator.getBlock(index) == block);
+    }
+    res = res && bitmap.isAllocated(index);
+    if (res) {
+        bitmap.free(index);
+    }
+    statisticsFree(res);
+    return res;
+}
+
+/**
+ * Compile time memory planner
+ * A memory layout is a list of pools. The planner places the pools one after another
+ * in a single statically allocated region, every pool starts at its own alignment.
+ * The offsets and the total size are compile time constants.
+ *
+ * Example of usage:
+ *
+ *   typedef MemoryLayout<
+ *       MemoryPoolSpec<63, 7, 2>,
+ *       MemoryPoolSpec<256, 4, 32>
+ *   > MyMemoryLayout;
+ *   static_assert((MyMemoryLayout::SIZE <= 1024), "Memory layout is too large");
+ *
+ *   static MemoryLayoutRegion<MyMemoryLayout> myRegion("myMem");
+ *   static MemoryLayoutPool<MyMemoryLayout, 0, LockDummy> mySmallPool("small", myRegion);
+ *   static MemoryLayoutPool<MyMemoryLayout, 1, LockDummy, MemoryPoolBitmap> myLargePool("large", myRegion);
+ */
+template<size_t BlockSize, size_t Count, unsigned int Alignment> struct MemoryPoolSpec {
+    static_assert((Alignment != 0) && ((Alignment & (Alignment-1)) == 0), "Alignment shall be a power of 2");
+
+    static const size_t BLOCK_SIZE = BlockSize;
+    static const size_t COUNT = Count;
+    static const unsigned int ALIGNMENT = Alignment;
+    static const size_t SIZE = MemoryAllocatorRaw::predictMemorySize(BlockSize, Count, Alignment);
+};
+
+template<size_t Offset, typename... Specs> struct MemoryLayoutPlanner;
+
+template<size_t Offset> struct MemoryLayoutPlanner<Offset> {
+    static const size_t SIZE = Offset;
+    static const unsigned int ALIGNMENT = 1;
+};
+
+template<size_t Offset, typename PoolSpec, typename... Specs> struct MemoryLayoutPlanner<Offset, PoolSpec, Specs...> {
+    typedef PoolSpec Spec;
+    static const size_t OFFSET = (Offset + PoolSpec::ALIGNMENT - 1) & ~((size_t)PoolSpec::ALIGNMENT - 1);
+    typedef MemoryLayoutPlanner<OFFSET + PoolSpec::SIZE, Specs...> Next;
+    static const size_t SIZE = Next::SIZE;
+    static const unsigned int ALIGNMENT = (PoolSpec::ALIGNMENT > Next::ALIGNMENT) ? PoolSpec::ALIGNMENT : Next::ALIGNMENT;
+};
+
+template<size_t I, typename Planner> struct MemoryLayoutEntry {
+    typedef typename MemoryLayoutEntry<I-1, typename Planner::Next>::Type Type;
+};
+
+template<typename Planner> struct MemoryLayoutEntry<0, Planner> {
+    typedef Planner Type;
+};
+
+template<typename... Specs> struct MemoryLayout : MemoryLayoutPlanner<0, Specs...> {
+    static_assert(sizeof...(Specs) > 0, "Memory layout is empty");
+
+    /**
+     * Entry<I>::Spec is the declaration of the pool I, Entry<I>::OFFSET is the offset
+     * of the pool in the region
+     */
+    template<size_t I> using Entry = typename MemoryLayoutEntry<I, MemoryLayoutPlanner<0, Specs...> >::Type;
+};
+
+/**
+ * Statically allocated memory for all pools in the Layout
+ */
+template<typename Layout> class MemoryLayoutRegion : public MemoryRegion {
+public:
+    MemoryLayoutRegion(const char *name) :
+        MemoryRegion(name, reinterpret_cast<uintptr_t>(storage), Layout::SIZE) {
+    }
+
+protected:
+    alignas(Layout::ALIGNMENT) uint8_t storage[Layout::SIZE];
+};
+
+template<typename Layout, size_t I> class MemoryLayoutAllocator : public MemoryAllocatorRaw {
+public:
+    typedef typename Layout::template Entry<I> Entry;
+
+    MemoryLayoutAllocator(const MemoryRegion& memoryRegion) :
+        MemoryAllocatorRaw(memoryRegion, Entry::Spec::BLOCK_SIZE, Entry::Spec::COUNT, Entry::Spec::ALIGNMENT, Entry::OFFSET) {
+    }
+};
+
+/**
+ * Pool number I in the Layout. Pool is MemoryPoolRaw or MemoryPoolBitmap
+ */
+template<typename Layout, size_t I, typename Lock,
+    template<typename, size_t> class Pool = MemoryPoolRaw>
+class MemoryLayoutPool :
+    protected MemoryLayoutAllocator<Layout, I>,
+    public Pool<Lock, MemoryLayoutAllocator<Layout, I>::Entry::Spec::COUNT> {
+public:
+    typedef Pool<Lock, MemoryLayoutAllocator<Layout, I>::Entry::Spec::COUNT> PoolType;
+
+    MemoryLayoutPool(const char* name, const MemoryLayoutRegion<Layout>& memoryRegion) :
+        MemoryLayoutAllocator<Layout, I>(memoryRegion),
+        PoolType(name, *this) {
+    }
+
+    using PoolType::getBlockSize;
+};
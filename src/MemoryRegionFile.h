@@ -0,0 +1,160 @@
+/**
+ * Memory region backed by a file. The content of the region survives restart of
+ * the process - tables and pools built in the region can be reattached instead of
+ * being rebuilt.
+ *
+ * The file starts with a header: magic, layout version, size, a checksum of the
+ * content and offset of the application root object. The region is restored if the
+ * header matches the expected layout version and size, the region was synced
+ * before the previous process exited (see sync()) and the checksum is correct.
+ * Otherwise the content of the region is undefined and the application is expected
+ * to build the data from scratch.
+ *
+ * Only an explicit sync() marks the region valid, the destructor does not. A process
+ * which exits in the middle of an update leaves a region which is not restored. After
+ * sync() the application calls invalidate() before it modifies the region again.
+ *
+ * The region can be mapped at a different address after restart. The objects in the
+ * region shall not keep pointers, only offsets from the beginning of the region, see
+ * MemoryRegion::getOffset() and MemoryRegion::getPointer(). The pools in Memory.h keep
+ * pointers and the state in the process memory, IndexPool keeps indexes and can be
+ * placed in the region.
+ *
+ * Example of usage:
+ *
+ *   static MemoryRegionFile tablesRegion("tables", "/var/run/tables.bin", 64*1024*1024, TABLES_LAYOUT_VERSION);
+ *   if (tablesRegion.isRestored()) {
+ *       myTables = tablesRegion.getPointer<MyTables>(tablesRegion.getRoot());
+ *   }
+ *   else {
+ *       myTables = buildTables(tablesRegion);
+ *       tablesRegion.setRoot(tablesRegion.getOffset(myTables));
+ *   }
+ *   tablesRegion.sync();
+ *   ....
+ *   tablesRegion.invalidate();
+ *   updateTables(myTables);
+ *   tablesRegion.sync();
+ */
+
+#pragma once
+
+#include "MappedFile.h"
+
+struct MemoryRegionFileHeader {
+    uint32_t magic;
+    uint32_t layoutVersion;
+    uint64_t size;
+    uint64_t checksum;
+    uint64_t root;
+    uint32_t synced;
+};
+
+class MemoryRegionFile : protected MappedFile, public MemoryRegion {
+
+public:
+
+    static const uint32_t MAGIC = 0x4d454d52;
+
+    /**
+     * Header is padded to a cache line, the region is cache line aligned
+     */
+    static const size_t HEADER_SIZE = 64;
+
+    MemoryRegionFile(const char* name, const char* path, size_t size, uint32_t layoutVersion) :
+        MappedFile(path, HEADER_SIZE + size),
+        MemoryRegion(name, reinterpret_cast<uintptr_t>(getRegionAddress()), (MappedFile::getAddress() != nullptr) ? size : 0),
+        restored(false) {
+        static_assert(sizeof(MemoryRegionFileHeader) <= HEADER_SIZE, "Header of the memory region file is too large");
+        if (!isMapped()) {
+            return;
+        }
+        MemoryRegionFileHeader* header = getHeader();
+        restored = (header->magic == MAGIC);
+        restored = restored && (header->layoutVersion == layoutVersion);
+        restored = restored && (header->size == size);
+        restored = restored && (header->synced != 0);
+        restored = restored && (header->checksum == checksum(getRegionAddress(), size));
+        if (!restored) {
+            header->magic = MAGIC;
+            header->layoutVersion = layoutVersion;
+            header->size = size;
+            header->root = 0;
+        }
+        // Until the next sync() the content can be modified and is not valid
+        invalidate();
+    }
+
+    /**
+     * The region is not synced, the next process rebuilds the data if this
+     * process exits before sync()
+     */
+    ~MemoryRegionFile() {
+    }
+
+    using MappedFile::isMapped;
+    using MemoryRegion::getSize;
+    using MemoryRegion::getAddress;
+
+    /**
+     * True if the content of the region was left by the previous process
+     */
+    bool isRestored() const {
+        return restored;
+    }
+
+    /**
+     * Offset of the application root object in the region
+     */
+    void setRoot(size_t offset) {
+        if (isMapped()) {
+            getHeader()->root = offset;
+        }
+    }
+
+    size_t getRoot() const {
+        return isMapped() ? getHeader()->root : 0;
+    }
+
+    /**
+     * Calculate the checksum and flush the region to the file. After sync() the
+     * region can be restored by the next process. The application calls sync()
+     * when the data is consistent, for example before exit
+     */
+    bool sync() {
+        if (!isMapped()) {
+            return false;
+        }
+        MemoryRegionFileHeader* header = getHeader();
+        header->checksum = checksum(getRegionAddress(), MemoryRegion::getSize());
+        header->synced = 1;
+        return MappedFile::sync();
+    }
+
+    /**
+     * Mark the region not valid before the region is modified. The header is flushed
+     * to the file - a crash in the middle of the update is detected by the next process
+     */
+    bool invalidate() {
+        if (!isMapped()) {
+            return false;
+        }
+        MemoryRegionFileHeader* header = getHeader();
+        header->synced = 0;
+        header->checksum = 0;
+        return MappedFile::sync();
+    }
+
+protected:
+
+    MemoryRegionFileHeader* getHeader() const {
+        return reinterpret_cast<MemoryRegionFileHeader*>(MappedFile::getAddress());
+    }
+
+    uint8_t* getRegionAddress() const {
+        uint8_t* address = MappedFile::getAddress();
+        return (address != nullptr) ? (address + HEADER_SIZE) : nullptr;
+    }
+
+    bool restored;
+};
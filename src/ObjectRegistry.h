@@ -1,5 +1,16 @@
+/**
+ * A static array of registered objects, for example all hash tables or all memory pools
+ * in the system. Used for debug and statistics.
+ *
+ * The objects register and unregister in the constructors and the destructors,
+ * possibly in different threads. The slots are updated with compare-and-set and read with
+ * atomic loads. A scan of the registry does not take a lock, see Snapshot.
+ */
+
 #pragma once
 
+#include <stdint.h>
+
 template<typename Object, int Size>
 class ObjectRegistry
 {
@@ -9,9 +20,8 @@ public:
         static_assert(sizeof(Object) <= sizeof(uintptr_t), "ObjectRegistry is intended to work only with pointers");
         for (int i = 0; i < Size; i++)
         {
-            if (registry[i] == nullptr)
+            if ((load(i) == nullptr) && __sync_bool_compare_and_swap(&registry[i], nullptr, o))
             {
-                registry[i] = o;
                 break;
             }
         }
@@ -21,9 +31,9 @@ public:
     {
         for (int i = 0; i < Size; i++)
         {
-            if (registry[i] == o)
+            if (load(i) == o)
             {
-                registry[i] = nullptr;
+                __sync_bool_compare_and_swap(&registry[i], o, nullptr);
             }
         }
     }
@@ -39,22 +49,67 @@ public:
     static enum GetNextResult getNext(uint_fast32_t &index, Object *o)
     {
         enum GetNextResult result = GETNEXT_END_TABLE;
-        Object *entry = &registry[index];
         for (uint_fast32_t i = index;i < Size;i++)
         {
-            if (*entry != nullptr)
+            Object entry = load(i);
+            if (entry != nullptr)
             {
-                *o = *entry;
+                *o = entry;
                 index = i;
                 result = GETNEXT_OK;
                 break;
             }
-            entry++;
         }
         return result;
     }
 
+    /**
+     * Copy of the registered objects. getNext() of the snapshot returns the same objects
+     * when called again, while getNext() of the registry can return an object registered
+     * in the slot after the previous call. The objects can be destroyed after the copy,
+     * the application shall keep the registered objects alive while a snapshot is in use.
+     */
+    class Snapshot
+    {
+    public:
+        Snapshot() : count(0)
+        {
+            for (int i = 0; i < Size; i++)
+            {
+                Object o = load(i);
+                if (o != nullptr)
+                {
+                    objects[count++] = o;
+                }
+            }
+        }
+
+        uint_fast32_t getCount() const
+        {
+            return count;
+        }
+
+        enum GetNextResult getNext(uint_fast32_t &index, Object *o) const
+        {
+            if (index >= count)
+            {
+                return GETNEXT_END_TABLE;
+            }
+            *o = objects[index];
+            return GETNEXT_OK;
+        }
+
+    protected:
+        Object objects[Size];
+        uint_fast32_t count;
+    };
+
 protected:
+    static Object load(int i)
+    {
+        return __atomic_load_n(&registry[i], __ATOMIC_ACQUIRE);
+    }
+
     static Object registry[Size];
 };
 
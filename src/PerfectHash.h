@@ -0,0 +1,462 @@
+/**
+ * Perfect hash for a set of keys known at compile time
+ *
+ * Command names, register maps, protocol opcodes - the keys are known when the code is
+ * compiled. The compiler builds the table of slots with hash and displace: the hash of
+ * a key selects a bucket, every bucket has a displacement - a seed which moves the keys
+ * of the bucket to free slots. The buckets are placed one after another, the compiler
+ * tries the displacements until all keys of the bucket land in free slots. There is no
+ * code running at initialization time and no collisions: a lookup is a hash, two loads
+ * from the tables and one compare.
+ *
+ * find() returns the index of the key in the list of keys or -1. The application keeps
+ * the values in an array in the same order as the keys. find() is constexpr and can be
+ * used in static_assert and switch labels.
+ *
+ * The table has O(N) slots: the default Size is the power of two above twice the number
+ * of keys, the number of buckets is the power of two above half of the number of keys.
+ * The displacement of a bucket is searched in [1, MAX_DISPLACEMENTS), the compilation
+ * fails with "PerfectHash: no displacement" if the table is too dense. The occupied slots
+ * are a bitmap and a displacement is checked in a few operations. Every bucket is a
+ * template instantiation, N is limited by PERFECT_HASH_MAX_KEYS to stay below the default
+ * -ftemplate-depth and to keep the build time reasonable - 256 keys take ~2s, 512 keys
+ * ~10s. The list shall not contain duplicates. All recursions in the constexpr functions
+ * are log deep or as deep as the size of a bucket, C++11 constexpr functions are single
+ * return.
+ *
+ * Example of usage:
+ *
+ *   constexpr const char *myCommands[] = {"get", "set", "delete", "stats"};
+ *   typedef PerfectHash<const char*, 4, myCommands> MyCommandsHash;
+ *   static_assert(MyCommandsHash::find("set") == 1, "Perfect hash is broken");
+ *   int command = MyCommandsHash::find(name);
+ *   if (command >= 0)
+ *       handlers[command](args);
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+static const size_t PERFECT_HASH_MAX_KEYS = 512;
+
+/**
+ * FNV-1a over the string, the seed is mixed by perfectHashMix()
+ */
+static constexpr uint32_t perfectHashFnv(const char *key, uint32_t hash = 2166136261u)
+{
+    return (*key == 0) ? hash : perfectHashFnv(key + 1, (hash ^ (uint8_t)*key) * 16777619u);
+}
+
+static constexpr uint32_t perfectHashShift(uint32_t hash, int shift)
+{
+    return hash ^ (hash >> shift);
+}
+
+/**
+ * Finalizer of MurmurHash3
+ */
+static constexpr uint32_t perfectHashMix(uint32_t hash, uint32_t seed)
+{
+    return perfectHashShift(perfectHashShift(perfectHashShift(hash ^ (seed * 0x9E3779B9u), 16) * 0x85EBCA6Bu, 13) * 0xC2B2AE35u, 16);
+}
+
+/**
+ * Integral keys
+ */
+template<typename Key> struct PerfectHashKey
+{
+    static constexpr uint32_t hash(Key key)
+    {
+        return (uint32_t)(uint64_t)key ^ (uint32_t)((uint64_t)key >> 32);
+    }
+
+    static constexpr bool equal(Key key1, Key key2)
+    {
+        return (key1 == key2);
+    }
+};
+
+template<> struct PerfectHashKey<const char*>
+{
+    static constexpr uint32_t hash(const char *key)
+    {
+        return perfectHashFnv(key);
+    }
+
+    static constexpr bool equal(const char *key1, const char *key2)
+    {
+        return (*key1 == *key2) && ((*key1 == 0) || equal(key1 + 1, key2 + 1));
+    }
+};
+
+template<size_t... I> struct PerfectHashIndexes
+{
+};
+
+template<typename Indexes1, typename Indexes2> struct PerfectHashConcat;
+
+template<size_t... I, size_t... J> struct PerfectHashConcat<PerfectHashIndexes<I...>, PerfectHashIndexes<J...> >
+{
+    typedef PerfectHashIndexes<I..., (sizeof...(I) + J)...> Type;
+};
+
+/**
+ * 0, 1, .. N-1, instantiation depth is log(N)
+ */
+template<size_t N> struct PerfectHashMakeIndexes
+{
+    typedef typename PerfectHashConcat<typename PerfectHashMakeIndexes<N / 2>::Type,
+        typename PerfectHashMakeIndexes<N - N / 2>::Type>::Type Type;
+};
+
+template<> struct PerfectHashMakeIndexes<0>
+{
+    typedef PerfectHashIndexes<> Type;
+};
+
+template<> struct PerfectHashMakeIndexes<1>
+{
+    typedef PerfectHashIndexes<0> Type;
+};
+
+static constexpr size_t perfectHashPowerOfTwo(size_t n, size_t power = 8)
+{
+    return (power >= n) ? power : perfectHashPowerOfTwo(n, 2 * power);
+}
+
+/**
+ * Displacements of the placed buckets, the last value is a placeholder
+ */
+template<uint32_t... D> struct PerfectHashDisplacements
+{
+    static constexpr uint32_t values[sizeof...(D) + 1] = {D..., 0};
+};
+
+template<uint32_t... D>
+constexpr uint32_t PerfectHashDisplacements<D...>::values[sizeof...(D) + 1];
+
+/**
+ * Occupied slots, 64 slots in a word
+ */
+template<uint64_t... W> struct PerfectHashBitmap
+{
+    static constexpr uint64_t values[sizeof...(W)] = {W...};
+};
+
+template<uint64_t... W>
+constexpr uint64_t PerfectHashBitmap<W...>::values[sizeof...(W)];
+
+/**
+ * Hashes and buckets of the keys, see PerfectHash
+ */
+template<typename Key, size_t N, const Key (&Keys)[N], size_t Size, typename KeyTraits,
+    typename Indexes = typename PerfectHashMakeIndexes<N>::Type>
+class PerfectHashBuilder;
+
+template<typename Key, size_t N, const Key (&Keys)[N], size_t Size, typename KeyTraits, size_t... I>
+class PerfectHashBuilder<Key, N, Keys, Size, KeyTraits, PerfectHashIndexes<I...> >
+{
+public:
+
+    static const uint32_t MAX_DISPLACEMENTS = 1 << 16;
+    static const uint16_t EMPTY = 0xFFFF;
+    static const size_t KEYS = N;
+    static const size_t SIZE = Size;
+    static const size_t WORDS = (Size + 63) / 64;
+    static const size_t BUCKETS = perfectHashPowerOfTwo(N / 2);
+
+    static_assert(N > 0, "PerfectHash: no keys");
+    static_assert(N <= PERFECT_HASH_MAX_KEYS, "PerfectHash: too many keys, see PERFECT_HASH_MAX_KEYS");
+    static_assert(N <= Size, "PerfectHash: Size is below the number of keys");
+    static_assert((Size & (Size - 1)) == 0, "PerfectHash: Size is not a power of two");
+
+    static constexpr uint32_t getBucket(uint32_t hash)
+    {
+        return perfectHashMix(hash, 0) & (BUCKETS - 1);
+    }
+
+    static constexpr uint32_t getSlot(uint32_t hash, uint32_t displacement)
+    {
+        return perfectHashMix(hash, displacement) & (Size - 1);
+    }
+
+    /**
+     * The hashes are calculated once, FNV of a string is not cheap in a constexpr
+     */
+    static constexpr uint32_t hashes[N] = {KeyTraits::hash(Keys[I])...};
+    static constexpr uint32_t buckets[N] = {getBucket(hashes[I])...};
+};
+
+template<typename Key, size_t N, const Key (&Keys)[N], size_t Size, typename KeyTraits, size_t... I>
+constexpr uint32_t PerfectHashBuilder<Key, N, Keys, Size, KeyTraits, PerfectHashIndexes<I...> >::hashes[N];
+
+template<typename Key, size_t N, const Key (&Keys)[N], size_t Size, typename KeyTraits, size_t... I>
+constexpr uint32_t PerfectHashBuilder<Key, N, Keys, Size, KeyTraits, PerfectHashIndexes<I...> >::buckets[N];
+
+/**
+ * Groups of the keys - buckets, words of the bitmap. Groups[i] is the group of the key i
+ */
+template<size_t N, const uint32_t (&Groups)[N]>
+struct PerfectHashGroups
+{
+    /**
+     * Number of the keys [first, last) in the group
+     */
+    static constexpr size_t count(uint32_t group, size_t first, size_t last)
+    {
+        return (last - first == 0) ? 0 :
+            (last - first == 1) ? ((Groups[first] == group) ? 1 : 0) :
+            (count(group, first, (first + last) / 2) + count(group, (first + last) / 2, last));
+    }
+
+    /**
+     * Index of the n-th key of the group among the keys [first, last)
+     */
+    static constexpr size_t nth(uint32_t group, size_t n, size_t first, size_t last)
+    {
+        return (last - first == 1) ? first :
+            nthOr(count(group, first, (first + last) / 2), group, n, first, last);
+    }
+
+    static constexpr size_t nthOr(size_t left, uint32_t group, size_t n, size_t first, size_t last)
+    {
+        return (n < left) ? nth(group, n, first, (first + last) / 2) :
+            nth(group, n - left, (first + last) / 2, last);
+    }
+};
+
+/**
+ * Indexes of the keys in the group
+ */
+template<size_t N, const uint32_t (&Groups)[N], uint32_t Group,
+    typename Indexes = typename PerfectHashMakeIndexes<PerfectHashGroups<N, Groups>::count(Group, 0, N)>::Type>
+struct PerfectHashGroup;
+
+template<size_t N, const uint32_t (&Groups)[N], uint32_t Group, size_t... J>
+struct PerfectHashGroup<N, Groups, Group, PerfectHashIndexes<J...> >
+{
+    typedef PerfectHashIndexes<PerfectHashGroups<N, Groups>::nth(Group, J, 0, N)...> Type;
+};
+
+/**
+ * Slots of the keys of a bucket
+ */
+template<typename Builder, typename Keys>
+struct PerfectHashBucketSlots;
+
+template<typename Builder, size_t... K>
+struct PerfectHashBucketSlots<Builder, PerfectHashIndexes<K...> >
+{
+    static const size_t COUNT = sizeof...(K);
+    static constexpr size_t keys[COUNT + 1] = {K..., 0};
+
+    static constexpr uint32_t getSlot(uint32_t displacement, size_t key)
+    {
+        return Builder::getSlot(Builder::hashes[keys[key]], displacement);
+    }
+
+    static constexpr uint64_t getBit(size_t word, uint32_t slot)
+    {
+        return ((slot / 64) == word) ? ((uint64_t)1 << (slot % 64)) : 0;
+    }
+
+    /**
+     * The keys [key, COUNT) land in free slots, a key does not collide with the keys before it
+     */
+    template<typename Bitmap>
+    static constexpr bool fits(uint32_t displacement, size_t key)
+    {
+        return (key == COUNT) ? true :
+            (isFree<Bitmap>(getSlot(displacement, key)) && isUnique(displacement, key, 0) &&
+                fits<Bitmap>(displacement, key + 1));
+    }
+
+    template<typename Bitmap>
+    static constexpr bool isFree(uint32_t slot)
+    {
+        return (Bitmap::values[slot / 64] & getBit(slot / 64, slot)) == 0;
+    }
+
+    static constexpr bool isUnique(uint32_t displacement, size_t key, size_t other)
+    {
+        return (other == key) ? true :
+            ((getSlot(displacement, other) != getSlot(displacement, key)) && isUnique(displacement, key, other + 1));
+    }
+
+    /**
+     * Word 'word' of the bitmap and the slots of the keys [key, COUNT)
+     */
+    static constexpr uint64_t fill(uint32_t displacement, uint64_t bits, size_t word, size_t key)
+    {
+        return (key == COUNT) ? bits : fill(displacement, bits | getBit(word, getSlot(displacement, key)), word, key + 1);
+    }
+};
+
+template<typename Builder, size_t... K>
+constexpr size_t PerfectHashBucketSlots<Builder, PerfectHashIndexes<K...> >::keys[COUNT + 1];
+
+/**
+ * Place the bucket in the free slots and continue with the next bucket. Bitmap is the
+ * occupied slots, D are the displacements of the placed buckets
+ */
+template<typename Builder, size_t Bucket, typename Bitmap, typename Displacements,
+    bool Done = (Bucket == Builder::BUCKETS),
+    typename Keys = typename PerfectHashGroup<Builder::KEYS, Builder::buckets, Done ? 0 : Bucket>::Type,
+    typename Words = typename PerfectHashMakeIndexes<Builder::WORDS>::Type>
+struct PerfectHashPlace;
+
+template<typename Builder, size_t Bucket, uint64_t... W, uint32_t... D, typename Keys, size_t... I>
+struct PerfectHashPlace<Builder, Bucket, PerfectHashBitmap<W...>, PerfectHashDisplacements<D...>, false,
+    Keys, PerfectHashIndexes<I...> >
+{
+    typedef PerfectHashBucketSlots<Builder, Keys> Slots;
+    typedef PerfectHashBitmap<W...> Bitmap;
+
+    /**
+     * The first displacement in [first, last) which fits the bucket, MAX_DISPLACEMENTS if none
+     */
+    static constexpr uint32_t findDisplacement(uint32_t first, uint32_t last)
+    {
+        return (last - first == 1) ? (Slots::template fits<Bitmap>(first, 0) ? first : Builder::MAX_DISPLACEMENTS) :
+            findDisplacementOr(findDisplacement(first, first + (last - first) / 2), first + (last - first) / 2, last);
+    }
+
+    static constexpr uint32_t findDisplacementOr(uint32_t found, uint32_t first, uint32_t last)
+    {
+        return (found != Builder::MAX_DISPLACEMENTS) ? found : findDisplacement(first, last);
+    }
+
+    static constexpr uint32_t displacement = (Slots::COUNT == 0) ? 0 : findDisplacement(1, Builder::MAX_DISPLACEMENTS);
+
+    static_assert(displacement != Builder::MAX_DISPLACEMENTS, "PerfectHash: no displacement, increase Size");
+
+    typedef typename PerfectHashPlace<Builder, Bucket + 1, PerfectHashBitmap<Slots::fill(displacement, W, I, 0)...>,
+        PerfectHashDisplacements<D..., displacement> >::Displacements Displacements;
+};
+
+template<typename Builder, size_t Bucket, typename Bitmap, typename DisplacementsType, typename Keys, typename Words>
+struct PerfectHashPlace<Builder, Bucket, Bitmap, DisplacementsType, true, Keys, Words>
+{
+    typedef DisplacementsType Displacements;
+};
+
+/**
+ * Place all buckets and build the table of slots
+ */
+template<typename Builder, typename Bitmap = typename PerfectHashMakeIndexes<Builder::WORDS>::Type,
+    typename KeyIndexes = typename PerfectHashMakeIndexes<Builder::KEYS>::Type,
+    typename SlotIndexes = typename PerfectHashMakeIndexes<Builder::SIZE>::Type>
+struct PerfectHashTable;
+
+template<typename Builder, size_t... I, size_t... K, size_t... S>
+struct PerfectHashTable<Builder, PerfectHashIndexes<I...>, PerfectHashIndexes<K...>, PerfectHashIndexes<S...> >
+{
+    typedef typename PerfectHashPlace<Builder, 0, PerfectHashBitmap<((void)I, 0)...>,
+        PerfectHashDisplacements<> >::Displacements Displacements;
+
+    static constexpr uint32_t keySlots[Builder::KEYS] =
+        {Builder::getSlot(Builder::hashes[K], Displacements::values[Builder::buckets[K]])...};
+    static constexpr uint32_t keyWords[Builder::KEYS] = {(keySlots[K] / 64)...};
+
+    /**
+     * The slot is looked up among the keys in the same word of the bitmap
+     */
+    template<typename Keys> struct Word;
+
+    template<size_t... J> struct Word<PerfectHashIndexes<J...> >
+    {
+        static constexpr uint16_t getKey(uint32_t slot)
+        {
+            return getKey(slot, 0);
+        }
+
+        static constexpr uint16_t getKey(uint32_t slot, size_t key)
+        {
+            return (key == sizeof...(J)) ? Builder::EMPTY :
+                (keySlots[keys[key]] == slot) ? (uint16_t)keys[key] : getKey(slot, key + 1);
+        }
+
+        static constexpr size_t keys[sizeof...(J) + 1] = {J..., 0};
+    };
+
+    static constexpr uint16_t slots[Builder::SIZE] =
+        {Word<typename PerfectHashGroup<Builder::KEYS, keyWords, S / 64>::Type>::getKey(S)...};
+};
+
+template<typename Builder, size_t... I, size_t... K, size_t... S>
+constexpr uint32_t PerfectHashTable<Builder, PerfectHashIndexes<I...>, PerfectHashIndexes<K...>,
+    PerfectHashIndexes<S...> >::keySlots[Builder::KEYS];
+
+template<typename Builder, size_t... I, size_t... K, size_t... S>
+constexpr uint32_t PerfectHashTable<Builder, PerfectHashIndexes<I...>, PerfectHashIndexes<K...>,
+    PerfectHashIndexes<S...> >::keyWords[Builder::KEYS];
+
+template<typename Builder, size_t... I, size_t... K, size_t... S>
+template<size_t... J>
+constexpr size_t PerfectHashTable<Builder, PerfectHashIndexes<I...>, PerfectHashIndexes<K...>,
+    PerfectHashIndexes<S...> >::Word<PerfectHashIndexes<J...> >::keys[sizeof...(J) + 1];
+
+template<typename Builder, size_t... I, size_t... K, size_t... S>
+constexpr uint16_t PerfectHashTable<Builder, PerfectHashIndexes<I...>, PerfectHashIndexes<K...>,
+    PerfectHashIndexes<S...> >::slots[Builder::SIZE];
+
+template<typename Key, size_t N, const Key (&Keys)[N], size_t Size = perfectHashPowerOfTwo(2 * N),
+    typename KeyTraits = PerfectHashKey<Key> >
+class PerfectHash : protected PerfectHashBuilder<Key, N, Keys, Size, KeyTraits>
+{
+public:
+
+    /**
+     * Index of the key in the list of keys or -1
+     */
+    static constexpr int find(Key key)
+    {
+        return find(key, KeyTraits::hash(key));
+    }
+
+    static constexpr size_t getSize()
+    {
+        return Size;
+    }
+
+    static constexpr size_t getBuckets()
+    {
+        return Builder::BUCKETS;
+    }
+
+    /**
+     * Largest displacement - the number of attempts to place the hardest bucket
+     */
+    static constexpr uint32_t getMaxDisplacement()
+    {
+        return getMaxDisplacement(0, Builder::BUCKETS);
+    }
+
+protected:
+
+    typedef PerfectHashBuilder<Key, N, Keys, Size, KeyTraits> Builder;
+    typedef PerfectHashTable<Builder> Table;
+
+    static constexpr int find(Key key, uint32_t hash)
+    {
+        return check(Table::slots[Builder::getSlot(hash, Table::Displacements::values[Builder::getBucket(hash)])], key);
+    }
+
+    static constexpr int check(uint16_t slot, Key key)
+    {
+        return ((slot != Builder::EMPTY) && KeyTraits::equal(Keys[slot], key)) ? slot : -1;
+    }
+
+    static constexpr uint32_t getMaxDisplacement(size_t first, size_t last)
+    {
+        return (last - first == 1) ? Table::Displacements::values[first] :
+            maximum(getMaxDisplacement(first, (first + last) / 2), getMaxDisplacement((first + last) / 2, last));
+    }
+
+    static constexpr uint32_t maximum(uint32_t a, uint32_t b)
+    {
+        return (a > b) ? a : b;
+    }
+};
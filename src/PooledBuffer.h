@@ -0,0 +1,187 @@
+/**
+ * Reference counted buffer allocated from a MemoryPoolRaw (or MemoryPoolBitmap)
+ * The reference counter and a pointer to the pool which owns the block are kept
+ * in the first bytes of the block. A copy of a PooledBuffer adds a reference,
+ * destruction of the last copy returns the block to the pool. One received
+ * packet can be handed to several consumers without copying the data and without
+ * agreeing who frees the block.
+ *
+ * The reference counter is updated with atomic operations, the handles can be
+ * released from different threads. The pool is called only for the last
+ * reference, the pool's Lock shall be a real lock if the last release can happen
+ * in different threads.
+ *
+ * The pool pointer is optional. A buffer attached with pool nullptr (for example
+ * a static buffer) is reference counted, but never freed.
+ *
+ * The blocks shall be aligned at least to ALIGNMENT (the counter and the pointer
+ * are accessed atomically), allocate() fails if the pool returns a misaligned block.
+ *
+ * Example of usage:
+ *
+ *   typedef PooledBuffer<MemoryPoolRaw<LockDummy, 16> > MyBuffer;
+ *   MyBuffer buffer;
+ *   if (MyBuffer::allocate(myPool, &buffer)) {
+ *       memcpy(buffer.getData(), packet, size);
+ *       MyBuffer forLog = buffer;     // no copy of the data
+ *       MyBuffer forStats = buffer;
+ *   }                                 // the block is back in the pool
+ */
+
+#pragma once
+
+#include <atomic>
+
+struct PooledBufferHeader {
+    uint32_t refCount;
+    void* pool;
+};
+
+template<typename Pool> class PooledBuffer {
+
+public:
+
+    PooledBuffer() :
+        block(nullptr) {
+    }
+
+    PooledBuffer(const PooledBuffer& other) :
+        block(other.block) {
+        if (block != nullptr) {
+            addReference(block);
+        }
+    }
+
+    PooledBuffer(PooledBuffer&& other) :
+        block(other.block) {
+        other.block = nullptr;
+    }
+
+    PooledBuffer& operator=(const PooledBuffer& other) {
+        // release() clears the block of 'other' if this is a self assignment
+        uint8_t* otherBlock = other.block;
+        if (otherBlock != nullptr) {
+            addReference(otherBlock);
+        }
+        release();
+        block = otherBlock;
+        return *this;
+    }
+
+    ~PooledBuffer() {
+        release();
+    }
+
+    /**
+     * Allocate a block from the pool, the reference counter is one
+     */
+    static bool allocate(Pool& pool, PooledBuffer* buffer) {
+        uint8_t* block;
+        bool res = pool.allocate(&block);
+        if (res && !isAligned(block)) {
+            pool.free(block);
+            res = false;
+        }
+        if (res) {
+            attach(block, &pool);
+            buffer->release();
+            buffer->block = block;
+        }
+        return res;
+    }
+
+    /**
+     * Drop the reference. The last reference returns the block to the pool
+     */
+    void release() {
+        if (block != nullptr) {
+            releaseReference(block);
+            block = nullptr;
+        }
+    }
+
+    bool isValid() const {
+        return (block != nullptr);
+    }
+
+    uint8_t* getData() const {
+        return block + HEADER_SIZE;
+    }
+
+    /**
+     * Number of bytes available for the application in the block
+     */
+    size_t getSize() const {
+        Pool* pool = getPool(block);
+        return (pool != nullptr) ? (pool->getBlockSize() - HEADER_SIZE) : 0;
+    }
+
+    uint32_t getRefCount() const {
+        return getRefCount(block);
+    }
+
+    /**
+     * The API below works with raw blocks and is used by containers which keep
+     * the block pointer, for example BufferChain
+     */
+
+    /**
+     * Size of the header in the beginning of the block
+     */
+    static const size_t HEADER_SIZE = (sizeof(PooledBufferHeader) + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1);
+
+    /**
+     * Minimal alignment of the blocks in the pool
+     */
+    static const size_t ALIGNMENT = alignof(PooledBufferHeader);
+
+    static_assert((ALIGNMENT >= alignof(std::atomic<uint32_t>)) && (ALIGNMENT >= alignof(void*)),
+        "PooledBuffer: the header is not aligned for atomic access");
+    static_assert((HEADER_SIZE % ALIGNMENT) == 0, "PooledBuffer: the data is not aligned");
+
+    static bool isAligned(const uint8_t* block) {
+        return ((reinterpret_cast<uintptr_t>(block) % ALIGNMENT) == 0);
+    }
+
+    static void attach(uint8_t* block, Pool* pool) {
+        PooledBufferHeader* header = getHeader(block);
+        header->pool = pool;
+        __atomic_store_n(&header->refCount, 1, __ATOMIC_RELEASE);
+    }
+
+    static void addReference(uint8_t* block) {
+        __atomic_fetch_add(&getHeader(block)->refCount, 1, __ATOMIC_RELAXED);
+    }
+
+    /**
+     * @return true if this was the last reference and the block was returned to the pool
+     */
+    static bool releaseReference(uint8_t* block) {
+        PooledBufferHeader* header = getHeader(block);
+        uint32_t refCount = __atomic_sub_fetch(&header->refCount, 1, __ATOMIC_ACQ_REL);
+        if (refCount != 0) {
+            return false;
+        }
+        Pool* pool = getPool(block);
+        if (pool != nullptr) {
+            pool->free(block);
+        }
+        return true;
+    }
+
+    static uint32_t getRefCount(const uint8_t* block) {
+        return __atomic_load_n(&getHeader(block)->refCount, __ATOMIC_ACQUIRE);
+    }
+
+    static Pool* getPool(const uint8_t* block) {
+        return static_cast<Pool*>(getHeader(block)->pool);
+    }
+
+protected:
+
+    static PooledBufferHeader* getHeader(const uint8_t* block) {
+        return reinterpret_cast<PooledBufferHeader*>(const_cast<uint8_t*>(block));
+    }
+
+    uint8_t* block;
+};
@@ -96,7 +96,7 @@ public:
 
 private:
 
-    ObjectType* data;
+    ObjectType** data;
 };// class Stack
 
 template<typename ObjectType, typename Lock>
@@ -2,6 +2,7 @@
  * Pool for allocation of small (4 bytes) blocks
  * This code is a result of an interview question (see http://www.amazon.com/dp/B00WVDHP8E) 
  * and probably does not have many real life applications. The code is not thread safe.
+ * See IndexPool.h for a template version which supports objects of any size and many pools
  */
 
 #include <string>
@@ -53,8 +54,8 @@ uint32_t *fastPoolAllocate()
 void fastPoolFree(uint32_t *block)
 {
     uint32_t blockOffset = block-&fastPoolData[0];
-    fastPoolSetNext(blockOffset, fastPoolGetNext(fastPoolHead));
-    fastPoolSetNext(fastPoolHead, blockOffset);
+    fastPoolSetNext(blockOffset, fastPoolHead);
+    fastPoolHead = blockOffset;
 }
 
 void fastPoolPrint()
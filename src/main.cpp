@@ -15,6 +15,7 @@
 #include <limits>
 #include <atomic>
 #include <thread>
+#include <mutex>
 #include <cstdint>
 #include <memory>
 
@@ -24,6 +25,7 @@
 #endif
 
 #include <sys/time.h>
+#include <unistd.h>
 using namespace std;
 
 
@@ -37,6 +39,7 @@ using namespace std;
 #include "CyclicBufferSimple.h"
 #include "Stack.h"
 #include "Memory.h"
+#include "BufferChain.h"
 #include "HardwareC.h"
 #include "Hardware.h"
 #include "Timers.h"
@@ -44,10 +47,24 @@ using namespace std;
 #include "OpenMP.h"
 #include "Pipeline.h"
 #include "FixedPoint.h"
+#include "IndexPool.h"
+#include "EpochReclamation.h"
+#include "CompactingPool.h"
+#include "MemoryRegionFile.h"
 #endif
 
 #if (EXAMPLE == 10)
 #include "HashTable.h"
+#include "LockfreeHashTableResizable.h"
+#include "HashTableSwiss.h"
+#include "HashTableRobinHood.h"
+#include "HashTableStriped.h"
+#include "HashTableReadMostly.h"
+#include "HashTableFlat.h"
+#include "LockfreeHashTableMultiWriter.h"
+#include "HashTableImage.h"
+#include "PerfectHash.h"
+#include "HashTableCuckoo.h"
 #endif
 
 #if (EXAMPLE != 10)
@@ -359,29 +376,424 @@ int mainExample8() {
 }
 
 
-static uint8_t dmaMemoryDummy[512];
-static MemoryRegion dmaMemoryRegion("dmaMem", (uintptr_t)dmaMemoryDummy, sizeof(dmaMemoryDummy));
+typedef MemoryLayout<
+    MemoryPoolSpec<63, 7, 8>,
+    MemoryPoolSpec<256, 4, 32>
+> DmaMemoryLayout;
 
-static_assert((sizeof(dmaMemoryDummy) >= MemoryAllocatorRaw::predictMemorySize(63, 3, 2)), "DmaMemoryDummy region is not large enough");
-static MemoryAllocatorRaw dmaAllocator(dmaMemoryRegion, 63, 3, 2);
+static_assert((DmaMemoryLayout::SIZE <= 1536), "DMA memory layout is too large");
+// 7 blocks of 63 bytes aligned to 8 are 448 bytes, the second pool starts at the next 32 bytes boundary
+static_assert((DmaMemoryLayout::Entry<0>::OFFSET == 0), "DMA pool 0 shall start the region");
+static_assert((DmaMemoryLayout::Entry<0>::Spec::SIZE == 7 * 64), "DMA pool 0 blocks are not aligned");
+static_assert((DmaMemoryLayout::Entry<1>::OFFSET == 7 * 64), "DMA pool 1 shall follow pool 0");
+static_assert(((DmaMemoryLayout::Entry<1>::OFFSET % DmaMemoryLayout::Entry<1>::Spec::ALIGNMENT) == 0), "DMA pool 1 is not aligned");
+static_assert((DmaMemoryLayout::SIZE == DmaMemoryLayout::Entry<1>::OFFSET + 4 * 256), "DMA memory layout size is wrong");
+static_assert((DmaMemoryLayout::ALIGNMENT == 32), "DMA memory region shall be aligned to the largest pool alignment");
+static MemoryLayoutRegion<DmaMemoryLayout> dmaMemoryRegion("dmaMem");
 
-static MemoryPoolRaw<LockDummy, 7> dmaPool("dmaPool", dmaAllocator);
+static MemoryLayoutPool<DmaMemoryLayout, 0, LockDummy> dmaPool("dmaPool", dmaMemoryRegion);
+static MemoryLayoutPool<DmaMemoryLayout, 1, LockDummy, MemoryPoolBitmap> dmaPoolLarge("dmaPoolLarge", dmaMemoryRegion);
+
+/**
+ * Allocate all blocks of the pool I, the blocks shall be aligned and inside the sub-range
+ * of the pool in the region. Returns number of errors
+ */
+template<size_t I, typename Pool> static uint32_t testDmaPool(Pool& pool) {
+    typedef typename DmaMemoryLayout::template Entry<I> Entry;
+    const uintptr_t start = dmaMemoryRegion.getAddress() + Entry::OFFSET;
+    const uintptr_t end = start + Entry::Spec::SIZE;
+    uint8_t* blocks[Entry::Spec::COUNT];
+    uint32_t errors = 0;
+    for (size_t i = 0;i < Entry::Spec::COUNT;i++) {
+        errors += !pool.allocate(&blocks[i]);
+        const uintptr_t block = reinterpret_cast<uintptr_t>(blocks[i]);
+        cout << "\t" << i << " pool=" << I << " block=" << block << endl;
+        errors += (block < start) || ((block + Entry::Spec::BLOCK_SIZE) > end);
+        errors += ((block % Entry::Spec::ALIGNMENT) != 0);
+    }
+    uint8_t* block;
+    errors += pool.allocate(&block);
+    for (size_t i = 0;i < Entry::Spec::COUNT;i++) {
+        errors += !pool.free(blocks[i]);
+    }
+    return errors;
+}
 
 static int mainExample9() {
+    cout << "base=" << dmaMemoryRegion.getAddress() << ",size=" << dmaMemoryRegion.getSize() << endl;
+    uint32_t errors = 0;
+    errors += (dmaMemoryRegion.getSize() != DmaMemoryLayout::SIZE);
+    errors += ((dmaMemoryRegion.getAddress() % DmaMemoryLayout::ALIGNMENT) != 0);
+    errors += testDmaPool<0>(dmaPool);
+    errors += testDmaPool<1>(dmaPoolLarge);
+    cout << "DMA memory layout errors=" << errors << endl;
+    return errors;
+}
+
+static MemoryPool<LockDummy, BufferSegment, 16> bufferSegmentPool("bufferSegments");
+typedef BufferChain<MemoryLayoutPool<DmaMemoryLayout, 0, LockDummy>, MemoryPool<LockDummy, BufferSegment, 16> > DmaBufferChain;
+
+static void testBufferChain() {
+    const char payload[] = "payload of the packet which does not fit a single block\n";
+    DmaBufferChain packet(dmaPool, bufferSegmentPool, 16);
+    packet.append((const uint8_t*)payload, sizeof(payload)-1);
+    packet.prepend((const uint8_t*)"udp:", 4);
+    packet.prepend((const uint8_t*)"ip:", 3);
+
+    DmaBufferChain copy(dmaPool, bufferSegmentPool);
+    packet.clone(&copy);
+    DmaBufferChain tail(dmaPool, bufferSegmentPool);
+    copy.split(7, &tail);
+
+    struct iovec iov[8];
+    size_t count = packet.getIovec(iov, 8);
+    cout << "BufferChain size=" << packet.getSize() << ",segments=" << count << endl;
+    cout.flush();
+    writev(STDOUT_FILENO, iov, count);
+    count = tail.getIovec(iov, 8);
+    writev(STDOUT_FILENO, iov, count);
+}
+
+typedef PooledBuffer<decltype(dmaPool)> DmaBuffer;
+
+static void testPooledBuffer() {
+    uint32_t errors = 0;
+    uint32_t inUse = dmaPool.getStatistics().inUse;
+    {
+        DmaBuffer buffer;
+        errors += buffer.isValid();
+        errors += !DmaBuffer::allocate(dmaPool, &buffer);
+        errors += !buffer.isValid() || (buffer.getRefCount() != 1);
+        errors += (buffer.getSize() != (dmaPool.getBlockSize() - DmaBuffer::HEADER_SIZE));
+        memset(buffer.getData(), 0x5A, buffer.getSize());
+        DmaBuffer copy(buffer);
+        errors += (copy.getData() != buffer.getData()) || (buffer.getRefCount() != 2);
+        DmaBuffer moved(std::move(copy));
+        errors += copy.isValid() || (moved.getRefCount() != 2);
+        DmaBuffer assigned;
+        errors += !DmaBuffer::allocate(dmaPool, &assigned);
+        errors += (dmaPool.getStatistics().inUse != (inUse + 2));
+        // The block of 'assigned' returns to the pool
+        assigned = moved;
+        errors += (dmaPool.getStatistics().inUse != (inUse + 1)) || (buffer.getRefCount() != 3);
+        assigned = assigned;
+        errors += (buffer.getRefCount() != 3);
+        moved.release();
+        errors += moved.isValid() || (buffer.getRefCount() != 2);
+        // Allocate into a valid handle releases the old block
+        errors += !DmaBuffer::allocate(dmaPool, &assigned);
+        errors += (buffer.getRefCount() != 1) || (buffer.getData()[0] != 0x5A);
+    }
+    errors += (dmaPool.getStatistics().inUse != inUse);
+
+    // Blocks of 63 bytes without alignment - the second block is misaligned
+    typedef MemoryLayout<MemoryPoolSpec<63, 2, 1> > UnalignedLayout;
+    static MemoryLayoutRegion<UnalignedLayout> unalignedRegion("unalignedMem");
+    MemoryLayoutPool<UnalignedLayout, 0, LockDummy> unalignedPool("unaligned", unalignedRegion);
+    typedef PooledBuffer<decltype(unalignedPool)> UnalignedBuffer;
+    UnalignedBuffer buffer1, buffer2;
+    bool res = UnalignedBuffer::allocate(unalignedPool, &buffer1);
+    res = res && UnalignedBuffer::allocate(unalignedPool, &buffer2);
+    errors += res;
+    cout << "PooledBuffer errors=" << errors << endl;
+}
+
+/**
+ * Headroom which does not leave space for the data in the first block
+ */
+static void testBufferChainHeadroom() {
+    const size_t blockData = dmaPool.getBlockSize() - DmaBuffer::HEADER_SIZE;
+    const size_t headrooms[] = {blockData - 1, blockData, blockData + 1, 1000};
+    uint32_t errors = 0;
+    uint32_t inUse = dmaPool.getStatistics().inUse;
+    for (size_t headroom : headrooms) {
+        DmaBufferChain packet(dmaPool, bufferSegmentPool, headroom);
+        errors += (packet.getHeadroom() != (blockData - 1));
+        const uint8_t payload[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+        errors += !packet.append(payload, sizeof(payload));
+        errors += (packet.getSize() != sizeof(payload)) || (packet.getSegments() != 2);
+        struct iovec iov[2];
+        errors += (packet.getIovec(iov, 2) != 2) || (iov[0].iov_len != 1) || (memcmp(iov[1].iov_base, payload + 1, 7) != 0);
+        uint8_t* header;
+        errors += !packet.prepend(blockData - 1, &header);
+        errors += (packet.getSegments() != 2);
+    }
+    errors += (dmaPool.getStatistics().inUse != inUse);
+    cout << "BufferChain headroom errors=" << errors << endl;
+}
+
+/**
+ * The registry reports the pools declared above and a local pool with known usage
+ */
+static void testMemoryPoolReport() {
+    typedef MemoryLayout<MemoryPoolSpec<20, 4, 8> > ReportLayout;
+    static MemoryLayoutRegion<ReportLayout> reportRegion("reportMem");
+    MemoryLayoutPool<ReportLayout, 0, LockDummy> reportPool("reportPool", reportRegion);
+    uint8_t* blocks[3];
+    uint32_t errors = 0;
+    for (size_t i = 0;i < 3;i++) {
+        errors += !reportPool.allocate(&blocks[i]);
+    }
+    errors += !reportPool.free(blocks[1]);
+    uint8_t foreign[24];
+    errors += reportPool.free(foreign);
+
+    MemoryPoolBase::Report reports[32];
+    size_t count = MemoryPoolBase::getReports(reports, 32);
+    bool foundDma = false;
+    bool foundReport = false;
+    for (size_t i = 0;i < count;i++) {
+        const MemoryPoolBase::Report& report = reports[i];
+        cout << report.name << ": size=" << report.size << ",block=" << report.blockSize << "/" << report.alignedBlockSize
+            << ",inUse=" << report.statistics.inUse << ",maxInUse=" << report.statistics.maxInUse
+            << ",errAllocate=" << report.statistics.errAllocate << ",errBadBlock=" << report.statistics.errBadBlock
+            << ",wasted=" << report.bytesWasted << endl;
+        if (strcmp(report.name, "dmaPool") == 0) {
+            foundDma = true;
+            errors += (report.size != 7) || (report.blockSize != 63) || (report.alignedBlockSize != 64);
+            errors += (report.bytesWasted != 7) || (report.statistics.inUse != 0);
+        }
+        if (strcmp(report.name, "reportPool") == 0) {
+            foundReport = true;
+            errors += (report.size != 4) || (report.blockSize != 20) || (report.alignedBlockSize != 24);
+            errors += (report.bytesWasted != 16);
+            errors += (report.statistics.inUse != 2) || (report.statistics.maxInUse != 3);
+            errors += (report.statistics.errBadBlock != 1) || (report.statistics.errAllocate != 0);
+        }
+    }
+    errors += !foundDma || !foundReport;
+    cout << "MemoryPool report pools=" << count << ",errors=" << errors << endl;
+}
+
+/**
+ * Allocate all blocks, free and allocate again. Returns number of errors
+ */
+template<typename Pool, typename Block> static uint32_t testPoolCarving(Pool& pool, size_t blockSize, Block* foreign) {
+    static const size_t SIZE = 8;
+    Block* blocks[SIZE];
+    uint32_t errors = 0;
+    // The first block is carved, the second block is above the high-water mark
+    errors += !pool.allocate(&blocks[0]);
+    Block* notCarved = reinterpret_cast<Block*>(reinterpret_cast<uint8_t*>(blocks[0]) + blockSize);
+    errors += pool.free(notCarved);
+    errors += pool.free(foreign);
+    for (size_t i = 1;i < SIZE;i++) {
+        errors += !pool.allocate(&blocks[i]);
+        for (size_t j = 0;j < i;j++) {
+            errors += (blocks[i] == blocks[j]);
+        }
+    }
+    Block* block;
+    errors += pool.allocate(&block);
+    errors += !pool.free(blocks[3]);
+    errors += !pool.allocate(&block);
+    errors += (block != blocks[3]);
+    for (size_t i = 0;i < SIZE;i++) {
+        errors += !pool.free(blocks[i]);
+    }
+    for (size_t i = 0;i < SIZE;i++) {
+        errors += !pool.allocate(&block);
+        bool found = false;
+        for (size_t j = 0;j < SIZE;j++) {
+            found = found || (block == blocks[j]);
+        }
+        errors += !found;
+    }
+    errors += pool.allocate(&block);
+    errors += (pool.getStatistics().inUse != SIZE);
+    return errors;
+}
+
+static void testMemoryPoolCarving() {
+    typedef MemoryLayout<MemoryPoolSpec<24, 8, 8> > CarvingLayout;
+    static MemoryLayoutRegion<CarvingLayout> carvingRegion("carvingMem");
+    MemoryLayoutPool<CarvingLayout, 0, LockDummy> rawPool("carvingRaw", carvingRegion);
+    MemoryPool<LockDummy, uint64_t, 8> pool("carving");
+    MemoryPoolDynamic<LockDummy, uint64_t> dynamicPool(8, "carvingDynamic");
+    uint64_t foreign[2];
+
+    uint32_t errors = 0;
+    errors += testPoolCarving(rawPool, 24, (uint8_t*)foreign);
+    errors += testPoolCarving(pool, sizeof(uint64_t), foreign);
+    errors += testPoolCarving(dynamicPool, sizeof(uint64_t), foreign);
+    cout << "MemoryPool carving errors=" << errors << endl;
+}
+
+/**
+ * 4097 blocks are 65 leaf words and two summary words
+ */
+static uint32_t testBlockBitmap() {
+    static const size_t SIZE = 4097;
+    static BlockBitmap<SIZE> bitmap;
+    uint32_t errors = 0;
+    size_t index;
+    for (size_t i = 0;i < SIZE;i++) {
+        errors += !bitmap.allocate(&index);
+        errors += (index != i);
+    }
+    errors += bitmap.allocate(&index);
+    const size_t boundaries[] = {4096, 4095, 64, 63, 0};
+    for (size_t boundary : boundaries) {
+        bitmap.free(boundary);
+        errors += bitmap.isAllocated(boundary);
+    }
+    // The lowest free block first
+    const size_t expected[] = {0, 63, 64, 4095, 4096};
+    for (size_t boundary : expected) {
+        errors += !bitmap.allocate(&index);
+        errors += (index != boundary);
+        errors += !bitmap.isAllocated(boundary);
+    }
+    errors += bitmap.allocate(&index);
+    for (size_t i = 0;i < SIZE;i++) {
+        bitmap.free(i);
+    }
+    errors += !bitmap.allocate(&index);
+    errors += (index != 0);
+    return errors;
+}
 
+static void testMemoryPoolBitmap() {
+    static const size_t SIZE = 130;
+    typedef MemoryLayout<MemoryPoolSpec<8, SIZE, 8> > BitmapLayout;
+    static MemoryLayoutRegion<BitmapLayout> bitmapRegion("bitmapMem");
+    MemoryLayoutPool<BitmapLayout, 0, LockDummy, MemoryPoolBitmap> pool("bitmap", bitmapRegion);
+    uint8_t* blocks[SIZE];
+    uint32_t errors = testBlockBitmap();
+    for (size_t i = 0;i < SIZE;i++) {
+        errors += !pool.allocate(&blocks[i]);
+        errors += (blocks[i] != (blocks[0] + 8 * i));
+    }
     uint8_t* block;
-    cout << "base=" << reinterpret_cast<uintptr_t>(dmaMemoryDummy) << endl;
-    bool res;
-    for (int i = 0;i < 5;i++)
-    {
-        res = dmaPool.allocate(&block);
-        if (res) {
-            cout << "\t" << i << " block=" << reinterpret_cast<uintptr_t>(block) << endl;
-            dmaPool.free(block);
+    errors += pool.allocate(&block);
+    errors += !pool.free(blocks[64]);
+    errors += pool.free(blocks[64]);
+    errors += !pool.free(blocks[63]);
+    errors += pool.free(blocks[63] + 1);
+    uint64_t foreign;
+    errors += pool.free(reinterpret_cast<uint8_t*>(&foreign));
+    errors += !pool.allocate(&block);
+    errors += (block != blocks[63]);
+    errors += !pool.allocate(&block);
+    errors += (block != blocks[64]);
+    errors += pool.allocate(&block);
+    for (size_t i = 0;i < SIZE;i++) {
+        errors += !pool.free(blocks[i]);
+    }
+    const MemoryPoolBase::Statistics& statistics = pool.getStatistics();
+    errors += (statistics.inUse != 0) || (statistics.errBadBlock != 3) || (statistics.errAllocate != 2);
+    cout << "MemoryPoolBitmap errors=" << errors << endl;
+}
+
+static void testCompactingPool() {
+    struct Session {
+        uint32_t id;
+        uint32_t timeout;
+    };
+    typedef CompactingPool<Session, 64> SessionPool;
+    static SessionPool sessionPool;
+    SessionPool::Handle handles[64];
+    for (uint32_t i = 0;i < 64;i++) {
+        sessionPool.allocate(&handles[i]);
+        sessionPool.get(handles[i])->id = i;
+    }
+    // Keep every fourth session
+    for (uint32_t i = 0;i < 64;i++) {
+        if ((i % 4) != 0) {
+            sessionPool.free(handles[i]);
         }
     }
+    cout << "CompactingPool count=" << sessionPool.getCount() << ",holes=" << sessionPool.getHoles();
+    size_t moves = 0;
+    while (!sessionPool.isCompact()) {
+        moves += sessionPool.compact(4);
+    }
+    bool ok = true;
+    for (uint32_t i = 0;i < 64;i += 4) {
+        ok = ok && (sessionPool.get(handles[i])->id == i);
+    }
+    uint_fast32_t index = 0;
+    Session* session;
+    uint32_t sessions = 0;
+    while (sessionPool.getNext(index, &session) == SessionPool::GETNEXT_OK) {
+        ok = ok && (index == sessions);
+        sessions++;
+        index++;
+    }
+    cout << ",moves=" << moves << ",holes=" << sessionPool.getHoles() << ",sessions=" << sessions << ",ok=" << ok << endl;
+}
 
-    return 0;
+/**
+ * Readers dereference the current configuration while the writer replaces it.
+ * Only the writer thread calls the pool, the pool does not need a lock
+ */
+struct EpochConfiguration {
+    uint32_t version;
+    uint32_t checksum;
+};
+typedef MemoryPool<LockDummy, EpochConfiguration, 32> EpochConfigurationPool;
+static EpochConfigurationPool epochConfigurationPool("epochConfigurations");
+
+static void testEpochReclamation() {
+    typedef EpochReclamation<EpochConfiguration, EpochConfigurationPool, 8, 8> ConfigurationReclamation;
+    ConfigurationReclamation reclamation(epochConfigurationPool);
+    std::atomic<EpochConfiguration*> configuration(nullptr);
+    std::atomic<bool> done(false);
+    std::atomic<uint32_t> errors(0);
+
+    auto reader = [&]() {
+        while (!done.load()) {
+            ConfigurationReclamation::Guard guard(reclamation);
+            if (!guard.isActive()) {
+                errors++;
+                break;
+            }
+            EpochConfiguration* current = configuration.load(std::memory_order_acquire);
+            if ((current != nullptr) && (current->checksum != ~current->version)) {
+                errors++;
+            }
+        }
+    };
+    std::thread reader1(reader);
+    std::thread reader2(reader);
+
+    uint32_t replaced = 0;
+    for (uint32_t version = 0;version < 10000;version++) {
+        EpochConfiguration* next;
+        while (!epochConfigurationPool.allocate(&next)) {
+            reclamation.reclaim();
+        }
+        next->version = version;
+        next->checksum = ~version;
+        EpochConfiguration* previous = configuration.exchange(next, std::memory_order_acq_rel);
+        if (previous != nullptr) {
+            while (!reclamation.retire(previous)) {
+                reclamation.reclaim();
+            }
+            replaced++;
+        }
+    }
+    done.store(true);
+    reader1.join();
+    reader2.join();
+    EpochConfiguration* last = configuration.load();
+    epochConfigurationPool.free(last);
+
+    // Short living threads reuse the indexes of the exited threads
+    for (uint32_t i = 0;i < 200;i++) {
+        std::thread worker([&]() {
+            ConfigurationReclamation::Guard guard(reclamation);
+            if (!guard.isActive()) {
+                errors++;
+            }
+        });
+        worker.join();
+    }
+
+    const ConfigurationReclamation::Statistics& statistics = reclamation.getStatistics();
+    errors += statistics.threadsOverflow.load();
+    cout << "EpochReclamation replaced=" << replaced << ",errors=" << errors.load()
+        << ",epochs=" << statistics.epochAdvance << ",retireFailed=" << statistics.retireFailed << endl;
 }
 
 
@@ -1030,6 +1442,118 @@ enum class LetterType {
 
 #include "fastpool.h"
 
+struct IndexPoolObject {
+    uint32_t id;
+    uint32_t data;
+};
+
+static IndexPool<IndexPoolObject, 7, true> myIndexPool;
+
+static void testIndexPool()
+{
+    typedef IndexPool<IndexPoolObject, 7, true>::Handle Handle;
+    uint32_t errors = 0;
+    Handle h1, h2, h3;
+    errors += !myIndexPool.allocate(&h1);
+    errors += !myIndexPool.allocate(&h2);
+    errors += !myIndexPool.allocate(&h3);
+    errors += (h1 == h2) || (h2 == h3) || (h1 == h3);
+    errors += (myIndexPool.get(h1) == nullptr) || (myIndexPool.get(h1) == myIndexPool.get(h2));
+    cout << "IndexPool h1=" << hex << h1 << ",h2=" << h2 << ",h3=" << h3 << dec << endl;
+    IndexPoolObject* object2 = myIndexPool.get(h2);
+    errors += !myIndexPool.free(h2);
+    if (myIndexPool.get(h2) != nullptr)
+    {
+        cout << "IndexPool stale handle is not detected " << hex << h2 << dec << endl;
+        errors++;
+    }
+    errors += myIndexPool.free(h2);
+    // The free object is reused with a new generation
+    Handle h4;
+    errors += !myIndexPool.allocate(&h4);
+    errors += (h4 == h2) || (myIndexPool.get(h4) != object2) || (myIndexPool.get(h2) != nullptr);
+    errors += (myIndexPool.getCount() != 3);
+    cout << "IndexPool h4=" << hex << h4 << dec << ",count=" << myIndexPool.getCount() << endl;
+    Handle handles[4];
+    for (int i = 0;i < 4;i++)
+    {
+        errors += !myIndexPool.allocate(&handles[i]);
+    }
+    Handle h5;
+    errors += myIndexPool.allocate(&h5);
+    errors += myIndexPool.free(IndexPool<IndexPoolObject, 7, true>::ILLEGAL_HANDLE);
+    for (int i = 0;i < 4;i++)
+    {
+        errors += !myIndexPool.free(handles[i]);
+    }
+    errors += !myIndexPool.free(h1);
+    errors += !myIndexPool.free(h3);
+    errors += !myIndexPool.free(h4);
+    errors += (myIndexPool.getCount() != 0);
+
+    // Without generations a double free is detected only in the debug build
+    static IndexPool<IndexPoolObject, 7> plainIndexPool;
+    Handle h6 = IndexPool<IndexPoolObject, 7>::ILLEGAL_HANDLE;
+    errors += !plainIndexPool.allocate(&h6);
+    errors += !plainIndexPool.free(h6);
+#ifndef NDEBUG
+    errors += plainIndexPool.free(h6);
+#endif
+    errors += (plainIndexPool.getCount() != 0);
+    cout << "IndexPool errors=" << errors << endl;
+}
+
+/**
+ * Build a pool in a file, remap the file and find the pool and the objects by offsets
+ */
+static void testMemoryRegionFile()
+{
+    typedef IndexPool<IndexPoolObject, 64, true> RegionPool;
+    const char* path = "/tmp/emcpp_region.bin";
+    const uint32_t LAYOUT_VERSION = 1;
+    const size_t REGION_SIZE = 4096;
+    static_assert(sizeof(RegionPool) <= REGION_SIZE, "Region is too small for the pool");
+    uint32_t errors = 0;
+    RegionPool::Handle handles[8];
+    unlink(path);
+    {
+        MemoryRegionFile region("poolRegion", path, REGION_SIZE, LAYOUT_VERSION);
+        errors += !region.isMapped() || region.isRestored();
+        RegionPool* pool = new (reinterpret_cast<void*>(region.getAddress())) RegionPool();
+        for (uint32_t i = 0;i < 8;i++)
+        {
+            errors += !pool->allocate(&handles[i]);
+            pool->get(handles[i])->id = i;
+        }
+        pool->free(handles[3]);
+        region.setRoot(region.getOffset(pool));
+        errors += !region.sync();
+    }
+    {
+        MemoryRegionFile region("poolRegion", path, REGION_SIZE, LAYOUT_VERSION);
+        errors += !region.isRestored();
+        RegionPool* pool = region.getPointer<RegionPool>(region.getRoot());
+        errors += (pool->getCount() != 7) || (pool->get(handles[3]) != nullptr);
+        for (uint32_t i = 0;i < 8;i++)
+        {
+            errors += (i != 3) && ((pool->get(handles[i]) == nullptr) || (pool->get(handles[i])->id != i));
+        }
+        // Modified and not synced - the next process shall not restore the region
+        RegionPool::Handle handle;
+        errors += !pool->allocate(&handle);
+    }
+    {
+        MemoryRegionFile region("poolRegion", path, REGION_SIZE, LAYOUT_VERSION);
+        errors += region.isRestored();
+    }
+    {
+        MemoryRegionFile region("poolRegion", path, REGION_SIZE, LAYOUT_VERSION + 1);
+        errors += region.isRestored();
+    }
+    unlink(path);
+    cout << "MemoryRegionFile errors=" << errors << endl;
+}
+
 /**
  * return size if Ok
  */
@@ -1210,6 +1734,227 @@ static void hashTableTest(void)
 }
 
 
+/**
+ * Objects "o0", "o1", ... for the tests of the hash tables
+ */
+template<int Objects> struct MyHashObjects
+{
+    MyHashObjects()
+    {
+        for (int i = 0;i < Objects;i++)
+        {
+            sprintf(names[i], "o%d", i);
+            objects[i] = new MyHashObject(names[i]);
+        }
+    }
+
+    ~MyHashObjects()
+    {
+        for (int i = 0;i < Objects;i++)
+        {
+            delete objects[i];
+        }
+    }
+
+    char names[Objects][8];
+    MyHashObject *objects[Objects];
+};
+
+/**
+ * Insert all objects, remove the even objects, search all objects and count the objects
+ * with getNext(). The table calls check(i) after the object i is inserted. Returns the
+ * number of errors
+ */
+template<typename HashTableType, int Objects, typename Check>
+static int hashTableRemoveEvenTest(HashTableType *hashTable, MyHashObjects<Objects> &fixture,
+    uint_fast32_t maxSize, Check check)
+{
+    int errors = 0;
+    for (int i = 0;i < Objects;i++)
+    {
+        MyHashObject *o = fixture.objects[i];
+        if (hashTable->insert(MyHashObject::getKey(o), o, maxSize) != HashTableType::INSERT_DONE)
+            errors++;
+        errors += check(i);
+    }
+    for (int i = 0;i < Objects;i += 2)
+    {
+        if (!hashTable->remove(fixture.names[i]))
+            errors++;
+    }
+    for (int i = 0;i < Objects;i++)
+    {
+        MyHashObject *po;
+        bool found = hashTable->search(fixture.names[i], &po);
+        if ((found != ((i & 1) != 0)) || (found && (po != fixture.objects[i])))
+            errors++;
+    }
+    uint_fast32_t index = 0;
+    MyHashObject *po;
+    uint_fast32_t count = 0;
+    while (hashTable->getNext(index, &po) != HashTableType::GETNEXT_END_TABLE)
+    {
+        count++;
+        index++;
+    }
+    if ((count != hashTable->getCount()) || (count != (Objects / 2)))
+        errors++;
+    return errors;
+}
+
+/**
+ * The table grows while the objects are inserted, a few entries are moved by every call
+ */
+static void hashTableIncrementalRehashTest(void)
+{
+    static const int OBJECTS = 1000;
+    MyHashObjects<OBJECTS> fixture;
+    MyHashTable *hashTable = MyHashTable::create("myHashTableIncremental", 64);
+    hashTable->setRehashStep(4);
+    int rehashing = 0;
+    int errors = hashTableRemoveEvenTest(hashTable, fixture, 64*OBJECTS, [&](int i)
+    {
+        if (hashTable->isRehashing())
+            rehashing++;
+        // All inserted objects are found during the rehash
+        MyHashObject *po;
+        int j = i / 2;
+        return (!hashTable->search(fixture.names[j], &po) || (po != fixture.objects[j])) ? 1 : 0;
+    });
+    // The table grows only by incremental rehash
+    const MyHashTable::Statistics *statistics = hashTable->getStatistics();
+    if ((statistics->rehashTotal == 0) || (statistics->rehashTotal != statistics->rehashIncremental))
+        errors++;
+    cout << "hashTableIncrementalRehashTest size=" << hashTable->getSize() << ",count=" << hashTable->getCount()
+        << ",rehash=" << statistics->rehashTotal << ",incremental=" << statistics->rehashIncremental
+        << ",rehashing=" << rehashing << ",stalled=" << statistics->rehashCollision << ",errors=" << errors << endl;
+    MyHashTable::destroy(hashTable);
+}
+
+typedef HashTableSwiss<struct MyHashObject*, const char*, LockDummy, AllocatorTrivial, struct MyHashObject, struct MyHashObject> MyHashTableSwiss;
+
+static void hashTableSwissTest(void)
+{
+    static const int OBJECTS = 1000;
+    MyHashObjects<OBJECTS> fixture;
+    MyHashTableSwiss *hashTable = MyHashTableSwiss::create("myHashTableSwiss", 16);
+    int errors = hashTableRemoveEvenTest(hashTable, fixture, 4*OBJECTS, [](int i) { return 0; });
+    if (hashTable->insert(fixture.names[1], fixture.objects[1]) != MyHashTableSwiss::INSERT_DUPLICATE)
+        errors++;
+    cout << "hashTableSwissTest size=" << hashTable->getSize() << ",count=" << hashTable->getCount()
+        << ",errors=" << errors << endl;
+    MyHashTableSwiss::destroy(hashTable);
+}
+
+
+/**
+ * Keep inserting and removing distinct keys in a table of a fixed size. The removed
+ * keys leave deleted slots in the full groups, the table shall not grow
+ */
+static void hashTableSwissChurnTest(void)
+{
+    static const int KEYS = 5000;
+    static const int FILL = 440;
+    static const int WINDOW = 300;
+    MyHashObjects<KEYS> fixture;
+    MyHashTableSwiss *hashTable = MyHashTableSwiss::create("myHashTableSwissChurn", FILL);
+    uint_fast32_t size = hashTable->getSize();
+    int errors = 0;
+    for (int i = 0;i < FILL;i++)
+    {
+        MyHashObject *o = fixture.objects[i];
+        if (hashTable->insert(MyHashObject::getKey(o), o, 4*KEYS) != MyHashTableSwiss::INSERT_DONE)
+            errors++;
+    }
+    for (int i = 0;i < (FILL - WINDOW);i++)
+    {
+        if (!hashTable->remove(fixture.names[i]))
+            errors++;
+    }
+    for (int i = FILL;i < (20 * KEYS);i++)
+    {
+        MyHashObject *o = fixture.objects[i % KEYS];
+        if (hashTable->insert(MyHashObject::getKey(o), o, 4*KEYS) != MyHashTableSwiss::INSERT_DONE)
+            errors++;
+        if (!hashTable->remove(fixture.names[(i - WINDOW) % KEYS]))
+            errors++;
+    }
+    if ((hashTable->getCount() != WINDOW) || (hashTable->getSize() != size))
+        errors++;
+    cout << "hashTableSwissChurnTest size=" << hashTable->getSize() << ",count=" << hashTable->getCount()
+        << ",rehash=" << hashTable->getStatistics()->rehashTotal << ",errors=" << errors << endl;
+    MyHashTableSwiss::destroy(hashTable);
+}
+
+
+typedef HashTableRobinHood<struct MyHashObject*, const char*, LockDummy, AllocatorTrivial, struct MyHashObject, struct MyHashObject> MyHashTableRobinHood;
+
+/**
+ * The key is the object and the home slot is the low byte of the key
+ */
+struct MyRobinHoodKey
+{
+    static bool equal(uint32_t object, uint32_t key)
+    {
+        return (object == key);
+    }
+
+    static uint32_t getKey(uint32_t object)
+    {
+        return object;
+    }
+
+    static uint_fast32_t hash(uint32_t key)
+    {
+        return key & 0xFF;
+    }
+};
+
+typedef HashTableRobinHood<uint32_t, uint32_t, LockDummy, AllocatorTrivial, MyRobinHoodKey, MyRobinHoodKey> MyHashTableRobinHoodKeys;
+
+/**
+ * Fill the table to 88%, the longest probe sequence shall stay short. The objects
+ * out of the home slot are counted when they are displaced and when they are shifted back
+ */
+static void hashTableRobinHoodTest(void)
+{
+    static const int OBJECTS = 900;
+    static const uint_fast32_t MAX_PROBE_LENGTH = 24;
+    MyHashObjects<OBJECTS> fixture;
+    MyHashTableRobinHood *hashTable = MyHashTableRobinHood::create("myHashTableRobinHood", OBJECTS);
+    // The table does not grow
+    uint_fast32_t size = hashTable->getSize();
+    int errors = hashTableRemoveEvenTest(hashTable, fixture, size, [](int i) { return 0; });
+    if (hashTable->insert(fixture.names[1], fixture.objects[1]) != MyHashTableRobinHood::INSERT_DUPLICATE)
+        errors++;
+    uint_fast32_t maxProbeLength = hashTable->getMaxProbeLength();
+    if ((maxProbeLength > MAX_PROBE_LENGTH) || (hashTable->getSize() != size))
+        errors++;
+
+    // Home slots 0, 1, 0: the third key displaces the second key
+    MyHashTableRobinHoodKeys *keys = MyHashTableRobinHoodKeys::create("myHashTableRobinHoodKeys", 16);
+    const uint32_t homeSlots[] = {0x100, 0x101, 0x200};
+    for (uint32_t key : homeSlots)
+    {
+        if (keys->insert(key, key) != MyHashTableRobinHoodKeys::INSERT_DONE)
+            errors++;
+    }
+    uint_fast32_t collisions = keys->getCollisionsInTheTable();
+    if ((collisions != 2) || (keys->getMaxProbeLength() != 2))
+        errors++;
+    if (!keys->remove(0x200) || (keys->getCollisionsInTheTable() != 0))
+        errors++;
+    uint32_t value;
+    if (!keys->search(0x101, &value) || (value != 0x101))
+        errors++;
+    MyHashTableRobinHoodKeys::destroy(keys);
+
+    cout << "hashTableRobinHoodTest size=" << hashTable->getSize() << ",maxProbeLength=" << maxProbeLength
+        << ",count=" << hashTable->getCount() << ",collisions=" << collisions << ",errors=" << errors << endl;
+    MyHashTableRobinHood::destroy(hashTable);
+}
+
+
 typedef LockfreeHashTable<uint32_t, (uint32_t)-1, uint32_t, (uint32_t)-1, AllocatorTrivial, HashTrivial> MyLockfreeHashTable;
 
 #define HASHTABLE_BITS 8
@@ -1285,6 +2030,1152 @@ static int lockfreeHashTableSpeedTest(size_t loops)
         }
     }
 	MyLockfreeHashTable::destroy(hashTable);
+    return 0;
+}
+
+typedef LockfreeHashTableResizable<uint32_t, (uint32_t)-1, uint32_t, (uint32_t)-1, AllocatorTrivial, HashTrivial, (uint32_t)-2> MyLockfreeHashTableResizable;
+
+/**
+ * Threads insert, search and remove keys while the table grows from 16 entries
+ */
+static int lockfreeHashTableResizableTest(int cpus, uint32_t keys)
+{
+    MyLockfreeHashTableResizable *hashTable = MyLockfreeHashTableResizable::create("myHashTableResizable", 4, 20);
+    std::atomic<uint32_t> errors(0);
+    std::thread threads[8];
+    cpus = std::min(cpus, 8);
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu] = std::thread([hashTable, &errors, cpu, keys]()
+        {
+            uint32_t first = cpu * keys;
+            for (uint32_t key = first;key < (first + keys);key++)
+            {
+                if (hashTable->insert(key, key) != MyLockfreeHashTableResizable::INSERT_DONE)
+                    errors++;
+                uint32_t value;
+                if (!hashTable->search(key, &value) || (value != key))
+                    errors++;
+            }
+            for (uint32_t key = first;key < (first + keys);key += 2)
+            {
+                uint32_t value;
+                if (!hashTable->remove(key, &value) || (value != key))
+                    errors++;
+            }
+            for (uint32_t key = first;key < (first + keys);key++)
+            {
+                uint32_t value;
+                bool found = hashTable->search(key, &value);
+                if (found != ((key & 1) != 0))
+                    errors++;
+            }
+        });
+    }
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu].join();
+    }
+    // The count and the statistics are exact, the odd keys remain
+    const MyLockfreeHashTableResizable::Statistics *statistics = hashTable->getStatistics();
+    if ((hashTable->getCount() != (cpus * keys / 2)) || (statistics->insertOk != (uint64_t)(cpus * keys)))
+        errors++;
+    cout << "lockfreeHashTableResizableTest size=" << hashTable->getSize() << ",count=" << hashTable->getCount()
+        << ",resize=" << statistics->rehashDone << ",errors=" << errors.load() << endl;
+    MyLockfreeHashTableResizable::destroy(hashTable);
+    return (errors.load() == 0);
+}
+
+/**
+ * Insert and remove distinct keys in a small table. The removed keys shall not fill
+ * the table, every thread keeps a window of live keys
+ */
+static int lockfreeHashTableResizableChurnTest(int cpus, uint32_t keys)
+{
+    MyLockfreeHashTableResizable *hashTable = MyLockfreeHashTableResizable::create("myHashTableChurn", 4, 10);
+    std::atomic<uint32_t> errors(0);
+    std::thread threads[8];
+    cpus = std::min(cpus, 8);
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu] = std::thread([hashTable, &errors, cpu, keys]()
+        {
+            const uint32_t WINDOW = 16;
+            uint32_t first = cpu * keys;
+            for (uint32_t key = first;key < (first + keys);key++)
+            {
+                if (hashTable->insert(key, key) != MyLockfreeHashTableResizable::INSERT_DONE)
+                    errors++;
+                if (key >= (first + WINDOW))
+                {
+                    uint32_t value;
+                    if (!hashTable->remove(key - WINDOW, &value) || (value != (key - WINDOW)))
+                        errors++;
+                }
+            }
+            for (uint32_t key = first + keys - WINDOW;key < (first + keys);key++)
+            {
+                uint32_t value;
+                if (!hashTable->search(key, &value) || (value != key))
+                    errors++;
+                if (!hashTable->remove(key, &value))
+                    errors++;
+            }
+        });
+    }
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu].join();
+    }
+    if ((hashTable->getCount() != 0) || (hashTable->getSize() > 1024))
+        errors++;
+    const MyLockfreeHashTableResizable::Statistics *statistics = hashTable->getStatistics();
+    cout << "lockfreeHashTableResizableChurnTest size=" << hashTable->getSize() << ",count=" << hashTable->getCount()
+        << ",resize=" << statistics->rehashDone << ",insertFailed=" << statistics->insertFailed << ",errors=" << errors.load() << endl;
+    MyLockfreeHashTableResizable::destroy(hashTable);
+    return (errors.load() == 0);
+}
+
+static const uint32_t HASH_TEST_KEYS = 1 << 18;
+static const uint32_t HASH_TEST_BUCKETS = 1 << 16;
+
+/**
+ * Hash the keys into HASH_TEST_BUCKETS buckets using the low bits of the hash like the tables do.
+ * For a uniform hash chi-square divided by the number of buckets is close to 1
+ */
+template<enum HashFunction Function>
+static void hashFunctionTest(const char *name, const uint8_t *keys, size_t keySize)
+{
+    static uint32_t buckets[HASH_TEST_BUCKETS];
+    memset(buckets, 0, sizeof(buckets));
+    struct timeval start, end;
+    gettimeofday(&start, nullptr);
+    for (uint32_t i = 0;i < HASH_TEST_KEYS;i++)
+    {
+        uint_fast32_t hash = HashFunctionSelector<Function>::hash(&keys[i * keySize], keySize);
+        buckets[hash & (HASH_TEST_BUCKETS - 1)]++;
+    }
+    gettimeofday(&end, nullptr);
+    double expected = (double)HASH_TEST_KEYS / HASH_TEST_BUCKETS;
+    double chiSquare = 0;
+    uint32_t maxBucket = 0;
+    for (uint32_t i = 0;i < HASH_TEST_BUCKETS;i++)
+    {
+        double diff = buckets[i] - expected;
+        chiSquare += (diff * diff) / expected;
+        maxBucket = std::max(maxBucket, buckets[i]);
+    }
+    uint64_t micros = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+    cout << name << " keySize=" << keySize << ",chiSquare/buckets=" << (chiSquare / HASH_TEST_BUCKETS)
+        << ",maxBucket=" << maxBucket << ",nanos/key=" << ((micros * 1000.0) / HASH_TEST_KEYS) << endl;
+}
+
+static void hashFunctionsTest(const char *keysName, const uint8_t *keys, size_t keySize)
+{
+    cout << "hashFunctionsTest " << keysName << endl;
+    hashFunctionTest<HASH_ONE_AT_A_TIME>("oneAtATime", keys, keySize);
+    hashFunctionTest<HASH_CRC32C>("crc32c", keys, keySize);
+    hashFunctionTest<HASH_WY>("wy", keys, keySize);
+    // Longer keys would measure hashWy again
+    if (keySize <= sizeof(uint64_t))
+    {
+        hashFunctionTest<HASH_MULTIPLICATIVE>("multiplicative", keys, keySize);
+    }
+}
+
+/**
+ * Integers with zero low bits and strings which differ in the last characters
+ */
+static void hashFunctionsTest(void)
+{
+    const char *check = "123456789";
+    uint32_t crc = hashCrc32c((const uint8_t*)check, strlen(check));
+    int errors = (crc == 0xE3069283) ? 0 : 1;
+    // The software and the CPU instruction agree for all tails
+    static const char *text = "The quick brown fox jumps over the lazy dog";
+    for (size_t len = 0;len <= strlen(text);len++)
+    {
+        uint32_t expected = ~hashCrc32cSoftware((const uint8_t*)text, len, ~(uint32_t)len);
+        if (hashCrc32c((const uint8_t*)text, len, len) != expected)
+            errors++;
+    }
+    cout << "crc32c check " << ((errors == 0) ? "Ok" : "failed") << ",hardware=" << hashCrc32cHardware() << endl;
+
+    static uint64_t integers[HASH_TEST_KEYS];
+    for (uint32_t i = 0;i < HASH_TEST_KEYS;i++)
+    {
+        integers[i] = (uint64_t)i << 12;
+    }
+    hashFunctionsTest("integers", (const uint8_t*)integers, sizeof(integers[0]));
+
+    static char strings[HASH_TEST_KEYS][24];
+    memset(strings, 0, sizeof(strings));
+    for (uint32_t i = 0;i < HASH_TEST_KEYS;i++)
+    {
+        sprintf(strings[i], "session.name.%u", i);
+    }
+    hashFunctionsTest("strings", (const uint8_t*)strings, sizeof(strings[0]));
+}
+
+/**
+ * Compare search() in a loop with searchBatch() for a table which does not fit the cache
+ */
+static int searchBatchTest(void)
+{
+    const int bits = 22;
+    const uint32_t keysCount = 1 << 20;
+    const size_t batch = 32;
+    uint32_t *keys = new uint32_t[keysCount];
+    uint32_t *results = new uint32_t[keysCount];
+    int errors = 0;
+
+    MyLockfreeHashTable *lockfreeHashTable = MyLockfreeHashTable::create("searchBatch", bits);
+    uint32_t inserted = 0;
+    for (uint32_t i = 0;i < keysCount;i++)
+    {
+        uint32_t key = hashMultiplicative(i);
+        if ((key != (uint32_t)-1) && (lockfreeHashTable->insert(key, i) == MyLockfreeHashTable::INSERT_DONE))
+        {
+            keys[inserted] = key;
+            inserted++;
+        }
+    }
+    // Random order of lookups
+    for (uint32_t i = inserted - 1;i > 0;i--)
+    {
+        std::swap(keys[i], keys[hashMultiplicative(i) % (i + 1)]);
+    }
+
+    struct timeval start, end;
+    gettimeofday(&start, nullptr);
+    for (uint32_t i = 0;i < inserted;i++)
+    {
+        lockfreeHashTable->search(keys[i], &results[i]);
+    }
+    gettimeofday(&end, nullptr);
+    uint64_t microsSearch = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+
+    gettimeofday(&start, nullptr);
+    size_t found = 0;
+    for (uint32_t i = 0;i < inserted;i += batch)
+    {
+        size_t count = std::min((size_t)(inserted - i), batch);
+        found += lockfreeHashTable->searchBatch(&keys[i], count, &results[i]);
+    }
+    gettimeofday(&end, nullptr);
+    uint64_t microsBatch = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+    for (uint32_t i = 0;i < inserted;i++)
+    {
+        if (hashMultiplicative(results[i]) != keys[i])
+            errors++;
+    }
+    if (found != inserted)
+        errors++;
+    lockfreeHashTable->remove(keys[0], nullptr);
+    if (lockfreeHashTable->searchBatch(keys, 1, results) != 0)
+        errors++;
+    MyLockfreeHashTable::destroy(lockfreeHashTable);
+
+    // HashTable, keys in the current table and in the table being rehashed
+    static char names[64][8];
+    MyHashTable *hashTable = MyHashTable::create("searchBatch", 1024);
+    hashTable->setRehashStep(1);
+    const char *nameKeys[65];
+    MyHashObject *objects[65];
+    for (int i = 0;i < 64;i++)
+    {
+        sprintf(names[i], "n%d", i);
+        nameKeys[i] = names[i];
+        hashTable->insert(names[i], new MyHashObject(names[i]));
+        if (i == 32)
+            hashTable->rehashIncremental(4096);
+    }
+    nameKeys[64] = "missing";
+    if (hashTable->searchBatch(nameKeys, 65, objects) != 64)
+        errors++;
+    for (int i = 0;i < 64;i++)
+    {
+        if ((objects[i] == nullptr) || strcmp(objects[i]->name, names[i]))
+            errors++;
+        delete objects[i];
+    }
+    if (objects[64] != nullptr)
+        errors++;
+    MyHashTable::destroy(hashTable);
+
+    cout << "searchBatchTest keys=" << inserted << ",nanos/key search=" << ((microsSearch * 1000.0) / inserted)
+        << ",searchBatch=" << ((microsBatch * 1000.0) / inserted) << ",errors=" << errors << endl;
+    delete[] keys;
+    delete[] results;
+
+    // HashTable keeps pointers, the comparator reads the object and the name
+    const uint32_t namesCount = 1 << 19;
+    char (*bigNames)[12] = new char[namesCount][12];
+    const char **bigKeys = new const char*[namesCount];
+    MyHashObject **bigObjects = new MyHashObject*[namesCount];
+    MyHashObject **bigResults = new MyHashObject*[namesCount];
+    hashTable = MyHashTable::create("searchBatchObjects", 4 * namesCount);
+    inserted = 0;
+    for (uint32_t i = 0;i < namesCount;i++)
+    {
+        sprintf(bigNames[i], "s%u", i);
+        bigObjects[i] = new MyHashObject(bigNames[i]);
+        if (hashTable->insert(bigNames[i], bigObjects[i]) == MyHashTable::INSERT_DONE)
+        {
+            bigKeys[inserted] = bigNames[i];
+            inserted++;
+        }
+    }
+    for (uint32_t i = inserted - 1;i > 0;i--)
+    {
+        std::swap(bigKeys[i], bigKeys[hashMultiplicative(i) % (i + 1)]);
+    }
+    gettimeofday(&start, nullptr);
+    for (uint32_t i = 0;i < inserted;i++)
+    {
+        hashTable->search(bigKeys[i], &bigResults[i]);
+    }
+    gettimeofday(&end, nullptr);
+    microsSearch = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+    gettimeofday(&start, nullptr);
+    found = 0;
+    for (uint32_t i = 0;i < inserted;i += batch)
+    {
+        size_t count = std::min((size_t)(inserted - i), batch);
+        found += hashTable->searchBatch(&bigKeys[i], count, &bigResults[i]);
+    }
+    gettimeofday(&end, nullptr);
+    microsBatch = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+    int objectErrors = (found == inserted) ? 0 : 1;
+    for (uint32_t i = 0;i < inserted;i++)
+    {
+        if (bigResults[i]->name != bigKeys[i])
+            objectErrors++;
+    }
+    cout << "searchBatchTest objects=" << inserted << ",nanos/key search=" << ((microsSearch * 1000.0) / inserted)
+        << ",searchBatch=" << ((microsBatch * 1000.0) / inserted) << ",errors=" << objectErrors << endl;
+    MyHashTable::destroy(hashTable);
+    for (uint32_t i = 0;i < namesCount;i++)
+    {
+        delete bigObjects[i];
+    }
+    delete[] bigObjects;
+    delete[] bigResults;
+    delete[] bigKeys;
+    delete[] bigNames;
+    return ((errors + objectErrors) == 0);
+}
+
+typedef HashTableStriped<struct MyHashObject*, const char*, std::mutex, AllocatorTrivial, struct MyHashObject, struct MyHashObject> MyHashTableStriped;
+
+/**
+ * Threads insert, search and remove different keys while the table grows
+ * The probe window is 3 entries, the table is sparse
+ */
+static int hashTableStripedTest(int cpus)
+{
+    static const int OBJECTS = 2500;
+    static const int SEARCH_LOOPS = 40;
+    static char names[8][OBJECTS][8];
+    static MyHashObject *objects[8][OBJECTS];
+    cpus = std::min(cpus, 8);
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        for (int i = 0;i < OBJECTS;i++)
+        {
+            sprintf(names[cpu][i], "%d.%d", cpu, i);
+            objects[cpu][i] = new MyHashObject(names[cpu][i]);
+        }
+    }
+    MyHashTableStriped *hashTable = MyHashTableStriped::create("myHashTableStriped", 1024);
+    std::atomic<uint32_t> errors(0);
+    std::thread threads[8];
+    struct timeval start, end;
+    gettimeofday(&start, nullptr);
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu] = std::thread([hashTable, &errors, cpu]()
+        {
+            for (int i = 0;i < OBJECTS;i++)
+            {
+                if (hashTable->insert(names[cpu][i], objects[cpu][i], 1024*1024) != MyHashTableStriped::INSERT_DONE)
+                    errors++;
+            }
+            for (int i = 0;i < OBJECTS;i += 2)
+            {
+                if (!hashTable->remove(names[cpu][i]))
+                    errors++;
+            }
+            for (int loop = 0;loop < SEARCH_LOOPS;loop++)
+            {
+                for (int i = 0;i < OBJECTS;i++)
+                {
+                    MyHashObject *o;
+                    bool found = hashTable->search(names[cpu][i], &o);
+                    if ((found != ((i & 1) != 0)) || (found && (o != objects[cpu][i])))
+                        errors++;
+                }
+            }
+        });
+    }
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu].join();
+    }
+    gettimeofday(&end, nullptr);
+    uint64_t micros = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+    if (hashTable->getCount() != (uint_fast32_t)(cpus * OBJECTS / 2))
+        errors++;
+    const MyHashTableStriped::Statistics *statistics = hashTable->getStatistics();
+    // Sharded statistics are exact when the stripes are updated in parallel
+    if (statistics->removeOk != (uint64_t)(cpus * OBJECTS / 2))
+        errors++;
+    if (statistics->searchTotal != (uint64_t)(cpus * OBJECTS * SEARCH_LOOPS))
+        errors++;
+    cout << "hashTableStripedTest threads=" << cpus << ",size=" << hashTable->getSize() << ",count=" << hashTable->getCount()
+        << ",rehash=" << statistics->rehashTotal << ",micros=" << micros << ",errors=" << errors.load() << endl;
+    MyHashTableStriped::destroy(hashTable);
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        for (int i = 0;i < OBJECTS;i++)
+        {
+            delete objects[cpu][i];
+        }
+    }
+    return (errors.load() == 0);
+}
+
+/**
+ * A lock for the writers of HashTableReadMostly
+ */
+class SynchroObjectMutex
+{
+public:
+    static inline void get()
+    {
+        mutex.lock();
+    }
+
+    static inline void release()
+    {
+        mutex.unlock();
+    }
+
+protected:
+    static std::mutex mutex;
+};
+
+std::mutex SynchroObjectMutex::mutex;
+
+typedef Lock<SynchroObjectMutex> LockMutex;
+
+typedef HashTableReadMostly<struct MyHashObject*, const char*, LockMutex, AllocatorTrivial, struct MyHashObject, struct MyHashObject> MyHashTableReadMostly;
+
+/**
+ * Readers look for the keys which are always in the table while a writer adds
+ * and removes other keys and the table grows
+ */
+static int hashTableReadMostlyTest(int readers)
+{
+    static const int OBJECTS = 1000;
+    static const int LOOPS = 20;
+    static char names[2 * OBJECTS][8];
+    static MyHashObject *objects[2 * OBJECTS];
+    for (int i = 0;i < 2 * OBJECTS;i++)
+    {
+        sprintf(names[i], "r%d", i);
+        objects[i] = new MyHashObject(names[i]);
+    }
+    MyHashTableReadMostly *hashTable = MyHashTableReadMostly::create("myHashTableReadMostly", 1024);
+    int errors = 0;
+    for (int i = 0;i < OBJECTS;i++)
+    {
+        if (hashTable->insert(names[i], objects[i], 1024*1024) != MyHashTableReadMostly::INSERT_DONE)
+            errors++;
+    }
+    std::atomic<uint32_t> readErrors(0);
+    std::atomic<bool> done(false);
+    std::thread threads[8];
+    readers = std::min(readers, 8);
+    for (int reader = 0;reader < readers;reader++)
+    {
+        threads[reader] = std::thread([hashTable, &readErrors, &done]()
+        {
+            while (!done.load())
+            {
+                for (int i = 0;i < 2 * OBJECTS;i++)
+                {
+                    MyHashObject *o;
+                    bool found = hashTable->search(names[i], &o);
+                    // The first half is always in the table, the second half comes and goes
+                    if ((i < OBJECTS) && !found)
+                        readErrors++;
+                    if (found && (o != objects[i]))
+                        readErrors++;
+                }
+            }
+        });
+    }
+    for (int loop = 0;loop < LOOPS;loop++)
+    {
+        for (int i = OBJECTS;i < 2 * OBJECTS;i++)
+        {
+            if (hashTable->insert(names[i], objects[i], 1024*1024) != MyHashTableReadMostly::INSERT_DONE)
+                errors++;
+        }
+        for (int i = OBJECTS;i < 2 * OBJECTS;i++)
+        {
+            if (!hashTable->remove(names[i]))
+                errors++;
+        }
+        if (hashTable->rehash(hashTable->getSize() + 1) == MyHashTableReadMostly::INSERT_FAILED)
+            errors++;
+    }
+    done.store(true);
+    for (int reader = 0;reader < readers;reader++)
+    {
+        threads[reader].join();
+    }
+
+    // 64 threads hold the indexes of the EpochReclamation, the next reader takes the lock
+    static const int HOLDERS = 64;
+    std::thread holders[HOLDERS];
+    std::mutex holdMutex;
+    std::atomic<int> holding(0);
+    holdMutex.lock();
+    for (int i = 0;i < HOLDERS;i++)
+    {
+        holders[i] = std::thread([&holdMutex, &holding]()
+        {
+            epochReclamationThreadIndex();
+            holding++;
+            std::lock_guard<std::mutex> hold(holdMutex);
+        });
+    }
+    while (holding.load() < HOLDERS)
+    {
+        std::this_thread::yield();
+    }
+    size_t readerIndex = 0;
+    std::thread lockedReader([hashTable, &readErrors, &readerIndex]()
+    {
+        readerIndex = epochReclamationThreadIndex();
+        for (int i = 0;i < 2 * OBJECTS;i++)
+        {
+            MyHashObject *o;
+            bool found = hashTable->search(names[i], &o);
+            if ((found != (i < OBJECTS)) || (found && (o != objects[i])))
+                readErrors++;
+        }
+    });
+    lockedReader.join();
+    holdMutex.unlock();
+    for (int i = 0;i < HOLDERS;i++)
+    {
+        holders[i].join();
+    }
+    if (readerIndex < HOLDERS)
+        errors++;
+    cout << "hashTableReadMostlyTest readers=" << readers << ",size=" << hashTable->getSize() << ",count=" << hashTable->getCount()
+        << ",rehash=" << hashTable->getStatistics()->rehashTotal << ",errors=" << (errors + readErrors.load()) << endl;
+    MyHashTableReadMostly::destroy(hashTable);
+    for (int i = 0;i < 2 * OBJECTS;i++)
+    {
+        delete objects[i];
+    }
+    return ((errors + readErrors.load()) == 0);
+}
+
+typedef LockfreeHashTable<uint32_t, (uint32_t)-1, uint32_t, (uint32_t)-1, AllocatorTrivial, HashTrivial, HashTableStatisticsSharded<> > MyLockfreeHashTableSharded;
+typedef LockfreeHashTable<uint32_t, (uint32_t)-1, uint32_t, (uint32_t)-1, AllocatorTrivial, HashTrivial, HashTableStatisticsSharded<2> > MyLockfreeHashTableShardedOverflow;
+typedef LockfreeHashTable<uint32_t, (uint32_t)-1, uint32_t, (uint32_t)-1, AllocatorTrivial, HashTrivial, HashTableStatisticsNone> MyLockfreeHashTableNoStatistics;
+typedef HashTable<struct MyHashObject*, const char*, LockDummy, AllocatorTrivial, struct MyHashObject, struct MyHashObject, HashTableStatisticsNone> MyHashTableNoStatistics;
+
+/**
+ * Threads add and remove different keys, compare the cost of the statistics policies
+ * If 'exact' is set the policy shall not lose updates
+ */
+template<typename HashTableType>
+static int hashTableStatisticsTest(const char *name, int cpus, uint32_t loops, bool exact)
+{
+    HashTableType *hashTable = HashTableType::create(name, 16);
+    std::atomic<uint32_t> errors(0);
+    std::thread threads[8];
+    cpus = std::min(cpus, 8);
+    struct timeval start, end;
+    gettimeofday(&start, nullptr);
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu] = std::thread([hashTable, &errors, cpu, loops]()
+        {
+            // 16 entries of 8 bytes apart - the threads do not share cache lines of the table
+            uint32_t key = cpu * 16;
+            for (uint32_t i = 0;i < loops;i++)
+            {
+                if (hashTable->insert(key, key) != HashTableType::INSERT_DONE)
+                    errors++;
+                if (!hashTable->remove(key, nullptr))
+                    errors++;
+            }
+        });
+    }
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu].join();
+    }
+    gettimeofday(&end, nullptr);
+    uint64_t micros = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+    const typename HashTableType::Statistics *statistics = hashTable->getStatistics();
+    const uint64_t total = (uint64_t)cpus * loops;
+    if (exact && ((statistics->insertTotal != total) || (statistics->removeTotal != total) || (hashTable->getCount() != 0)))
+        errors++;
+    cout << "hashTableStatisticsTest " << name << " insertTotal=" << statistics->insertTotal
+        << ",removeTotal=" << statistics->removeTotal << ",count=" << hashTable->getCount()
+        << ",micros=" << micros << ",errors=" << errors.load() << endl;
+    HashTableType::destroy(hashTable);
+    return (errors.load() == 0);
+}
+
+static void hashTableStatisticsTest(void)
+{
+    const uint32_t loops = 2*1000*1000;
+    // The shared counters are approximate without a lock
+    hashTableStatisticsTest<MyLockfreeHashTable>("shared", 4, loops, false);
+    hashTableStatisticsTest<MyLockfreeHashTableSharded>("sharded", 4, loops, true);
+    // Two shards, the threads above the second share the overflow shard
+    hashTableStatisticsTest<MyLockfreeHashTableShardedOverflow>("shardedOverflow", 4, loops, true);
+    hashTableStatisticsTest<MyLockfreeHashTableNoStatistics>("none", 4, loops, false);
+
+    MyHashTableNoStatistics *hashTable = MyHashTableNoStatistics::create("myHashTableNoStatistics", 16);
+    MyHashObject o1("o1");
+    MyHashObject *o;
+    bool ok = (hashTable->insert(MyHashObject::getKey(&o1), &o1) == MyHashTableNoStatistics::INSERT_DONE) &&
+        hashTable->search("o1", &o) && (o == &o1) && (hashTable->getStatistics()->searchTotal == 0);
+    cout << "hashTableStatisticsTest HashTable none " << (ok ? "Ok" : "failed") << endl;
+    MyHashTableNoStatistics::destroy(hashTable);
+}
+
+struct MyFlowCounters
+{
+    uint32_t packets;
+    uint32_t bytes;
+};
+
+typedef HashTableFlat<uint64_t, MyFlowCounters, LockDummy, AllocatorTrivial> MyHashTableFlat;
+
+static void hashTableFlatTest(void)
+{
+    static const uint64_t FLOWS = 10*1000;
+    MyHashTableFlat *hashTable = MyHashTableFlat::create("myHashTableFlat", 1024);
+    int errors = 0;
+    for (uint64_t flow = 0;flow < FLOWS;flow++)
+    {
+        MyFlowCounters counters = {(uint32_t)flow, 0};
+        if (hashTable->insert(flow << 20, counters, 1024*1024) != MyHashTableFlat::INSERT_DONE)
+            errors++;
+    }
+    MyFlowCounters duplicate = {0, 0};
+    if (hashTable->insert(0, duplicate) != MyHashTableFlat::INSERT_DUPLICATE)
+        errors++;
+    for (uint64_t flow = 0;flow < FLOWS;flow++)
+    {
+        MyFlowCounters *counters = hashTable->find(flow << 20);
+        if ((counters == nullptr) || (counters->packets != flow))
+        {
+            errors++;
+            continue;
+        }
+        counters->bytes += 64;
+    }
+    for (uint64_t flow = 0;flow < FLOWS;flow += 2)
+    {
+        if (!hashTable->remove(flow << 20))
+            errors++;
+    }
+    for (uint64_t flow = 0;flow < FLOWS;flow++)
+    {
+        MyFlowCounters counters;
+        bool found = hashTable->search(flow << 20, &counters);
+        if ((found != ((flow & 1) != 0)) || (found && (counters.bytes != 64)))
+            errors++;
+    }
+    uint_fast32_t index = 0;
+    uint64_t flow;
+    MyFlowCounters counters;
+    uint32_t count = 0;
+    while (hashTable->getNext(index, &flow, &counters) != MyHashTableFlat::GETNEXT_END_TABLE)
+    {
+        if (counters.packets != (flow >> 20))
+            errors++;
+        count++;
+        index++;
+    }
+    cout << "hashTableFlatTest size=" << hashTable->getSize() << ",count=" << hashTable->getCount()
+        << ",getNext=" << count << ",errors=" << errors << endl;
+    MyHashTableFlat::destroy(hashTable);
+}
+typedef LockfreeHashTableMultiWriter<uint32_t, (uint32_t)-1, uint32_t, (uint32_t)-1, AllocatorTrivial, HashPolicy<uint32_t> > MyLockfreeHashTableMultiWriter;
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+typedef LockfreeHashTableMultiWriter<uint64_t, (uint64_t)-1, uint64_t, (uint64_t)-1, AllocatorTrivial, HashPolicy<uint64_t> > MyLockfreeHashTableMultiWriter128;
+#endif
+
+/**
+ * All threads insert, update and remove the same keys. The data carries the key, a reader
+ * should never see data of another key
+ */
+template<typename HashTableType, typename Key>
+static int lockfreeHashTableMultiWriterTest(const char *name, int cpus, uint32_t loops)
+{
+    static const Key KEYS = 1024;
+    HashTableType *hashTable = HashTableType::create(name, 12);
+    std::atomic<uint32_t> errors(0);
+    std::thread threads[8];
+    cpus = std::min(cpus, 8);
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu] = std::thread([hashTable, &errors, cpu, loops]()
+        {
+            for (uint32_t loop = 0;loop < loops;loop++)
+            {
+                for (Key key = 0;key < KEYS;key++)
+                {
+                    Key data = (key << 3) | cpu;
+                    if (hashTable->insert(key, data) == HashTableType::INSERT_FAILED)
+                        errors++;
+                    if (hashTable->search(key, &data) && ((data >> 3) != key))
+                        errors++;
+                    if (((key + loop + cpu) & 1) && hashTable->remove(key, &data) && ((data >> 3) != key))
+                        errors++;
+                }
+            }
+        });
+    }
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu].join();
+    }
+    uint32_t found = 0;
+    for (Key key = 0;key < KEYS;key++)
+    {
+        Key data;
+        if (hashTable->search(key, &data))
+        {
+            if ((data >> 3) != key)
+                errors++;
+            found++;
+        }
+    }
+    if (found != hashTable->getCount())
+        errors++;
+    if (hashTable->insert((Key)-1, 0) != HashTableType::INSERT_FAILED)
+        errors++;
+    // IllegalData marks a dead slot, the key would be counted and not found
+    Key data;
+    if (hashTable->insert(KEYS, (Key)-1) != HashTableType::INSERT_FAILED)
+        errors++;
+    if ((hashTable->getCount() != found) || hashTable->search(KEYS, &data))
+        errors++;
+    cout << "lockfreeHashTableMultiWriterTest " << name << " cpus=" << cpus << ",count=" << hashTable->getCount()
+        << ",found=" << found << ",insertDuplicate=" << hashTable->getStatistics()->insertDuplicate
+        << ",errors=" << errors.load() << endl;
+    HashTableType::destroy(hashTable);
+    return (errors.load() == 0);
+}
+
+/**
+ * A small table and a stream of new keys. The keys fit the table only if insert() reuses
+ * the slots of the removed keys. Threads insert the same keys at the same time, the table
+ * shall not keep two copies of a key
+ */
+static int lockfreeHashTableMultiWriterChurnTest(int cpus, uint32_t keys)
+{
+    static const uint32_t WINDOW = 4;
+    MyLockfreeHashTableMultiWriter *hashTable = MyLockfreeHashTableMultiWriter::create("myLockfreeHashTableMultiWriterChurn", 6);
+    std::atomic<uint32_t> errors(0);
+    std::thread threads[8];
+    cpus = std::min(cpus, 8);
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu] = std::thread([hashTable, &errors, cpu, keys]()
+        {
+            for (uint32_t key = 0;key < keys;key++)
+            {
+                uint32_t data = (key << 3) | cpu;
+                if (hashTable->insert(key, data) == MyLockfreeHashTableMultiWriter::INSERT_FAILED)
+                    errors++;
+                if ((key >= WINDOW) && hashTable->remove(key - WINDOW, &data) && ((data >> 3) != (key - WINDOW)))
+                    errors++;
+            }
+        });
+    }
+    for (int cpu = 0;cpu < cpus;cpu++)
+    {
+        threads[cpu].join();
+    }
+    // The last keys are in the table once
+    uint32_t found = 0;
+    for (uint32_t key = keys - WINDOW;key < keys;key++)
+    {
+        uint32_t data;
+        if (hashTable->search(key, &data) && ((data >> 3) == key))
+            found++;
+    }
+    if ((found != WINDOW) || (hashTable->getCount() != WINDOW))
+        errors++;
+    cout << "lockfreeHashTableMultiWriterChurnTest cpus=" << cpus << ",count=" << hashTable->getCount()
+        << ",insertFailed=" << hashTable->getStatistics()->insertFailed << ",errors=" << errors.load() << endl;
+    MyLockfreeHashTableMultiWriter::destroy(hashTable);
+    return (errors.load() == 0);
+}
+typedef HashTableImage<uint32_t, uint32_t> MyLockfreeHashTableImage;
+typedef HashTableImage<const char*, uint32_t> MyHashTableImage;
+
+/**
+ * Copy the image and modify the copy, the checksum matches - a crafted file
+ */
+template<typename Patch> static void hashTableImagePatch(const char *path, const char *copyPath, Patch patch)
+{
+    MappedFile source(path);
+    MappedFile copy(copyPath, source.getSize());
+    uint8_t *address = copy.getAddress();
+    memcpy(address, source.getAddress(), source.getSize());
+    HashTableImageHeader *header = (HashTableImageHeader*)address;
+    patch(header, address);
+    header->checksum = MappedFile::checksum(address + MyHashTableImage::HEADER_SIZE, copy.getSize() - MyHashTableImage::HEADER_SIZE);
+}
+
+/**
+ * Save a LockfreeHashTable and a HashTable to files, map the files and search
+ */
+static void hashTableImageTest(void)
+{
+    static const uint32_t KEYS = 1000;
+    static const char *lockfreePath = "/tmp/emcpp.lockfreeHashTable.image";
+    static const char *hashTablePath = "/tmp/emcpp.hashTable.image";
+    static const char *craftedPath = "/tmp/emcpp.crafted.image";
+    int errors = 0;
+
+    MyLockfreeHashTable *lockfreeHashTable = MyLockfreeHashTable::create("image", 12);
+    for (uint32_t key = 0;key < KEYS;key++)
+    {
+        lockfreeHashTable->insert(key, key * 2);
+    }
+    uint32_t inserted = lockfreeHashTable->getCount();
+    if (!MyLockfreeHashTableImage::save(lockfreePath, *lockfreeHashTable, 0x1234))
+        errors++;
+    MyLockfreeHashTable::destroy(lockfreeHashTable);
+    {
+        MyLockfreeHashTableImage image(lockfreePath);
+        if (!image.isLoaded() || !image.verify() || (image.getCount() != inserted))
+            errors++;
+        uint32_t found = 0;
+        for (uint32_t key = 0;key < KEYS;key++)
+        {
+            uint32_t value;
+            if (image.search(key, &value))
+            {
+                found++;
+                if (value != key * 2)
+                    errors++;
+            }
+        }
+        uint32_t value;
+        if ((found != inserted) || image.search(KEYS, &value))
+            errors++;
+    }
+
+    MyHashTable *hashTable = MyHashTable::create("image", 64);
+    MyHashObject objects[] = {MyHashObject("eth0"), MyHashObject("eth1"), MyHashObject("lo")};
+    for (MyHashObject &object : objects)
+    {
+        hashTable->insert(object.name, &object);
+    }
+    bool saved = MyHashTableImage::saveObjects<MyHashObject*>(hashTablePath, *hashTable,
+        [](MyHashObject *object) { return object->name; },
+        [](MyHashObject *object) { return (uint32_t)strlen(object->name); });
+    MyHashTable::destroy(hashTable);
+    {
+        MyHashTableImage image(hashTablePath);
+        uint32_t value;
+        if (!saved || !image.isLoaded() || !image.verify() || (image.getCount() != 3))
+            errors++;
+        if (!image.search("eth1", &value) || (value != 4) || !image.search("lo", &value) || (value != 2))
+            errors++;
+        if (image.search("eth2", &value))
+            errors++;
+    }
+    // An image of another layout is not loaded
+    {
+        MyHashTableImage image(lockfreePath);
+        if (image.isLoaded())
+            errors++;
+    }
+    // Crafted images with a correct checksum: the last string is not terminated, an offset
+    // of a string is outside of the keys, the number of slots overflows the size of the slots
+    struct StringSlot
+    {
+        uint64_t key;
+        uint32_t value;
+        uint32_t hash;
+        uint32_t used;
+    };
+    hashTableImagePatch(hashTablePath, craftedPath, [](HashTableImageHeader *header, uint8_t *address)
+    {
+        address[header->keysOffset + header->keysSize - 1] = 'x';
+    });
+    {
+        MyHashTableImage image(craftedPath);
+        if (!image.isLoaded() || image.verify())
+            errors++;
+    }
+    hashTableImagePatch(hashTablePath, craftedPath, [&errors](HashTableImageHeader *header, uint8_t *address)
+    {
+        if (header->slotSize != sizeof(StringSlot))
+            errors++;
+        StringSlot *slots = (StringSlot*)(address + MyHashTableImage::HEADER_SIZE);
+        for (uint64_t i = 0;i < header->size;i++)
+        {
+            if (slots[i].used)
+            {
+                slots[i].key = header->keysSize;
+                break;
+            }
+        }
+    });
+    {
+        MyHashTableImage image(craftedPath);
+        if (!image.isLoaded() || image.verify())
+            errors++;
+    }
+    hashTableImagePatch(hashTablePath, craftedPath, [](HashTableImageHeader *header, uint8_t *address)
+    {
+        // 2^61 slots of 24 bytes wrap to zero bytes
+        uint64_t fileSize = header->keysOffset + header->keysSize;
+        header->size = 1ULL << 61;
+        header->keysOffset = MyHashTableImage::HEADER_SIZE;
+        header->keysSize = fileSize - MyHashTableImage::HEADER_SIZE;
+    });
+    {
+        MyHashTableImage image(craftedPath);
+        if (image.isLoaded())
+            errors++;
+    }
+    unlink(lockfreePath);
+    unlink(hashTablePath);
+    unlink(craftedPath);
+    cout << "hashTableImageTest count=" << inserted << ",errors=" << errors << endl;
+}
+constexpr const char *myCommands[] = {"get", "set", "delete", "stats", "incr", "decr", "touch", "flush_all",
+    "version", "quit", "append", "prepend", "cas", "gets", "verbosity", "add", "replace"};
+typedef PerfectHash<const char*, sizeof(myCommands)/sizeof(myCommands[0]), myCommands, 64> MyCommandsHash;
+static_assert(MyCommandsHash::find("delete") == 2, "Perfect hash of the commands is broken");
+static_assert(MyCommandsHash::find("deleted") == -1, "Perfect hash of the commands is broken");
+
+constexpr uint16_t myOpcodes[] = {0x01, 0x02, 0x07, 0x80, 0x81, 0x300, 0x1000, 0xFFFF};
+typedef PerfectHash<uint16_t, sizeof(myOpcodes)/sizeof(myOpcodes[0]), myOpcodes> MyOpcodesHash;
+
+/**
+ * A generated list of keys - the table of hundreds of keys is still O(N) slots
+ */
+template<typename Indexes> struct MyPerfectHashKeys;
+
+template<size_t... I> struct MyPerfectHashKeys<PerfectHashIndexes<I...> >
+{
+    static constexpr uint32_t keys[sizeof...(I)] = {(uint32_t)(I * 7919 + 1)...};
+};
+
+template<size_t... I> constexpr uint32_t MyPerfectHashKeys<PerfectHashIndexes<I...> >::keys[sizeof...(I)];
+
+static const size_t MY_PERFECT_HASH_KEYS = 256;
+typedef MyPerfectHashKeys<PerfectHashMakeIndexes<MY_PERFECT_HASH_KEYS>::Type> MyManyKeys;
+typedef PerfectHash<uint32_t, MY_PERFECT_HASH_KEYS, MyManyKeys::keys> MyManyKeysHash;
+
+static void perfectHashTest(void)
+{
+    int errors = 0;
+    for (size_t i = 0;i < sizeof(myCommands)/sizeof(myCommands[0]);i++)
+    {
+        // Not a literal - a copy on the stack
+        char command[16];
+        strcpy(command, myCommands[i]);
+        if (MyCommandsHash::find(command) != (int)i)
+            errors++;
+    }
+    if ((MyCommandsHash::find("gett") != -1) || (MyCommandsHash::find("") != -1))
+        errors++;
+    for (size_t i = 0;i < sizeof(myOpcodes)/sizeof(myOpcodes[0]);i++)
+    {
+        if (MyOpcodesHash::find(myOpcodes[i]) != (int)i)
+            errors++;
+    }
+    if (MyOpcodesHash::find(0x03) != -1)
+        errors++;
+    for (size_t i = 0;i < MY_PERFECT_HASH_KEYS;i++)
+    {
+        if (MyManyKeysHash::find(MyManyKeys::keys[i]) != (int)i)
+            errors++;
+    }
+    if (MyManyKeysHash::find(2) != -1)
+        errors++;
+    cout << "perfectHashTest commands size=" << MyCommandsHash::getSize()
+        << ",displacement=" << MyCommandsHash::getMaxDisplacement()
+        << ",opcodes size=" << MyOpcodesHash::getSize() << ",displacement=" << MyOpcodesHash::getMaxDisplacement()
+        << ",keys=" << MY_PERFECT_HASH_KEYS << ",size=" << MyManyKeysHash::getSize()
+        << ",buckets=" << MyManyKeysHash::getBuckets() << ",displacement=" << MyManyKeysHash::getMaxDisplacement()
+        << ",errors=" << errors << endl;
+}
+typedef HashTableCuckoo<uint32_t, uint32_t, LockDummy, AllocatorTrivial> MyHashTableCuckoo;
+typedef HashTableCuckoo<uint64_t, uint64_t, LockDummy, AllocatorTrivial> MyHashTableCuckoo64;
+
+/**
+ * Fill the table until the first insert fails, check the load factor. For 64 bits keys
+ * the random number is in both halves of the key
+ */
+template<typename HashTableType, typename Key>
+static void hashTableCuckooTest(const char *name, double minLoadFactor)
+{
+    HashTableType *hashTable = HashTableType::create(name, 64*1024);
+    int errors = 0;
+    uint32_t keys = 0;
+    uint32_t random = 1;
+    while (true)
+    {
+        random = random * 1103515245 + 12345;
+        if (hashTable->insert((Key)random * (Key)0x100000001ull, keys) != HashTableType::INSERT_DONE)
+            break;
+        keys++;
+    }
+    double loadFactor = hashTable->getLoadFactor();
+    if (loadFactor < minLoadFactor)
+        errors++;
+    random = 1;
+    for (uint32_t i = 0;i < keys;i++)
+    {
+        random = random * 1103515245 + 12345;
+        Key value;
+        if (!hashTable->search((Key)random * (Key)0x100000001ull, &value) || (value != i))
+            errors++;
+        if ((i & 1) && !hashTable->remove((Key)random * (Key)0x100000001ull))
+            errors++;
+    }
+    uint_fast32_t index = 0;
+    Key key, value;
+    uint32_t count = 0;
+    while (hashTable->getNext(index, &key, &value) != HashTableType::GETNEXT_END_TABLE)
+    {
+        if (value & 1)
+            errors++;
+        count++;
+        index++;
+    }
+    if (count != hashTable->getCount())
+        errors++;
+    // Grow the table
+    uint32_t size = hashTable->getSize();
+    for (uint32_t i = 0;i < size;i++)
+    {
+        if (hashTable->insert(0x80000000 | i, i, 4 * size) != HashTableType::INSERT_DONE)
+            errors++;
+    }
+    if (!hashTable->search(0x80000000, &value) || (value != 0))
+        errors++;
+    cout << "hashTableCuckooTest " << name << " slots=" << HashTableType::SLOTS << ",loadFactor=" << loadFactor
+        << ",insertHashCollision=" << hashTable->getStatistics()->insertHashCollision
+        << ",size=" << hashTable->getSize() << ",count=" << hashTable->getCount() << ",errors=" << errors << endl;
+    HashTableType::destroy(hashTable);
+}
+typedef HashTable<struct MyHashObject*, const char*, LockMutex, AllocatorTrivial, struct MyHashObject, struct MyHashObject> MyHashTableMutex;
+typedef ObjectRegistry<MyHashObject*, 16> MyObjectRegistry;
+
+/**
+ * A writer adds and removes objects while the main thread takes snapshots
+ * of a HashTable and of an ObjectRegistry
+ */
+static int hashTableSnapshotTest(void)
+{
+    static const int OBJECTS = 1000;
+    static const int SNAPSHOTS = 200;
+    static char names[2 * OBJECTS][8];
+    static MyHashObject *objects[2 * OBJECTS];
+    for (int i = 0;i < 2 * OBJECTS;i++)
+    {
+        sprintf(names[i], "s%d", i);
+        objects[i] = new MyHashObject(names[i]);
+    }
+    MyHashTableMutex *hashTable = MyHashTableMutex::create("myHashTableSnapshot", 8192);
+    int errors = 0;
+    for (int i = 0;i < OBJECTS;i++)
+    {
+        if (hashTable->insert(names[i], objects[i]) != MyHashTableMutex::INSERT_DONE)
+            errors++;
+    }
+    MyObjectRegistry::addRegistration(objects[0]);
+    std::atomic<bool> done(false);
+    std::thread writer([hashTable, &done]()
+    {
+        while (!done.load())
+        {
+            for (int i = OBJECTS;i < 2 * OBJECTS;i++)
+            {
+                hashTable->insert(names[i], objects[i]);
+                if (i < OBJECTS + 8)
+                    MyObjectRegistry::addRegistration(objects[i]);
+            }
+            for (int i = OBJECTS;i < 2 * OBJECTS;i++)
+            {
+                hashTable->remove(names[i]);
+                if (i < OBJECTS + 8)
+                    MyObjectRegistry::removeRegistration(objects[i]);
+            }
+        }
+    });
+    uint32_t maxCount = 0;
+    for (int loop = 0;loop < SNAPSHOTS;loop++)
+    {
+        MyHashTableMutex::Snapshot snapshot(*hashTable);
+        if (!snapshot.isValid())
+            errors++;
+        uint_fast32_t index = 0;
+        MyHashObject *o;
+        int stable = 0;
+        while (snapshot.getNext(index, &o) != MyHashTableMutex::GETNEXT_END_TABLE)
+        {
+            // The first half is always in the table
+            int i = atoi(o->name + 1);
+            if ((i < 0) || (i >= 2 * OBJECTS) || (objects[i] != o))
+                errors++;
+            if (i < OBJECTS)
+                stable++;
+            index++;
+        }
+        if (stable != OBJECTS)
+            errors++;
+        maxCount = std::max(maxCount, (uint32_t)snapshot.getCount());
+
+        MyObjectRegistry::Snapshot registrySnapshot;
+        index = 0;
+        bool first = false;
+        while (registrySnapshot.getNext(index, &o) != MyObjectRegistry::GETNEXT_END_TABLE)
+        {
+            first = first || (o == objects[0]);
+            index++;
+        }
+        if (!first)
+            errors++;
+    }
+    done.store(true);
+    writer.join();
+    for (int i = 0;i < OBJECTS + 8;i++)
+    {
+        MyObjectRegistry::removeRegistration(objects[i]);
+    }
+    cout << "hashTableSnapshotTest snapshots=" << SNAPSHOTS << ",maxCount=" << maxCount << ",errors=" << errors << endl;
+    MyHashTableMutex::destroy(hashTable);
+    for (int i = 0;i < 2 * OBJECTS;i++)
+    {
+        delete objects[i];
+    }
+    return (errors == 0);
 }
 #endif  // EXAMPLE == 10
 
@@ -1300,7 +3191,32 @@ int main()
 #if (EXAMPLE == 10)
     lockfreeHashTableTest(4);
     lockfreeHashTableSpeedTest(100*1000*1000);
+    lockfreeHashTableResizableTest(4, 50*1000);
+    lockfreeHashTableResizableChurnTest(1, 5000);
+    lockfreeHashTableResizableChurnTest(4, 50*1000);
     hashTableTest();
+    hashTableIncrementalRehashTest();
+    hashTableSwissTest();
+    hashTableSwissChurnTest();
+    hashTableRobinHoodTest();
+    hashFunctionsTest();
+    searchBatchTest();
+    hashTableStripedTest(1);
+    hashTableStripedTest(4);
+    hashTableReadMostlyTest(3);
+    hashTableStatisticsTest();
+    hashTableFlatTest();
+    lockfreeHashTableMultiWriterTest<MyLockfreeHashTableMultiWriter, uint32_t>("64bits", 4, 1000);
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+    lockfreeHashTableMultiWriterTest<MyLockfreeHashTableMultiWriter128, uint64_t>("128bits", 4, 200);
+#endif
+    lockfreeHashTableMultiWriterChurnTest(1, 100*1000);
+    lockfreeHashTableMultiWriterChurnTest(4, 100*1000);
+    hashTableImageTest();
+    perfectHashTest();
+    hashTableCuckooTest<MyHashTableCuckoo, uint32_t>("32bits", 0.9);
+    hashTableCuckooTest<MyHashTableCuckoo64, uint64_t>("64bits", 0.85);
+    hashTableSnapshotTest();
 #endif
 
 #if (EXAMPLE != 10)
@@ -1327,6 +3243,17 @@ int main()
     fastPoolPrint();
     fastPoolFree(p2);
     fastPoolPrint();
+    testIndexPool();
+    testMemoryRegionFile();
+    mainExample9();
+    testBufferChain();
+    testBufferChainHeadroom();
+    testPooledBuffer();
+    testCompactingPool();
+    testEpochReclamation();
+    testMemoryPoolReport();
+    testMemoryPoolCarving();
+    testMemoryPoolBitmap();
 
     testNamedContainerFinal();
     testNamedContainer();